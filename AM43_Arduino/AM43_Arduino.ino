@@ -12,14 +12,26 @@
 
 #include "mqtt.h"
 #include "am43.h"
+#include "http.h"
+#include "multicast.h"
+#include "rules.h"
+#include "battery.h"
+#include "warmstart.h"
+#include "calibration.h"
+#include "scheduler.h"
+#include "config.h"
+#include "crc.h"
 
 #define PIN_LED           2
 #define CONFIG_VER        1       // Change this if there is changes in parameters and config must be refreshed
+#define NTP_SERVER        "pool.ntp.org"
+#define CONFIG_JSON_DOC_N (JSON_OBJECT_SIZE(10) + 256) // Legacy config keys and copied strings
 
 Ticker ticker;
 WiFiManager wifi_manager;
   
-const char* config_filename = "/config.json";
+const char* config_filename = "/config.bin";
+const char* config_json_filename = "/config.json"; // Legacy config, migrated to binary once
 
 // !!!!!!!!!!!!!!!!!!!!!!! CHANGE THIS PASSWORD !!!!!!!!!!!!!!!!!!!!!!!
 // !!!!!!!!!!!!!!!!!!!!!!! CHANGE THIS PASSWORD !!!!!!!!!!!!!!!!!!!!!!!
@@ -32,6 +44,15 @@ char mqtt_port[6] = "8080";
 char mqtt_topic[32] = "am43-default";
 char mqtt_user[16] = {0};
 char mqtt_pass[24] = {0};
+char mqtt_group[32] = {0};
+char udp_group[6] = "0";
+char udp_node[4] = "0";
+char time_zone[40] = "UTC0";    // POSIX TZ string, used to keep blinds MCU clock in sync
+
+// Cached access point
+uint8_t wifi_bssid[6] = {0};
+int32_t wifi_channel = 0;
+bool wifi_cached = false;
 
 bool should_save_settings = false;
 void SaveConfigCallback()
@@ -58,8 +79,12 @@ void setup()
   
   Serial.begin(AM43_BAUD);
 
+  // Last known state is published as stale right after MQTT connects
+  WarmStart.Restore();
+
   // Try to load config
   bool config_ok = LoadSettings();
+  const unsigned long boot_config_ms = millis();
 
   wifi_manager.setDebugOutput(false);
   wifi_manager.setSaveConfigCallback(SaveConfigCallback);
@@ -72,11 +97,19 @@ void setup()
   WiFiManagerParameter custom_mqtt_topic("topic", "mqtt topic", mqtt_topic, 32);
   WiFiManagerParameter custom_mqtt_user("user", "mqtt user", mqtt_user, 16);
   WiFiManagerParameter custom_mqtt_pass("pass", "mqtt pass", mqtt_pass, 24);
+  WiFiManagerParameter custom_mqtt_group("group", "mqtt group topic", mqtt_group, 32);
+  WiFiManagerParameter custom_udp_group("udp_group", "udp group id (0 - off)", udp_group, 6);
+  WiFiManagerParameter custom_udp_node("udp_node", "udp node id (1-254)", udp_node, 4);
+  WiFiManagerParameter custom_time_zone("tz", "time zone (POSIX TZ)", time_zone, 40);
   wifi_manager.addParameter(&custom_mqtt_server);
   wifi_manager.addParameter(&custom_mqtt_port);
   wifi_manager.addParameter(&custom_mqtt_user);
   wifi_manager.addParameter(&custom_mqtt_pass);
   wifi_manager.addParameter(&custom_mqtt_topic);
+  wifi_manager.addParameter(&custom_mqtt_group);
+  wifi_manager.addParameter(&custom_udp_group);
+  wifi_manager.addParameter(&custom_udp_node);
+  wifi_manager.addParameter(&custom_time_zone);
   
   // If wifi fails to connect it will create an esp_ssid access point
   // Fill esp_ssid if it's not set with esp_ssid_fmt and MAC address
@@ -86,7 +119,18 @@ void setup()
   }
 
   bool wifi_result = false;
-  if(config_ok)
+  bool wifi_fast = false;
+  if(config_ok && wifi_cached)
+  {
+    // Connect directly to last access point, skips scan
+    wifi_fast = wifi_result = FastConnect();
+  }
+  
+  if(wifi_result)
+  {
+    // Already connected to cached access point
+  }
+  else if(config_ok)
   {
     // Try to connect and start config portal if failed
     wifi_result = wifi_manager.autoConnect(esp_ssid, passwd);
@@ -109,11 +153,10 @@ void setup()
   strcpy(mqtt_topic, custom_mqtt_topic.getValue());
   strcpy(mqtt_user, custom_mqtt_user.getValue());
   strcpy(mqtt_pass, custom_mqtt_pass.getValue());
-  if(should_save_settings)
-  {
-    SaveSettings();
-  }
-
+  strcpy(mqtt_group, custom_mqtt_group.getValue());
+  strcpy(udp_group, custom_udp_group.getValue());
+  strcpy(udp_node, custom_udp_node.getValue());
+  strcpy(time_zone, custom_time_zone.getValue());
   ticker.detach();
   
   // Wait for wifi connection
@@ -121,16 +164,41 @@ void setup()
   {
     delay(500);
   }
+  const unsigned long boot_wifi_ms = millis();
+
+  // Remember access point for next boot
+  if(!wifi_cached || wifi_channel != WiFi.channel() || memcmp(wifi_bssid, WiFi.BSSID(), sizeof(wifi_bssid)) != 0)
+  {
+    memcpy(wifi_bssid, WiFi.BSSID(), sizeof(wifi_bssid));
+    wifi_channel = WiFi.channel();
+    wifi_cached = true;
+    should_save_settings = true;
+  }
+  
+  if(should_save_settings)
+  {
+    SaveSettings();
+  }
 
   // Setup OTA
   ArduinoOTA.setHostname(esp_ssid);
   ArduinoOTA.setPassword(passwd);
   ArduinoOTA.begin();
 
+  // Local time source for blinds MCU clock
+  configTime(time_zone, NTP_SERVER);
+
   // Init AM43 comms
   AM43.Init(&Serial);
 
-  Mqtt.Init(esp_ssid, mqtt_user, mqtt_pass, mqtt_server, atoi(mqtt_port), mqtt_topic);
+  Mqtt.Init(esp_ssid, mqtt_user, mqtt_pass, mqtt_server, atoi(mqtt_port), mqtt_topic, mqtt_group);
+  Mqtt.SetBootTimes(boot_config_ms, boot_wifi_ms, wifi_fast);
+
+  // Local HTTP API, stays available if MQTT broker is down
+  Http.Init();
+
+  // Multicast fleet control, disabled if group or node is 0
+  Multicast.Init(atoi(udp_group), atoi(udp_node));
   
   digitalWrite(PIN_LED, HIGH);
 }
@@ -139,9 +207,43 @@ void loop()
 {
   ArduinoOTA.handle();
 
+  // Periodic AM43 polling and MQTT reconnect/publish
+  Scheduler.Run();
+
   AM43.Loop();
 
+  Calibration.Loop();
+
+  // Local rules react to fresh AM43 state in same loop pass
+  Rules.Loop();
+
+  Battery.Loop();
+
+  WarmStart.Loop();
+
   Mqtt.Loop();
+
+  Http.Loop();
+
+  Multicast.Loop();
+
+  // Sleep until next timer deadline unless MCU reply or network input is waiting
+  Scheduler.Idle(Serial.available() > 0 || Mqtt.HasPendingInput() || Http.HasPendingInput() || Multicast.HasPendingInput());
+}
+
+bool FastConnect()
+{
+  WiFi.mode(WIFI_STA);
+  // SSID and password are kept by SDK from last successful connection
+  WiFi.begin(WiFi.SSID().c_str(), WiFi.psk().c_str(), wifi_channel, wifi_bssid);
+
+  const unsigned long start = millis();
+  while(WiFi.status() != WL_CONNECTED && millis() - start < CONFIG_WIFI_FAST_MS)
+  {
+    delay(10);
+  }
+
+  return WiFi.status() == WL_CONNECTED;
 }
 
 bool LoadSettings()
@@ -150,38 +252,83 @@ bool LoadSettings()
   {
     if(SPIFFS.exists(config_filename))
     {
-      // Parse json config file
-      File jsonFile = SPIFFS.open(config_filename, "r");
-      if(jsonFile)
+      File configFile = SPIFFS.open(config_filename, "r");
+      if(configFile)
       {
-        size_t size = jsonFile.size();
+        ConfigRecord record;
+        const bool read_ok = configFile.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record);
+        configFile.close();
         
-        // Allocate a buffer to store contents of the file.
-        std::unique_ptr<char[]> jsonBuf(new char[size]);
-        jsonFile.readBytes(jsonBuf.get(), size);
-        DynamicJsonDocument jsonDoc(1024);
-        DeserializationError error = deserializeJson(jsonDoc, jsonBuf.get());
-        if(!error)
+        if(read_ok &&
+          record.Magic == CONFIG_MAGIC &&
+          record.Version == CONFIG_BIN_VER &&
+          record.Size == sizeof(record) &&
+          record.Crc == Crc32(reinterpret_cast<const uint8_t*>(&record), offsetof(ConfigRecord, Crc)))
         {
-          int config_ver = jsonDoc["config_ver"];
-          
-          strcpy(mqtt_server, jsonDoc["mqtt_server"]);
-          strcpy(mqtt_port, jsonDoc["mqtt_port"]);
-            
-          if(config_ver == CONFIG_VER)
-          {
-            strcpy(mqtt_topic, jsonDoc["mqtt_topic"]);
-            strcpy(mqtt_user, jsonDoc["mqtt_user"]);
-            strcpy(mqtt_pass, jsonDoc["mqtt_pass"]);
-          }
-          
-          jsonFile.close();
+          strlcpy(mqtt_server, record.MqttServer, sizeof(mqtt_server));
+          strlcpy(mqtt_port, record.MqttPort, sizeof(mqtt_port));
+          strlcpy(mqtt_topic, record.MqttTopic, sizeof(mqtt_topic));
+          strlcpy(mqtt_user, record.MqttUser, sizeof(mqtt_user));
+          strlcpy(mqtt_pass, record.MqttPass, sizeof(mqtt_pass));
+          strlcpy(mqtt_group, record.MqttGroup, sizeof(mqtt_group));
+          strlcpy(udp_group, record.UdpGroup, sizeof(udp_group));
+          strlcpy(udp_node, record.UdpNode, sizeof(udp_node));
+          strlcpy(time_zone, record.TimeZone, sizeof(time_zone));
 
-          return config_ver == CONFIG_VER;
+          memcpy(wifi_bssid, record.WifiBssid, sizeof(wifi_bssid));
+          wifi_channel = record.WifiChannel;
+          wifi_cached = record.WifiValid != 0;
+          
+          return true;
         }
+      }
+    }
+    
+    return MigrateJsonSettings();
+  }
+
+  return false;
+}
+
+// Read legacy JSON config and convert it to binary record
+bool MigrateJsonSettings()
+{
+  if(!SPIFFS.exists(config_json_filename))
+  {
+    return false;
+  }
+  
+  // Parse json config file straight from file, document lives on stack
+  File jsonFile = SPIFFS.open(config_json_filename, "r");
+  if(jsonFile)
+  {
+    StaticJsonDocument<CONFIG_JSON_DOC_N> jsonDoc;
+    DeserializationError error = deserializeJson(jsonDoc, jsonFile);
+    jsonFile.close();
+    
+    if(!error)
+    {
+      int config_ver = jsonDoc["config_ver"];
+      
+      strlcpy(mqtt_server, jsonDoc["mqtt_server"] | "", sizeof(mqtt_server));
+      strlcpy(mqtt_port, jsonDoc["mqtt_port"] | "", sizeof(mqtt_port));
         
-        jsonFile.close();
+      if(config_ver == CONFIG_VER)
+      {
+        strlcpy(mqtt_topic, jsonDoc["mqtt_topic"] | "", sizeof(mqtt_topic));
+        strlcpy(mqtt_user, jsonDoc["mqtt_user"] | "", sizeof(mqtt_user));
+        strlcpy(mqtt_pass, jsonDoc["mqtt_pass"] | "", sizeof(mqtt_pass));
+        // Group is optional and missing in configs saved by older firmware
+        strlcpy(mqtt_group, jsonDoc["mqtt_group"] | "", sizeof(mqtt_group));
+        strlcpy(udp_group, jsonDoc["udp_group"] | "0", sizeof(udp_group));
+        strlcpy(udp_node, jsonDoc["udp_node"] | "0", sizeof(udp_node));
+        strlcpy(time_zone, jsonDoc["time_zone"] | "UTC0", sizeof(time_zone));
+
+        SaveSettings();
+        SPIFFS.remove(config_json_filename);
       }
+
+      return config_ver == CONFIG_VER;
     }
   }
 
@@ -191,19 +338,33 @@ bool LoadSettings()
 void SaveSettings()
 {
   if(ESP.getFlashChipRealSize() == ESP.getFlashChipSize() && SPIFFS.begin())
-  {   
-    DynamicJsonDocument jsonDoc(1024);
-    jsonDoc["mqtt_server"] = mqtt_server;
-    jsonDoc["mqtt_port"] = mqtt_port;
-    jsonDoc["mqtt_user"] = mqtt_user;
-    jsonDoc["mqtt_pass"] = mqtt_pass;
-    jsonDoc["mqtt_topic"] = mqtt_topic;
-    jsonDoc["config_ver"] = CONFIG_VER;
+  {
+    ConfigRecord record;
+    memset(&record, 0, sizeof(record));
+    record.Magic = CONFIG_MAGIC;
+    record.Version = CONFIG_BIN_VER;
+    record.Size = sizeof(record);
+    
+    strlcpy(record.MqttServer, mqtt_server, sizeof(record.MqttServer));
+    strlcpy(record.MqttPort, mqtt_port, sizeof(record.MqttPort));
+    strlcpy(record.MqttTopic, mqtt_topic, sizeof(record.MqttTopic));
+    strlcpy(record.MqttUser, mqtt_user, sizeof(record.MqttUser));
+    strlcpy(record.MqttPass, mqtt_pass, sizeof(record.MqttPass));
+    strlcpy(record.MqttGroup, mqtt_group, sizeof(record.MqttGroup));
+    strlcpy(record.UdpGroup, udp_group, sizeof(record.UdpGroup));
+    strlcpy(record.UdpNode, udp_node, sizeof(record.UdpNode));
+    strlcpy(record.TimeZone, time_zone, sizeof(record.TimeZone));
+    
+    memcpy(record.WifiBssid, wifi_bssid, sizeof(record.WifiBssid));
+    record.WifiChannel = wifi_channel;
+    record.WifiValid = wifi_cached ? 1 : 0;
+    
+    record.Crc = Crc32(reinterpret_cast<const uint8_t*>(&record), offsetof(ConfigRecord, Crc));
       
     File configFile = SPIFFS.open(config_filename, "w");
     if(configFile)
     {
-      serializeJson(jsonDoc, configFile);
+      configFile.write(reinterpret_cast<const uint8_t*>(&record), sizeof(record));
       should_save_settings = false;
       configFile.close();
     }
@@ -1,17 +1,59 @@
 #include "am43.h"
+#include "scheduler.h"
+#include "budget.h"
 
 #ifdef WEB_SOCKET_DEBUG
 // http://tzapu.github.io/WebSocketSerialMonitor/
 #include <WebSocketsServer.h>   //https://github.com/Links2004/arduinoWebSockets/tree/async
 #include <Hash.h>
 WebSocketsServer webSocket = WebSocketsServer(81);
-String log_txt;
+char log_txt[AM43_DEBUG_LOG_N];
+unsigned int log_n = 0;
+
+void LogPosition(char tag, uint8_t position)
+{
+  // Fixed log buffer, restarts when full instead of growing
+  if(log_n + 8 > sizeof(log_txt))
+  {
+    log_n = 0;
+  }
+  log_n += snprintf(log_txt + log_n, sizeof(log_txt) - log_n, " %c:%u", tag, position);
+}
 #endif
 
+static_assert((AM43_TX_QUEUE_N & (AM43_TX_QUEUE_N - 1)) == 0, "AM43_TX_QUEUE_N must be power of 2");
+
 AM43Class AM43;
-namespace {
-static uint8_t s_reqPrefix[] = { 0x00, 0xFF, 0x00, 0x00 };
-static uint8_t s_reqHeaderPrefix[] = { 0x9a };
+RAM_BUDGET_CHECK(sizeof(AM43Class), RAM_BUDGET_AM43);
+
+// Empty slot, same wait and next step means no step transition
+#define AM43_NO_RESPONSE { AM43Class::Command::Verification, 0, nullptr, AM43Class::UpdateStep::Finish, AM43Class::UpdateStep::Finish }
+
+constexpr AM43Class::ResponseDescriptor AM43Class::s_responses[AM43_RESPONSE_N] =
+{
+  // Command                Min length                  Decoder                                   Finishes step                    Next step
+  AM43_NO_RESPONSE,                                                                                                                                             // 0xA0
+  { Command::GetPosition,     2,                          &AM43Class::DecodePositionResponse,       UpdateStep::Finish,              UpdateStep::Finish },          // 0xA1
+  { Command::GetBatteryLevel, 5,                          &AM43Class::DecodeBatteryLevelResponse,   UpdateStep::WaitForBatteryLevel, UpdateStep::Finish },          // 0xA2
+  { Command::GetSpeed,        2,                          &AM43Class::DecodeSpeedResponse,          UpdateStep::Finish,              UpdateStep::Finish },          // 0xA3
+  AM43_NO_RESPONSE,                                                                                                                                             // 0xA4
+  AM43_NO_RESPONSE,                                                                                                                                             // 0xA5
+  AM43_NO_RESPONSE,                                                                                                                                             // 0xA6
+  { Command::GetSettings,     7,                          &AM43Class::DecodeSettingsResponse,       UpdateStep::Finish,              UpdateStep::Finish },          // 0xA7
+  { Command::GetTiming,       1,                          &AM43Class::DecodeTimingResponse,         UpdateStep::Finish,              UpdateStep::Finish },          // 0xA8
+  { Command::GetSeason,       AM43Core::SeasonsSize,      &AM43Class::DecodeSeasonResponse,         UpdateStep::WaitForSettings,     UpdateStep::GetLightLevel },   // 0xA9
+  { Command::GetLightLevel,   2,                          &AM43Class::DecodeLightLevelResponse,     UpdateStep::WaitForLightLevel,   UpdateStep::GetBatteryLevel }, // 0xAA
+  AM43_NO_RESPONSE,                                                                                                                                             // 0xAB
+  AM43_NO_RESPONSE,                                                                                                                                             // 0xAC
+  AM43_NO_RESPONSE,                                                                                                                                             // 0xAD
+  AM43_NO_RESPONSE,                                                                                                                                             // 0xAE
+  AM43_NO_RESPONSE,                                                                                                                                             // 0xAF
+};
+
+constexpr bool AM43Class::ResponsesOrdered(int i)
+{
+  return i == AM43_RESPONSE_N ||
+    ((s_responses[i].Decode == nullptr || static_cast<int>(s_responses[i].Cmd) == AM43_RESPONSE_BASE + i) && ResponsesOrdered(i + 1));
 }
 
 #ifdef WEB_SOCKET_DEBUG
@@ -39,7 +81,7 @@ void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t lenght
       }
       else if(payload[0] == 'L')
       {
-        webSocket.broadcastTXT(log_txt + "\n");
+        webSocket.broadcastTXT(log_txt, log_n);
       }
       else
       {
@@ -52,10 +94,9 @@ void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t lenght
 #endif
 
 AM43Class::AM43Class() :
-m_stream(nullptr),
 m_update_step(UpdateStep::Start),
-m_update_delay(AM43_UPDATE_DELAY_FAST_MS),
-m_last_update(0),
+m_update_timer(-1),
+m_light_timer(-1),
 m_no_answer_reset_counter(0),
 m_update_ticks(0),
 m_direction(Direction::Forward),
@@ -69,7 +110,43 @@ m_bottomLimitSet(true),
 m_hasLightSensor(true),
 m_position(0),
 m_lightLevel(0),
+m_lightFiltered(0),
+m_light_ema(0),
+m_light_ema_valid(false),
+m_light_sample_ms(AM43_LIGHT_SAMPLE_MS),
+m_poll_scale(1),
 m_batteryLevel(0),
+m_summerSeason(),
+m_winterSeason(),
+m_season_tags(),
+m_timings(),
+m_last_time_sync(0),
+m_settings_valid(false),
+m_seasons_valid(false),
+m_timings_valid(false),
+m_time_synced(false),
+m_restored(false),
+m_settings_rev(0),
+m_tx_queue(),
+m_last_tx(0),
+m_last_tx_cmd(Command::Verification),
+m_last_user_tx(0),
+m_reply_wait_until(0),
+m_collisions_avoided(0),
+m_tx_deferred(false),
+m_pending(),
+m_pending_active(false),
+m_pending_resend(false),
+m_pending_sent(0),
+m_pending_deadline(0),
+m_failed_count(0),
+m_last_failed_cmd(Command::Verification),
+m_frame_callback(nullptr),
+m_limit_result(0),
+m_link(*this),
+m_tracker(),
+m_track_timer(-1),
+m_aux_buff(),
 m_initialized(false)
 {
   
@@ -150,7 +227,40 @@ void AM43Class::Init(Stream* output_stream)
 {
   pinMode(AM43_PIN_RESET, INPUT);
   
-  m_stream = output_stream;
+  m_link.Begin(StreamTransport{output_stream});
+
+  // Periodic work runs from scheduler, Loop only drains UART and queue
+  m_update_timer = Scheduler.Add([]()
+  {
+    AM43.Update();
+    // Light sample period restarts after every update
+    if(Scheduler.IsActive(AM43.m_light_timer))
+    {
+      Scheduler.Restart(AM43.m_light_timer);
+    }
+  }, AM43_UPDATE_DELAY_FAST_MS);
+
+  m_light_timer = Scheduler.Add([]()
+  {
+    // Light is sampled on its own cadence between slow update cycles
+    if(AM43.m_initialized && AM43.m_hasLightSensor && AM43.m_update_step == UpdateStep::Start)
+    {
+      AM43.DeviceGetLightLevel();
+    }
+  }, m_light_sample_ms * m_poll_scale, m_light_sample_ms > 0);
+
+  // Position is read back faster while blinds are moving
+  m_track_timer = Scheduler.Add([]()
+  {
+    if(AM43.m_tracker.IsMoving())
+    {
+      AM43.DeviceGetSettings();
+    }
+    else
+    {
+      Scheduler.Stop(AM43.m_track_timer);
+    }
+  }, AM43_TRACK_POLL_MS, false);
   #ifdef WEB_SOCKET_DEBUG
   webSocket.begin();
   webSocket.onEvent(webSocketEvent);
@@ -159,37 +269,28 @@ void AM43Class::Init(Stream* output_stream)
 
 void AM43Class::Loop()
 {
-  if(m_stream != nullptr && m_stream->available() > 1) // At least we have header prefix and command
+  // Drain UART without blocking, received frames are handled once line goes idle
+  #ifdef WEB_SOCKET_DEBUG
+  if(m_link.Poll())
   {
-    int buff_offset = 0;
-    while(m_stream->available())
-    {
-      m_aux_recv_buff[buff_offset++] = m_stream->read();
-      delay(100);
-    }
-
-    int resp_end = 0;
-    uint8_t* buff = m_aux_recv_buff;
-    int buff_n = buff_offset;
-    do
-    {
-      resp_end = HandleResponse(buff, buff_n);
-      buff += resp_end;
-      buff_n -= resp_end;
-    } while(resp_end > 0 && buff_n > 0);
-
-    #ifdef WEB_SOCKET_DEBUG
     PrintData();
-    #endif
   }
+  #else
+  m_link.Poll();
+  #endif
 
-  if(millis() - m_last_update >= m_update_delay)
-  {    
-    Update();
-    
-    m_last_update = millis();
+  // Move ends when target is reached or move stalls, position is read once
+  // more to get final one
+  if(m_tracker.Update(m_position))
+  {
+    Scheduler.Stop(m_track_timer);
+    DeviceGetSettings();
   }
 
+  // Unconfirmed user request is retransmitted or reported as failed
+  ProcessPending();
+  ProcessQueue();
+
   #ifdef WEB_SOCKET_DEBUG
   webSocket.loop();
   #endif
@@ -201,22 +302,15 @@ void AM43Class::DeviceReset()
   digitalWrite(AM43_PIN_RESET, LOW);
   pinMode(AM43_PIN_RESET, OUTPUT);
   
-  delay(100);
+  Clock::Delay(100);
   
   pinMode(AM43_PIN_RESET, INPUT);
 
-  delay(100);
+  Clock::Delay(100);
 }
 
 void AM43Class::Update()
 {
-  #ifdef WEB_SOCKET_DEBUG
-  if(log_txt.length() > 2000)
-  {
-    log_txt = "";
-  }
-  #endif
-  
   ++m_no_answer_reset_counter;
   if(m_no_answer_reset_counter > AM43_NO_ANSWER_RESET_T)
   {
@@ -226,16 +320,17 @@ void AM43Class::Update()
   
   if(++m_update_ticks > 10 || m_update_step == UpdateStep::Start)
   {
-      m_update_delay = AM43_UPDATE_DELAY_FAST_MS;
+      SetUpdateDelay(AM43_UPDATE_DELAY_FAST_MS);
       m_update_step = UpdateStep::GetSettings;
       m_update_ticks = 0;
   }
   else if(m_update_step == UpdateStep::Finish)
   {
-      m_update_delay = AM43_UPDATE_DELAY_SLOW_MS;
+      SetUpdateDelay(AM43_UPDATE_DELAY_SLOW_MS * m_poll_scale);
       m_update_step = UpdateStep::Start;
       m_initialized = true;
       m_update_ticks = 0;
+      SyncTime();
   }
   
   switch(m_update_step)
@@ -245,6 +340,11 @@ void AM43Class::Update()
       m_update_step = UpdateStep::WaitForSettings;
       m_update_ticks = 0;
       DeviceGetSettings();
+      // Timings are written as whole table, so they must be read before first write
+      if(!m_timings_valid)
+      {
+        DeviceGetTiming();
+      }
       break;
     }
     case UpdateStep::GetLightLevel:
@@ -261,336 +361,805 @@ void AM43Class::Update()
       DeviceGetBatteryLevel();
       break;
     }
+    default:
+      // Waiting for reply, nothing to send
+      break;
   }
 }
 
 void AM43Class::SendAction(ControlAction action)
 {
-  const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), Command::SendAction, static_cast<uint8_t>(action));
-  SendRequest(m_aux_buff, len);
+  QueueRequest(Priority::User, Command::SendAction, static_cast<uint8_t>(action));
 
-  // Update position imadeitely to unlock home automation options
-  // e.g. Home Assistant locks Close command if position is 100% or Open command if position is 0%
+  // Measured position is left as is, opening/closing operation unlocks
+  // home automation options while blinds are moving
   switch(action)
   {
     case ControlAction::Close:
     {
-      ++m_position;
+      m_tracker.Start(100, GetTravelTime());
       #ifdef WEB_SOCKET_DEBUG
-      log_txt += " +:" + String(m_position);
+      LogPosition('+', 100);
       #endif
       break;
     }
     case ControlAction::Open:
     {
-      --m_position;
+      m_tracker.Start(0, GetTravelTime());
       #ifdef WEB_SOCKET_DEBUG
-      log_txt += " -:" + String(m_position);
+      LogPosition('-', 0);
       #endif
       break;
     }
+    case ControlAction::Stop:
+    {
+      m_tracker.Stop();
+      // Read back where blinds have stopped
+      DeviceGetSettings();
+      break;
+    }
   }
   
-  m_position = constrain(m_position, 0, 100);
+  Scheduler.Restart(m_track_timer);
+}
+
+void AM43Class::SetUpdateDelay(unsigned long delay_ms)
+{
+  // Next update is delay_ms after previous one
+  Scheduler.SetPeriod(m_update_timer, delay_ms);
+}
+
+void AM43Class::SetLightSamplePeriod(unsigned long period_ms)
+{
+  m_light_sample_ms = period_ms;
+  UpdateLightTimer();
+}
+
+void AM43Class::SetPollScale(uint8_t scale)
+{
+  m_poll_scale = max(scale, (uint8_t)1);
+  UpdateLightTimer();
+}
+
+void AM43Class::UpdateLightTimer()
+{
+  if(m_light_sample_ms > 0)
+  {
+    Scheduler.SetPeriod(m_light_timer, m_light_sample_ms * m_poll_scale);
+  }
+  else
+  {
+    Scheduler.Stop(m_light_timer);
+  }
+}
+
+void AM43Class::Refresh()
+{
+  m_update_step = UpdateStep::Start;
+  SetUpdateDelay(AM43_UPDATE_DELAY_FAST_MS);
+}
+
+void AM43Class::ResetLimits()
+{
+  static const uint8_t data[] = AM43_LIMIT_RESET;
+  m_limit_result = 0;
+  QueueRequest(Priority::User, Command::ResetLimits, data, sizeof(data));
+}
+
+bool AM43Class::SetLimit(bool top)
+{
+  #ifdef AM43_LIMITS_CALIBRATION
+  static const uint8_t top_data[] = AM43_LIMIT_TOP;
+  static const uint8_t bottom_data[] = AM43_LIMIT_BOTTOM;
+  m_limit_result = 0;
+  QueueRequest(Priority::User, Command::ResetLimits, top ? top_data : bottom_data, sizeof(top_data));
+  return true;
+  #else
+  (void)top;
+  return false;
+  #endif
 }
 
 void AM43Class::SetPosition(uint8_t position_percent)
 {
-  m_position = constrain(position_percent, 0, 100);
+  // Measured position follows MCU reports, target is tracked separately
+  const uint8_t target = constrain(position_percent, 0, 100);
   #ifdef WEB_SOCKET_DEBUG
-  log_txt += " =:" + String(m_position);
+  LogPosition('=', target);
   #endif
   
-  const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), Command::SetPosition, m_position);
-  SendRequest(m_aux_buff, len);
+  QueueRequest(Priority::User, Command::SetPosition, target);
+  m_tracker.Start(target, GetTravelTime());
+  Scheduler.Restart(m_track_timer);
+}
+
+AM43Class::Settings AM43Class::GetDeviceSettings() const
+{
+  Settings settings;
+  settings.Dir = m_direction;
+  settings.Mode = m_operationMode;
+  settings.Speed = m_deviceSpeed;
+  settings.Length = m_deviceLength;
+  settings.Diameter = m_deviceDiameter;
+  settings.Type = m_deviceType;
+  return settings;
+}
+
+unsigned long AM43Class::GetTravelTime() const
+{
+  if(m_deviceSpeed == 0 || m_deviceDiameter == 0)
+  {
+    return 0;
+  }
+
+  // Roller revolutions for full length at speed RPM
+  return static_cast<unsigned long>(60000.0f * m_deviceLength / (PI * m_deviceDiameter * m_deviceSpeed));
+}
+
+bool AM43Class::SetDeviceSettings(const Settings& settings)
+{
+  if(!m_settings_valid)
+  {
+    return false;
+  }
+
+  if(settings.Dir == m_direction &&
+    settings.Mode == m_operationMode &&
+    settings.Speed == m_deviceSpeed &&
+    settings.Length == m_deviceLength &&
+    settings.Diameter == m_deviceDiameter &&
+    settings.Type == m_deviceType)
+  {
+    return true;
+  }
+
+  // Write-through, next GetSettings reply resyncs cache if MCU rejects it
+  m_direction = settings.Dir;
+  m_operationMode = settings.Mode;
+  m_deviceSpeed = settings.Speed;
+  m_deviceLength = settings.Length;
+  m_deviceDiameter = settings.Diameter;
+  m_deviceType = settings.Type;
+  ++m_settings_rev;
+  
+  DeviceSetSettings();
+  return true;
+}
+
+bool AM43Class::SetDeviceSpeed(uint8_t rpm)
+{
+  if(!m_initialized || !m_settings_valid)
+  {
+    return false;
+  }
+
+  if(rpm == m_deviceSpeed)
+  {
+    return true;
+  }
+
+  m_deviceSpeed = rpm;
+  ++m_settings_rev;
+
+  DeviceSetSettings();
+  return true;
+}
+
+bool AM43Class::SetSeasons(const SeasonInfo& summer, const SeasonInfo& winter)
+{
+  if(!m_seasons_valid)
+  {
+    return false;
+  }
+
+  if(memcmp(&summer, &m_summerSeason, sizeof(SeasonInfo)) == 0 &&
+    memcmp(&winter, &m_winterSeason, sizeof(SeasonInfo)) == 0)
+  {
+    return true;
+  }
+
+  m_summerSeason = summer;
+  m_winterSeason = winter;
+  ++m_settings_rev;
+  
+  DeviceSetSeason();
+  return true;
+}
+
+void AM43Class::UpdateLightFilter(uint8_t level)
+{
+  const int sample = level * 16;
+  if(!m_light_ema_valid)
+  {
+    m_light_ema = sample;
+    m_light_ema_valid = true;
+  }
+  else
+  {
+    m_light_ema += (sample - static_cast<int>(m_light_ema)) / (1 << AM43_LIGHT_EMA_SHIFT);
+  }
+
+  // Filtered level moves only when EMA is past level boundary by hysteresis
+  const int filtered = m_lightFiltered * 16;
+  if(static_cast<int>(m_light_ema) >= filtered + 8 + AM43_LIGHT_HYST_X16 ||
+    static_cast<int>(m_light_ema) <= filtered - 8 - AM43_LIGHT_HYST_X16 ||
+    m_light_ema == sample)
+  {
+    m_lightFiltered = (m_light_ema + 8) / 16;
+  }
+}
+
+bool AM43Class::SetTiming(int index, const TimingInfo& timing)
+{
+  if(index < 0 || index >= AM43_TIMINGS_N)
+  {
+    return false;
+  }
+
+  // All slots are written at once, other slots are unknown until GetTiming reply
+  if(!m_timings_valid)
+  {
+    return false;
+  }
+
+  if(memcmp(&timing, &m_timings[index], sizeof(TimingInfo)) == 0)
+  {
+    return true;
+  }
+
+  m_timings[index] = timing;
+  ++m_settings_rev;
+  
+  DeviceSetTiming();
+  return true;
+}
+
+void AM43Class::SyncTime()
+{
+  // MCU runs timings from its own clock, which drifts and knows nothing about DST
+  if(time(nullptr) < AM43_TIME_VALID_EPOCH ||
+    (m_time_synced && Clock::Millis() - m_last_time_sync < AM43_TIME_SYNC_MS))
+  {
+    return;
+  }
+
+  m_time_synced = true;
+  m_last_time_sync = Clock::Millis();
+  DeviceSetTime();
+}
+
+void AM43Class::DeviceSetTime()
+{
+  const time_t now = time(nullptr);
+  const tm* local = localtime(&now);
+  
+  TimeInfo info;
+  info.WeekDay = local->tm_wday;
+  info.Hour = local->tm_hour;
+  info.Minute = local->tm_min;
+  info.Second = local->tm_sec;
+  QueueRequest(Priority::User, Command::SetTime, reinterpret_cast<const uint8_t*>(&info), sizeof(info));
+}
+
+void AM43Class::DeviceSetTiming()
+{
+  // Same layout as GetTiming reply, slots count followed by all slots
+  uint8_t data[sizeof(TimingInfo) * AM43_TIMINGS_N + 1];
+  data[0] = AM43_TIMINGS_N;
+  memcpy(data + 1, m_timings, sizeof(m_timings));
+  QueueRequest(Priority::User, Command::SetTiming, data, sizeof(data));
 }
 
 void AM43Class::DeviceSetSettings()
 {
-  uint8_t data[64];
+  uint8_t data[AM43_TX_DATA_MAX];
   const int data_n = BuildSettingsData(data, sizeof(data));
-  const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), Command::SetName, data, data_n);
-  SendRequest(m_aux_buff, len);
+  QueueRequest(Priority::User, Command::SetSettings, data, data_n);
+}
+
+void AM43Class::DeviceSetSeason()
+{
+  // Same layout as GetSeason reply
+  uint8_t data[AM43Core::SeasonsSize];
+  const int data_n = AM43Core::EncodeSeasons(data, sizeof(data), m_summerSeason, m_winterSeason, m_season_tags);
+  QueueRequest(Priority::User, Command::SetSeason, data, data_n);
 }
 
 void AM43Class::DeviceGetSettings()
 {
-  const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), Command::GetSettings, 1);
-  SendRequest(m_aux_buff, len);
+  QueueRequest(Priority::Poll, Command::GetSettings, 1);
 }
 
 void AM43Class::DeviceGetLightLevel()
 {
-  const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), Command::GetLightLevel, 1);
-  SendRequest(m_aux_buff, len);
+  QueueRequest(Priority::Poll, Command::GetLightLevel, 1);
 }
 
 void AM43Class::DeviceGetBatteryLevel()
 {
-  const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), Command::GetBatteryLevel, 1);
-  SendRequest(m_aux_buff, len);
+  QueueRequest(Priority::Poll, Command::GetBatteryLevel, 1);
 }
 
-void AM43Class::SendRequest(const uint8_t* buff, unsigned int buff_n)
+void AM43Class::DeviceGetTiming()
 {
-  #ifdef WEB_SOCKET_DEBUG
-  String txt = "SendRequest:";
-  for(int i = 0; i < buff_n; ++i)
+  QueueRequest(Priority::Poll, Command::GetTiming, 1);
+}
+
+bool AM43Class::SendRaw(uint8_t cmd, const uint8_t* data, uint8_t data_n)
+{
+  // Unknown commands may never be confirmed, so they skip user request tracking
+  return QueueRequest(Priority::Poll, static_cast<Command>(cmd), data, data_n);
+}
+
+bool AM43Class::QueueRequest(Priority prio, Command cmd, uint8_t data)
+{
+  return QueueRequest(prio, cmd, &data, 1);
+}
+
+bool AM43Class::QueueRequest(Priority prio, Command cmd, const uint8_t* data, uint8_t data_n)
+{
+  if(data_n > AM43_TX_DATA_MAX)
   {
-    txt += String(" 0x") + String(buff[i], HEX);
+    return false;
   }
-  webSocket.broadcastTXT(txt + "\n");
-  #endif
+
+  Request req;
+  req.Cmd = cmd;
+  req.Attempt = 0;
+  req.DataN = data_n;
+  memcpy(req.Data, data, data_n);
   
-  if(m_stream != nullptr && buff_n > 0)
+  return PushRequest(prio, req);
+}
+
+bool AM43Class::PushRequest(Priority prio, const Request& req)
+{
+  RequestQueue& queue = m_tx_queue[static_cast<int>(prio)];
+  const uint8_t head = queue.Head;
+  if(static_cast<uint8_t>(head - queue.Tail) >= AM43_TX_QUEUE_N)
   {
-    m_stream->write(buff, buff_n);
+    return false;
   }
+
+  queue.Items[head & (AM43_TX_QUEUE_N - 1)] = req;
+
+  // Publish record only after it is filled
+  queue.Head = head + 1;
+  return true;
 }
 
-int AM43Class::HandleResponse(const uint8_t* buff, unsigned int buff_n)
+void AM43Class::ProcessQueue()
 {
-  #ifdef WEB_SOCKET_DEBUG
-  String txt = "Processing:";
-  for(int i = 0; i < buff_n; ++i)
+  RequestQueue& user_queue = m_tx_queue[static_cast<int>(Priority::User)];
+  RequestQueue& poll_queue = m_tx_queue[static_cast<int>(Priority::Poll)];
+  const unsigned long now = Clock::Millis();
+  
+  // One user request is on the line at a time, so every ack belongs to
+  // pending request and its retransmits are not overtaken by newer ones
+  const Request* req = nullptr;
+  RequestQueue* queue = nullptr;
+  if(m_pending_active && m_pending_resend)
   {
-    txt += String(" 0x") + String(buff[i], HEX);
+    req = &m_pending;
+  }
+  else if(!m_pending_active && user_queue.Tail != user_queue.Head)
+  {
+    queue = &user_queue;
+  }
+  else if(poll_queue.Tail != poll_queue.Head && now - m_last_user_tx >= AM43_TX_POLL_DEFER_MS)
+  {
+    queue = &poll_queue;
+  }
+
+  if(req == nullptr && queue == nullptr)
+  {
+    return;
+  }
+
+  // Half-duplex line, hold request while MCU is sending or expected to reply
+  const bool line_busy = m_link.IsReceiving() ||
+    now - m_last_tx < AM43_TX_GAP_MS ||
+    now - m_link.GetLastRecv() < AM43_TX_GAP_MS ||
+    static_cast<long>(m_reply_wait_until - now) > 0;
+  if(line_busy)
+  {
+    if(!m_tx_deferred)
+    {
+      m_tx_deferred = true;
+      ++m_collisions_avoided;
+    }
+    return;
+  }
+
+  const uint8_t tail = queue != nullptr ? queue->Tail : 0;
+  if(queue != nullptr)
+  {
+    req = &queue->Items[tail & (AM43_TX_QUEUE_N - 1)];
+  }
+  const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), req->Cmd, req->Data, req->DataN);
+
+  m_tx_deferred = false;
+  m_last_tx = now;
+  m_last_tx_cmd = req->Cmd;
+  m_reply_wait_until = now + AM43_TX_REPLY_WAIT_MS;
+  if(queue != &poll_queue)
+  {
+    m_last_user_tx = now;
+    if(queue == &user_queue)
+    {
+      m_pending = *req;
+      m_pending_active = true;
+      m_pending_deadline = now + AM43_CMD_DEADLINE_MS;
+    }
+    m_pending_resend = false;
+    m_pending_sent = now;
+  }
+
+  // Slot is released only after record is copied out
+  if(queue != nullptr)
+  {
+    queue->Tail = tail + 1;
   }
-  webSocket.broadcastTXT(txt + "\n");
-  #endif
-  
-  int response_begin = -1;
-  int req_herader_prefix_offset = 0;
   
-  for(int i = 0; i < buff_n; ++i)
+  SendRequest(m_aux_buff, len);
+}
+
+void AM43Class::ProcessPending()
+{
+  if(!m_pending_active)
   {
-    if(buff[i] == s_reqHeaderPrefix[req_herader_prefix_offset])
+    return;
+  }
+
+  const unsigned long now = Clock::Millis();
+  if(static_cast<long>(now - m_pending_deadline) >= 0)
+  {
+    m_pending_active = false;
+    m_last_failed_cmd = m_pending.Cmd;
+    ++m_failed_count;
+
+    // Write-through cache may be ahead of MCU now, resync it
+    if(m_pending.Cmd == Command::SetSettings || m_pending.Cmd == Command::SetSeason || m_pending.Cmd == Command::SetTiming)
     {
-      ++req_herader_prefix_offset;
-      if(req_herader_prefix_offset == sizeof(s_reqHeaderPrefix))
+      if(m_pending.Cmd == Command::SetTiming)
       {
-        response_begin = i - sizeof(s_reqHeaderPrefix) + 1;
-        break;
+        // Timings are read back only while cache is invalid
+        m_timings_valid = false;
       }
+      m_update_step = UpdateStep::Start;
+      SetUpdateDelay(AM43_UPDATE_DELAY_FAST_MS);
     }
-    else
+    else if(m_pending.Cmd == Command::SetTime)
     {
-      req_herader_prefix_offset = 0;
+      // Retried on next update cycle
+      m_time_synced = false;
     }
+    return;
   }
 
-  if(response_begin == -1)
+  // Exponential backoff between retransmits, resend goes ahead of queued requests
+  if(!m_pending_resend && now - m_pending_sent >= (static_cast<unsigned long>(AM43_RETRY_MS) << m_pending.Attempt))
   {
-    #ifdef WEB_SOCKET_DEBUG
-    webSocket.broadcastTXT("Header not found\n");
-    #endif
-    return 0;
+    if(m_pending.Attempt >= AM43_RETRY_MAX)
+    {
+      // Out of retries, wait for late confirmation until deadline
+      return;
+    }
+
+    ++m_pending.Attempt;
+    m_pending_resend = true;
+  }
+}
+
+void AM43Class::ConfirmPending(Command response_cmd, const uint8_t* data, uint8_t data_n)
+{
+  if(!m_pending_active)
+  {
+    return;
   }
 
-  m_no_answer_reset_counter = 0;
-  
-  int response_offset = response_begin + sizeof(s_reqHeaderPrefix);
+  // Movement report means motor accepted action or position request
+  if(response_cmd == Command::GetPosition &&
+    (m_pending.Cmd == Command::SendAction || m_pending.Cmd == Command::SetPosition))
+  {
+    m_pending_active = false;
+    return;
+  }
+
+  // Verification reply carries no command code, it confirms pending request
+  // only if nothing else was sent after it
+  const bool verification = response_cmd == Command::Verification && m_last_tx_cmd == m_pending.Cmd;
+  if(response_cmd != m_pending.Cmd && !verification)
+  {
+    return;
+  }
 
-  Command response_cmd = static_cast<Command>(buff[response_offset++]);
-  uint8_t response_len = buff[response_offset++];
-  uint8_t response_checksum = buff[response_offset + response_len];
+  if(data_n > 0 && data[0] == static_cast<uint8_t>(ContentResult::Success))
+  {
+    m_pending_active = false;
+  }
+  else if(m_pending.Cmd == Command::ResetLimits && data_n > 0 &&
+    (data[0] == static_cast<uint8_t>(ContentResult::LimitSetSuccess) ||
+    data[0] == static_cast<uint8_t>(ContentResult::LimitSetFailure) ||
+    data[0] == static_cast<uint8_t>(ContentResult::LimitSetExit) ||
+    data[0] == static_cast<uint8_t>(ContentResult::ResetSuccess)))
+  {
+    // Limits requests are answered with own result codes, retransmit won't change them
+    m_pending_active = false;
+  }
+  else if(data_n > 0 && data[0] == static_cast<uint8_t>(ContentResult::Failure))
+  {
+    // Rejected, retransmit on next pass
+    if(!m_pending_resend)
+    {
+      m_pending_sent = Clock::Millis() - (static_cast<unsigned long>(AM43_RETRY_MS) << m_pending.Attempt);
+    }
+  }
+}
+
+void AM43Class::SendRequest(const uint8_t* buff, unsigned int buff_n)
+{
+  #ifdef WEB_SOCKET_DEBUG
+  String txt = "SendRequest:";
+  for(int i = 0; i < buff_n; ++i)
+  {
+    txt += String(" 0x") + String(buff[i], HEX);
+  }
+  webSocket.broadcastTXT(txt + "\n");
+  #endif
   
-  const int response_size = sizeof(s_reqHeaderPrefix) + response_len + 3;
-  const int response_end = response_begin + response_size;
+  m_link.Send(buff, buff_n);
+}
 
-  uint8_t response_calculated_checksum = 0;
-  for(int i = response_begin; i < response_end - 1; ++i)
+void AM43Class::OnFrame(const AM43Core::Frame& frame)
+{
+  m_no_answer_reset_counter = 0;
+  m_reply_wait_until = Clock::Millis();
+
+  if(m_frame_callback != nullptr)
   {
-    response_calculated_checksum ^= buff[i];
+    m_frame_callback(frame);
   }
 
-  const uint8_t* data = buff + response_offset;
-  if(response_calculated_checksum == response_checksum)
+  const Command response_cmd = static_cast<Command>(frame.Cmd);
+  const uint8_t response_len = frame.Len;
+  const uint8_t* data = frame.Data;
+  if(frame.IsValid())
   {
-    switch(response_cmd)
+    ConfirmPending(response_cmd, data, response_len);
+
+    if(response_cmd == Command::ResetLimits && response_len > 0)
     {
-      case Command::GetSettings:
-      {
-        if(response_len >= 7)
-        {
-          uint8_t dat = data[0];
-          m_direction = static_cast<Direction>(dat & 1);
-          m_operationMode = static_cast<OperationMode>((dat >> 1) & 1);
-
-          m_topLimitSet = (dat & 4) > 0;
-          m_bottomLimitSet = (dat & 8) > 0;
-          m_hasLightSensor = (dat & 16) > 0;
-          
-          m_deviceSpeed = data[1];
-          m_position = data[2];
-          m_deviceLength = (data[3] << 8) | data[4];
-          m_deviceDiameter = data[5];
-          
-          m_deviceType = static_cast<DeviceType>(abs(data[6] >> 4));
-          #ifdef WEB_SOCKET_DEBUG
-          log_txt += " *:" + String(m_position);
-          #endif
-        }
-        break;
-      }
-      case Command::GetLightLevel:
-      {
-        if(response_len >= 2)
-        {
-          m_lightLevel = data[1];
-        }
-        
-        if(m_update_step == UpdateStep::WaitForLightLevel)
-        {
-          m_update_step = UpdateStep::GetBatteryLevel;
-        }
-        
-        break;
-      }
-      case Command::GetPosition:
-      {
-        if(response_len >= 2)
-        {
-          m_position = data[1];
-          #ifdef WEB_SOCKET_DEBUG
-          log_txt += " /:" + String(m_position);
-          #endif
-        }
-        break;
-      }
-      case Command::GetBatteryLevel:
-      {
-        if(response_len >= 5)
-        {
-          m_batteryLevel = data[4];
-        }
-        
-        if(m_update_step == UpdateStep::WaitForBatteryLevel)
-        {
-          m_update_step = UpdateStep::Finish;
-        }
-        
-        break;
-      }
-      case Command::GetSpeed:
+      m_limit_result = data[0];
+    }
+    
+    static_assert(ResponsesOrdered(0), "AM43 response descriptors must be ordered by command code");
+    
+    // Codes below base wrap around and fail range check
+    const unsigned int index = static_cast<uint8_t>(frame.Cmd - AM43_RESPONSE_BASE);
+    if(index < AM43_RESPONSE_N && s_responses[index].Cmd == response_cmd)
+    {
+      const ResponseDescriptor& desc = s_responses[index];
+      if(desc.Decode != nullptr && response_len >= desc.MinLen)
       {
-        if(response_len >= 2)
-        {
-          m_deviceSpeed = data[1];
-          
-          uint8_t dat = data[0];
-          m_direction = static_cast<Direction>((dat >> 1) & 1);
-          m_operationMode = static_cast<OperationMode>((dat >> 2) & 1);
-          m_hasLightSensor = ((dat >> 3) & 1) > 0;
-        }
-        break;
+        (this->*desc.Decode)(data, response_len);
       }
-      case Command::GetSeason:
+
+      if(m_update_step == desc.WaitStep)
       {
-        if(response_len >= sizeof(SeasonInfo) * 2 + 2)
-        {
-          memcpy(&m_summerSeason, data + 1, sizeof(SeasonInfo));
-          memcpy(&m_winterSeason, data + sizeof(SeasonInfo) + 2, sizeof(SeasonInfo));
-        }
-        
-        if(m_update_step == UpdateStep::WaitForSettings)
-        {
-          m_update_step = UpdateStep::GetLightLevel;
-        }
-        
-        break;
+        m_update_step = desc.NextStep;
       }
     }
   }
   
   #ifdef WEB_SOCKET_DEBUG
-  txt = "Response header found";
+  String txt = "Response header found";
   txt += String("\nCMD: 0x") + String((int)response_cmd, HEX);
   txt += String("\nLEN: ") + String(response_len);
   for(int i = 0; i < response_len; ++i)
   {
-    txt += String("\nDAT[") + String(i) + String("]: 0x") + String(buff[response_offset + i], HEX);
+    txt += String("\nDAT[") + String(i) + String("]: 0x") + String(data[i], HEX);
   }
-  txt += String("\nCHK: 0x") + String(response_checksum, HEX);
-  txt += String("\nCCC: 0x") + String(response_calculated_checksum, HEX);
+  txt += String("\nCHK: 0x") + String(frame.Checksum, HEX);
+  txt += String("\nCCC: 0x") + String(frame.CalculatedChecksum, HEX);
   
   webSocket.broadcastTXT(txt + "\n");
   #endif
-
-  return response_end;
 }
 
-int AM43Class::BuildSettingsData(uint8_t* buff, uint8_t buff_n)
+void AM43Class::DecodeSettingsResponse(const uint8_t* data, uint8_t /*data_n*/)
 {
-  if(buff_n < 6)
+  const Settings prev = GetDeviceSettings();
+  const bool prev_top = m_topLimitSet;
+  const bool prev_bottom = m_bottomLimitSet;
+  DecodeSettings(data);
+
+  if(!m_settings_valid ||
+    prev_top != m_topLimitSet ||
+    prev_bottom != m_bottomLimitSet ||
+    prev.Dir != m_direction ||
+    prev.Mode != m_operationMode ||
+    prev.Speed != m_deviceSpeed ||
+    prev.Length != m_deviceLength ||
+    prev.Diameter != m_deviceDiameter ||
+    prev.Type != m_deviceType)
   {
-    return 0;
+    ++m_settings_rev;
   }
-  
-  uint8_t dataHead = (static_cast<uint8_t>(m_direction) & 1) << 1;
-  dataHead |= (static_cast<uint8_t>(m_operationMode) & 1) << 2;
-  dataHead |= static_cast<uint8_t>(m_deviceType) << 4;
-
-  int buff_offset = 0;
-  buff[buff_offset++] = dataHead;
-  buff[buff_offset++] = m_deviceSpeed;
-  buff[buff_offset++] = 0;
-  
-  buff[buff_offset++] = static_cast<uint8_t>((m_deviceLength & 0xFF00) >> 8);
-  buff[buff_offset++] = static_cast<uint8_t>(m_deviceLength & 0xFF);
-  buff[buff_offset++] = m_deviceDiameter; 
+  m_settings_valid = true;
+  #ifdef WEB_SOCKET_DEBUG
+  LogPosition('*', m_position);
+  #endif
+}
 
-  return buff_offset;
+void AM43Class::DecodeLightLevelResponse(const uint8_t* data, uint8_t /*data_n*/)
+{
+  m_lightLevel = data[1];
+  UpdateLightFilter(m_lightLevel);
 }
 
-int AM43Class::BuildRequest(uint8_t* buff, unsigned int buff_n, Command cmd, uint8_t data)
+void AM43Class::DecodePositionResponse(const uint8_t* data, uint8_t /*data_n*/)
 {
-  return BuildRequest(buff, buff_n, cmd, &data, 1);
+  m_position = data[1];
+  #ifdef WEB_SOCKET_DEBUG
+  LogPosition('/', m_position);
+  #endif
 }
 
-int AM43Class::BuildRequest(uint8_t* buff, unsigned int buff_n, Command cmd, const uint8_t* data, uint8_t data_n)
+void AM43Class::DecodeBatteryLevelResponse(const uint8_t* data, uint8_t /*data_n*/)
 {
-  if(buff == nullptr || buff_n < sizeof(s_reqPrefix) + sizeof(s_reqHeaderPrefix) + data_n + 3)
-  {
-    return 0;
-  }
+  m_batteryLevel = data[4];
+}
 
-  // AM43 Request example
-  // 00 ff 00 00 9a 17 02 22 b8 15
-  // 0x00, 0xFF, 0x00, 0x00   REQUEST PREFIX
-  // 0x9a                     HEADER PREFIX
-  // 0x00                     HEADER(CMD)
-  // 0x01                     DATA LENGTH
-  // 0x00                     DATA
-  // 0x00                     REQUEST CHECKSUM (HEADER PREFIX xor HEADER xor DATA LENGTH xor DATA)
+void AM43Class::DecodeSpeedResponse(const uint8_t* data, uint8_t data_n)
+{
+  AM43Core::SettingsInfo settings = GetSettingsInfo();
+  AM43Core::DecodeSpeed(data, data_n, settings);
+  SetSettingsInfo(settings);
+}
 
-  int buff_offset = 0;
+void AM43Class::DecodeTimingResponse(const uint8_t* data, uint8_t data_n)
+{
+  // Timing count comes first, followed by timing records
+  if(data_n < 1 + data[0] * sizeof(TimingInfo))
+  {
+    return;
+  }
+  
+  TimingInfo timings[AM43_TIMINGS_N];
+  memset(timings, 0, sizeof(timings));
+  const int timings_n = min(static_cast<int>(data[0]), AM43_TIMINGS_N);
+  for(int i = 0; i < timings_n; ++i)
+  {
+    DecodeTiming(data + 1 + i * sizeof(TimingInfo), timings[i]);
+  }
   
-  // Request prefix
-  memcpy(buff + buff_offset, s_reqPrefix, sizeof(s_reqPrefix));
-  buff_offset += sizeof(s_reqPrefix);
+  if(!m_timings_valid || memcmp(m_timings, timings, sizeof(m_timings)) != 0)
+  {
+    ++m_settings_rev;
+  }
 
-  // Header
-  // Header prefix
-  memcpy(buff + buff_offset, s_reqHeaderPrefix, sizeof(s_reqHeaderPrefix));
-  buff_offset += sizeof(s_reqHeaderPrefix);
-  // Header(command)
-  buff[buff_offset++] = static_cast<uint8_t>(cmd);
+  memcpy(m_timings, timings, sizeof(m_timings));
+  m_timings_valid = true;
+}
 
-  // Data
-  // Data length
-  buff[buff_offset++] = data_n;
-  for(int i = 0; i < data_n; ++i)
+void AM43Class::DecodeSeasonResponse(const uint8_t* data, uint8_t data_n)
+{
+  SeasonInfo summer;
+  SeasonInfo winter;
+  uint8_t tags[2];
+  if(!AM43Core::DecodeSeasons(data, data_n, summer, winter, tags))
   {
-    buff[buff_offset++] = data[i];
+    return;
   }
+  
+  if(!m_seasons_valid ||
+    memcmp(&m_summerSeason, &summer, sizeof(SeasonInfo)) != 0 ||
+    memcmp(&m_winterSeason, &winter, sizeof(SeasonInfo)) != 0)
+  {
+    ++m_settings_rev;
+  }
+  
+  memcpy(m_season_tags, tags, sizeof(m_season_tags));
+  m_summerSeason = summer;
+  m_winterSeason = winter;
+  m_seasons_valid = true;
+}
+
+void AM43Class::DecodeTiming(const uint8_t* data, TimingInfo& timing)
+{
+  timing.State = data[0];
+  timing.Position = data[1];
+  timing.RepeatMask = data[2];
+  timing.Hour = data[3];
+  timing.Minute = data[4];
+}
+
+void AM43Class::DecodeSettings(const uint8_t* data)
+{
+  AM43Core::SettingsInfo settings;
+  AM43Core::DecodeSettings(data, AM43Core::SettingsSize, settings);
+  SetSettingsInfo(settings);
+}
+
+void AM43Class::EncodeSettings(uint8_t* data) const
+{
+  AM43Core::EncodeSettings(data, AM43Core::SettingsSize, GetSettingsInfo());
+}
+
+AM43Core::SettingsInfo AM43Class::GetSettingsInfo() const
+{
+  AM43Core::SettingsInfo settings;
+  settings.Dir = static_cast<uint8_t>(m_direction);
+  settings.Mode = static_cast<uint8_t>(m_operationMode);
+  settings.Speed = m_deviceSpeed;
+  settings.Position = m_position;
+  settings.Length = m_deviceLength;
+  settings.Diameter = m_deviceDiameter;
+  settings.Type = static_cast<uint8_t>(m_deviceType);
+  settings.TopLimit = m_topLimitSet;
+  settings.BottomLimit = m_bottomLimitSet;
+  settings.LightSensor = m_hasLightSensor;
+  return settings;
+}
 
-  uint8_t checksum = 0;
-  for(int i = sizeof(s_reqPrefix); i < buff_offset; ++i)
+void AM43Class::SetSettingsInfo(const AM43Core::SettingsInfo& settings)
+{
+  m_direction = static_cast<Direction>(settings.Dir);
+  m_operationMode = static_cast<OperationMode>(settings.Mode);
+  m_deviceSpeed = settings.Speed;
+  m_position = settings.Position;
+  m_deviceLength = settings.Length;
+  m_deviceDiameter = settings.Diameter;
+  m_deviceType = static_cast<DeviceType>(settings.Type);
+  m_topLimitSet = settings.TopLimit;
+  m_bottomLimitSet = settings.BottomLimit;
+  m_hasLightSensor = settings.LightSensor;
+}
+
+void AM43Class::GetSnapshot(Snapshot& snapshot) const
+{
+  EncodeSettings(snapshot.SettingsData);
+  snapshot.BatteryLevel = m_batteryLevel;
+  snapshot.LightLevel = m_lightLevel;
+  snapshot.Summer = m_summerSeason;
+  snapshot.Winter = m_winterSeason;
+  memcpy(snapshot.SeasonTags, m_season_tags, sizeof(m_season_tags));
+  memcpy(snapshot.Timings, m_timings, sizeof(m_timings));
+}
+
+void AM43Class::RestoreSnapshot(const Snapshot& snapshot)
+{
+  if(m_initialized)
   {
-    checksum ^= buff[i];
+    return;
   }
-  buff[buff_offset++] = checksum;
+
+  DecodeSettings(snapshot.SettingsData);
+  m_batteryLevel = snapshot.BatteryLevel;
+  m_lightLevel = snapshot.LightLevel;
+  UpdateLightFilter(m_lightLevel);
+  m_summerSeason = snapshot.Summer;
+  m_winterSeason = snapshot.Winter;
+  memcpy(m_season_tags, snapshot.SeasonTags, sizeof(m_season_tags));
+  memcpy(m_timings, snapshot.Timings, sizeof(m_timings));
+  ++m_settings_rev;
   
-  return buff_offset;
+  // Caches are still not trusted for diffed writes until MCU reports them
+  m_restored = true;
+}
+
+int AM43Class::BuildSettingsData(uint8_t* buff, uint8_t buff_n)
+{
+  return AM43Core::EncodeSettingsRequest(buff, buff_n, GetSettingsInfo());
+}
+
+int AM43Class::BuildRequest(uint8_t* buff, unsigned int buff_n, Command cmd, uint8_t data)
+{
+  return BuildRequest(buff, buff_n, cmd, &data, 1);
+}
+
+int AM43Class::BuildRequest(uint8_t* buff, unsigned int buff_n, Command cmd, const uint8_t* data, uint8_t data_n)
+{
+  return AM43Core::BuildRequest(buff, buff_n, static_cast<uint8_t>(cmd), data, data_n);
 }
@@ -3,18 +3,58 @@
 
 #include <Arduino.h>
 
+#include "clock.h"
+#include "am43_core.h"
+
 #define AM43_BAUD                 19200
 #define AM43_UPDATE_DELAY_FAST_MS 1000
 #define AM43_UPDATE_DELAY_SLOW_MS 15000
 #define AM43_NO_ANSWER_RESET_T    32
+#define AM43_RECV_IDLE_MS         20    // Line idle time which ends received frames burst
+#define AM43_TX_QUEUE_N           8     // Queued requests, must be power of 2
+#define AM43_TX_DATA_MAX          24    // Max request data payload
+#define AM43_FRAME_MAX            (4 + 3 + AM43_TX_DATA_MAX + 1) // Prefix, header, payload and checksum
+#define AM43_RECV_BUFF_N          (2 * AM43_FRAME_MAX) // Fits GetSettings and GetSeason replies burst
+#define AM43_TX_GAP_MS            50    // Min spacing between frames on the line
+#define AM43_TX_REPLY_WAIT_MS     150   // Line is held for MCU reply after poll request
+#define AM43_TX_POLL_DEFER_MS     1500  // Polls are held back after user command while motor starts
+#define AM43_RETRY_MS             300   // First retransmit timeout, doubled on every retry
+#define AM43_RETRY_MAX            3     // Retransmits of unconfirmed user request
+#define AM43_CMD_DEADLINE_MS      5000  // User request is reported as failed if not confirmed by then
+#define AM43_LIGHT_SAMPLE_MS      5000  // Default light level sampling period between full update cycles
+#define AM43_LIGHT_EMA_SHIFT      2     // Light filter weight of new sample is 1/(2^shift)
+#define AM43_LIGHT_HYST_X16       4     // Filtered light level hysteresis, 1/16 level units
+#define AM43_TIMINGS_N            4     // MCU timing slots
+#define AM43_LIMIT_RESET          { 0x00, 0x00, 0x01 }
+#define AM43_LIMIT_TOP            { 0x01, 0x00, 0x00 } // Not verified, result is checked with GetSettings limit bits
+#define AM43_LIMIT_BOTTOM         { 0x00, 0x01, 0x00 } // Not verified, result is checked with GetSettings limit bits
+// Remote limits calibration sends AM43_LIMIT_TOP/BOTTOM payloads above,
+// they are not verified on real MCU so it is off unless enabled here
+//#define AM43_LIMITS_CALIBRATION
+#define AM43_RESPONSE_BASE        0xA0  // First response command code in descriptor table
+#define AM43_RESPONSE_N           16    // Response descriptor table size
+#define AM43_TRACK_POLL_MS        1000  // Position read back period while blinds are moving
+#define AM43_TRACK_STALL_MS       5000  // Move is reported as stalled if position doesn't change for this long
+#define AM43_TRACK_TOLERANCE      1     // Target is reached within this many percent
+#define AM43_TIME_SYNC_MS         21600000 // MCU clock resync period (6 hours)
+#define AM43_TIME_VALID_EPOCH     1577836800 // Local time is ignored until it's past 2020-01-01
 
 #define AM43_PIN_RESET            5
 
 //#define WEB_SOCKET_DEBUG
+#define AM43_DEBUG_LOG_N          256   // Position log size, log restarts when full
 
 class AM43Class
 {
 public:
+  enum class Priority
+  {
+    User, // Actions, sent at next idle gap
+    Poll, // Background status requests, deferred while user requests are pending
+    
+    Count
+  };
+
   enum class UpdateStep
   {
     Start,
@@ -27,20 +67,26 @@ public:
     Finish
   };
   
-  struct SeasonInfo
-  {
-    uint8_t SeasonState;
-    uint8_t LightSeasonState;
-    uint8_t LightLevel;
-    uint8_t LightStartHour;
-    uint8_t LightStartMinute;
-    uint8_t LightEndHour;
-    uint8_t LightEndMinute;
-  };
+  // Decoded by protocol core, shared with ESPHome front-end
+  typedef AM43Core::SeasonInfo SeasonInfo;
 
+  // Layout is not fully reverse engineered, records are written back in
+  // the same order as they are reported by GetTiming
   struct TimingInfo
   {
+    uint8_t State;      // 0 - off, 1 - on
+    uint8_t Position;   // Target position percent
+    uint8_t RepeatMask; // Bit per weekday, bit 0 - Sunday
+    uint8_t Hour;
+    uint8_t Minute;
+  };
 
+  struct TimeInfo
+  {
+    uint8_t WeekDay; // 0 - Sunday
+    uint8_t Hour;
+    uint8_t Minute;
+    uint8_t Second;
   };
   
   enum class DeviceType
@@ -64,7 +110,11 @@ public:
   enum class ContentResult
   {
     Success = 0x5A,
-    Failure = 0xA5
+    Failure = 0xA5,
+    LimitSetSuccess = 0x5B,
+    LimitSetFailure = 0xB5,
+    LimitSetExit = 0x5C,
+    ResetSuccess = 0xC5
   };
   
   enum class ControlAction
@@ -86,6 +136,17 @@ public:
     Continuous  = 0x00
   };
 
+  // Device settings as reported by GetSettings
+  struct Settings
+  {
+    Direction Dir;
+    OperationMode Mode;
+    uint8_t Speed;    // RPM
+    uint16_t Length;  // mm
+    uint8_t Diameter; // mm
+    DeviceType Type;
+  };
+
   // Content:
   // Failure = 0xA5
   // Succese = 0x5A
@@ -107,7 +168,7 @@ public:
     SetPosition     = 0x0D,     // byte position
     SetSettings     = 0x11,     // AM43Settings settings
     
-    ResetLimits     = 0x22,     // byte[] { 0, 0, 1 }    
+    ResetLimits     = 0x22,     // byte[] { 0, 0, 1 } reset, see AM43_LIMIT_* for confirm payloads
     SetTime         = 0x14,     // AM43Time time
     SetSeason       = 0x16,     // SeasonInfo summer, SeasonInfo winter
     SetTiming       = 0x15,     // TimingInfo
@@ -115,10 +176,10 @@ public:
     GetSettings     = 0xA7,     // byte 1
     GetLightLevel   = 0xAA,     // byte 1
     GetBatteryLevel = 0xA2,     // byte 1
+    GetTiming       = 0xA8,     // byte 1, reply is slots count followed by TimingInfo slots
 
     // Responce only commands
     Verification    = 0x00,     // ContentResult, CommandResult
-    GetTiming       = 0xA8,     // TimingInfo
     GetSeason       = 0xA9,     // SeasonInfo summer, SeasonInfo winter
     GetPosition     = 0xA1,
     GetSpeed        = 0xA3,
@@ -133,39 +194,154 @@ public:
 
   void Init(Stream* output_stream);
   void Loop();
+  // Called by UART link for every received frame
+  void OnFrame(const AM43Core::Frame& frame);
 
   void Update();
   
   void SendAction(ControlAction action);
  
   void SetPosition(uint8_t position_percent);
+  // Measured position, as reported by MCU
   uint8_t GetPosition() const { return m_position; }
+  // Position commanded by last move
+  uint8_t GetTargetPosition() const { return m_tracker.GetTarget(); }
+  AM43Core::Operation GetOperation() const { return m_tracker.GetOperation(); }
+  // Moves which stopped making progress before reaching target
+  unsigned long GetStallCount() const { return m_tracker.GetStallCount(); }
   uint8_t GetBatteryLevel() const { return m_batteryLevel; }
   uint8_t GetLightLevel() const { return m_lightLevel; }
+  // Light level after EMA filter and hysteresis, doesn't flap around level boundaries
+  uint8_t GetLightLevelFiltered() const { return m_lightFiltered; }
+  void SetLightSamplePeriod(unsigned long period_ms);
+  // Stretch background polling periods, every poll wakes battery powered MCU
+  void SetPollScale(uint8_t scale);
+  unsigned long GetLightSamplePeriod() const { return m_light_sample_ms; }
   bool IsInitialized() const { return m_initialized; }
+  // Restart update cycle now, i.e. to read back settings after write
+  void Refresh();
+
+  // Limits setup
+  void ResetLimits();
+  // Store current position as top or bottom limit
+  // Returns false if limits calibration is not enabled, see AM43_LIMITS_CALIBRATION
+  bool SetLimit(bool top);
+  bool IsTopLimitSet() const { return m_topLimitSet; }
+  bool IsBottomLimitSet() const { return m_bottomLimitSet; }
+  // Last ContentResult reported for limits request, 0 if none
+  uint8_t GetLimitResult() const { return m_limit_result; }
+  // State is restored from snapshot and not refreshed from MCU yet
+  bool IsStale() const { return m_restored && !m_initialized; }
+  bool HasState() const { return m_restored || m_initialized; }
+  // Requests held back to avoid colliding with line traffic
+  unsigned long GetCollisionsAvoided() const { return m_collisions_avoided; }
+
+  // Settings, seasons and timings are cached from GetSettings/GetSeason/GetTiming replies
+  // Setters write to MCU only if value differs from cache
+  // Returns false if cache is not synced with MCU yet, timings are read once after boot
+  Settings GetDeviceSettings() const;
+  bool SetDeviceSettings(const Settings& settings);
+  // Changes speed only, other settings are left as read from MCU
+  // Returns false until MCU state is initialized, restored snapshot may be stale
+  bool SetDeviceSpeed(uint8_t rpm);
+  // Full travel time estimate from length, roller diameter and speed
+  // Follows speed changes as soon as they are written, 0 if unknown
+  unsigned long GetTravelTime() const;
+  const SeasonInfo& GetSummerSeason() const { return m_summerSeason; }
+  const SeasonInfo& GetWinterSeason() const { return m_winterSeason; }
+  bool SetSeasons(const SeasonInfo& summer, const SeasonInfo& winter);
+  const TimingInfo& GetTiming(int index) const { return m_timings[index]; }
+  bool SetTiming(int index, const TimingInfo& timing);
+  // Compact copy of device state which survives reboots
+  // Single byte fields only, so it has no padding and can be compared with memcmp
+  struct Snapshot
+  {
+    uint8_t SettingsData[7]; // Same layout as GetSettings reply, includes position
+    uint8_t BatteryLevel;
+    uint8_t LightLevel;
+    SeasonInfo Summer;
+    SeasonInfo Winter;
+    uint8_t SeasonTags[2];
+    TimingInfo Timings[AM43_TIMINGS_N];
+  };
+  
+  void GetSnapshot(Snapshot& snapshot) const;
+  // Restore state published until MCU is polled, ignored once initialized
+  void RestoreSnapshot(const Snapshot& snapshot);
+
+  // Incremented on every settings or seasons change
+  uint16_t GetSettingsRevision() const { return m_settings_rev; }
+  // User request is waiting for MCU confirmation or queued behind one
+  bool IsCommandPending() const
+  {
+    const RequestQueue& queue = m_tx_queue[static_cast<int>(Priority::User)];
+    return m_pending_active || queue.Head != queue.Tail;
+  }
+  // User requests which were not confirmed by MCU before deadline
+  unsigned long GetFailedCount() const { return m_failed_count; }
+  uint8_t GetLastFailedCommand() const { return static_cast<uint8_t>(m_last_failed_cmd); }
+
+  // Raw frames for protocol exploration
+  // Callback is called for every received frame, including bad checksum
+  typedef void (*FrameCallback)(const AM43Core::Frame& frame);
+  void SetFrameCallback(FrameCallback callback) { m_frame_callback = callback; }
+  // Queue arbitrary request, sent as background request without retransmits
+  bool SendRaw(uint8_t cmd, const uint8_t* data, uint8_t data_n);
   
 protected:
   void DeviceReset();
   //void DeviceResetLimits();
   void DeviceSetSettings();
-  //void DeviceSetTime();
+  void DeviceSetTime();
   //void DeviceSetPassword();
   //void DeviceSetPasswordChange();
   void DeviceSetSeason();
-  //void DeviceSetTiming();
+  void DeviceSetTiming();
 
   void DeviceGetSettings();
   void DeviceGetLightLevel();
   void DeviceGetBatteryLevel();
+  void DeviceGetTiming();
+  // Queue SetTime once local time is valid and every AM43_TIME_SYNC_MS after that
+  void SyncTime();
+
+  // Settings in GetSettings reply layout
+  void DecodeSettings(const uint8_t* data);
+  void EncodeSettings(uint8_t* data) const;
+  // Settings fields as used by protocol core codecs
+  AM43Core::SettingsInfo GetSettingsInfo() const;
+  void SetSettingsInfo(const AM43Core::SettingsInfo& settings);
+
+  // Feed light sample to filter
+  void UpdateLightFilter(uint8_t level);
+
+  // Response decoders, data_n is at least descriptor MinLen
+  void DecodeSettingsResponse(const uint8_t* data, uint8_t data_n);
+  void DecodeLightLevelResponse(const uint8_t* data, uint8_t data_n);
+  void DecodePositionResponse(const uint8_t* data, uint8_t data_n);
+  void DecodeBatteryLevelResponse(const uint8_t* data, uint8_t data_n);
+  void DecodeSpeedResponse(const uint8_t* data, uint8_t data_n);
+  void DecodeTimingResponse(const uint8_t* data, uint8_t data_n);
+  void DecodeSeasonResponse(const uint8_t* data, uint8_t data_n);
+
+  static void DecodeTiming(const uint8_t* data, TimingInfo& timing);
   
   #ifdef WEB_SOCKET_DEBUG
   void PrintData();
   #endif
   
+  // Queue request to be sent from Loop, so callers never wait on UART
+  // Returns false if queue is full
+  bool QueueRequest(Priority prio, Command cmd, uint8_t data);
+  bool QueueRequest(Priority prio, Command cmd, const uint8_t* data, uint8_t data_n);
+  // Send next queued request if line is idle, user requests go first
+  void ProcessQueue();
+  // Retransmit unconfirmed user request or report it as failed
+  void ProcessPending();
+  // Mark pending user request as confirmed by MCU response
+  void ConfirmPending(Command response_cmd, const uint8_t* data, uint8_t data_n);
+  
   void SendRequest(const uint8_t* buff, unsigned int buff_n);
-  // handle response from AM43 device
-  // Returns response end offset
-  int HandleResponse(const uint8_t* buff, unsigned int buff_n);
 
   // Build data payload for device SetSettings request
   // Returns size of payload in bytes
@@ -179,10 +355,13 @@ protected:
   // Returns size of request in bytes
   int BuildRequest(uint8_t* buff, unsigned int buff_n, Command cmd, const uint8_t* data, uint8_t data_n);
   
-  Stream* m_stream;
+  // Next update cycle step is delay_ms after previous one
+  void SetUpdateDelay(unsigned long delay_ms);
+  void UpdateLightTimer();
+
   UpdateStep m_update_step;
-  unsigned long m_last_update;
-  unsigned long m_update_delay;
+  int8_t m_update_timer; // Scheduler timer ids
+  int8_t m_light_timer;
   int m_no_answer_reset_counter;
   int m_update_ticks;
   
@@ -197,13 +376,98 @@ protected:
   bool m_hasLightSensor;
   uint8_t m_position;
   uint8_t m_lightLevel;
+  uint8_t m_lightFiltered;
+  uint16_t m_light_ema; // Filtered light level * 16
+  bool m_light_ema_valid;
+  unsigned long m_light_sample_ms;
+  uint8_t m_poll_scale;
   uint8_t m_batteryLevel;
   SeasonInfo m_summerSeason;
   SeasonInfo m_winterSeason;
+  uint8_t m_season_tags[2]; // Bytes preceding each season record in GetSeason reply, echoed on write
+  TimingInfo m_timings[AM43_TIMINGS_N];
+  unsigned long m_last_time_sync;
+  bool m_settings_valid;
+  bool m_seasons_valid;
+  bool m_timings_valid;
+  bool m_time_synced;
+  bool m_restored;
+  uint16_t m_settings_rev;
   
 private:
-  byte m_aux_recv_buff[256];
-  byte m_aux_buff[128];
+  typedef void (AM43Class::*ResponseDecoder)(const uint8_t* data, uint8_t data_n);
+
+  // Response handling is table driven, descriptors are indexed by
+  // command - AM43_RESPONSE_BASE
+  struct ResponseDescriptor
+  {
+    Command Cmd;
+    uint8_t MinLen;          // Decoder is skipped for shorter responses
+    ResponseDecoder Decode;
+    UpdateStep WaitStep;     // Update cycle step finished by this response
+    UpdateStep NextStep;
+  };
+
+  static const ResponseDescriptor s_responses[AM43_RESPONSE_N];
+  // Every used slot must hold response with matching code
+  static constexpr bool ResponsesOrdered(int i);
+
+  // Fixed size request record, queue is single producer/single consumer ring
+  struct Request
+  {
+    Command Cmd;
+    uint8_t Attempt; // 0 for new request, retransmit number otherwise
+    uint8_t DataN;
+    uint8_t Data[AM43_TX_DATA_MAX];
+  };
+
+  bool PushRequest(Priority prio, const Request& req);
+
+  struct RequestQueue
+  {
+    Request Items[AM43_TX_QUEUE_N];
+    volatile uint8_t Head;
+    volatile uint8_t Tail;
+  };
+
+  RequestQueue m_tx_queue[static_cast<int>(Priority::Count)];
+  unsigned long m_last_tx;
+  Command m_last_tx_cmd;
+  unsigned long m_last_user_tx;
+  unsigned long m_reply_wait_until;
+  unsigned long m_collisions_avoided;
+  bool m_tx_deferred;
+
+  // Last user request waiting for MCU confirmation, later user requests
+  // are held in queue until it's confirmed or failed
+  Request m_pending;
+  bool m_pending_active;
+  bool m_pending_resend;
+  unsigned long m_pending_sent;
+  unsigned long m_pending_deadline;
+  unsigned long m_failed_count;
+  Command m_last_failed_cmd;
+  FrameCallback m_frame_callback;
+  uint8_t m_limit_result;
+  
+  struct StreamTransport
+  {
+    Stream* Output;
+
+    int Available() { return Output != nullptr ? Output->available() : 0; }
+    int Read() { return Output->read(); }
+    void Write(const uint8_t* buff, unsigned int buff_n) { if(Output != nullptr) Output->write(buff, buff_n); }
+  };
+
+  struct ClockPolicy
+  {
+    static unsigned long Millis() { return Clock::Millis(); }
+  };
+
+  AM43Core::Link<StreamTransport, ClockPolicy, AM43Class, AM43_RECV_BUFF_N, AM43_RECV_IDLE_MS> m_link;
+  AM43Core::Tracker<ClockPolicy, AM43_TRACK_STALL_MS, AM43_TRACK_TOLERANCE> m_tracker;
+  int8_t m_track_timer;
+  byte m_aux_buff[AM43_FRAME_MAX];
   bool m_initialized;
 };
 
@@ -0,0 +1,514 @@
+#ifndef AM43_CORE_H
+#define AM43_CORE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// AM43 UART protocol core, shared by Arduino and ESPHome front-ends
+// Header only, transport, clock and frame sink are template policies so
+// all calls between them are resolved at compile time.
+// Core covers framing, receive link, move tracking and payload codecs of
+// settings and seasons. Response dispatch, device state and polling stay in
+// front-ends, which track different state.
+//
+// Transport policy:
+//   int Available();
+//   int Read();
+//   void Write(const uint8_t* buff, unsigned int buff_n);
+// Clock policy:
+//   static unsigned long Millis();
+// Sink policy:
+//   void OnFrame(const AM43Core::Frame& frame); // Called for every frame with header found
+//
+// Move tracker is independent of link and shares only clock policy
+namespace AM43Core
+{
+  static const uint8_t RequestPrefix[] = { 0x00, 0xFF, 0x00, 0x00 };
+  static const uint8_t HeaderPrefix = 0x9a;
+
+  // Request size for data payload size
+  constexpr unsigned int RequestSize(unsigned int data_n)
+  {
+    return sizeof(RequestPrefix) + 3 + data_n + 1;
+  }
+
+  struct Frame
+  {
+    uint8_t Cmd;
+    uint8_t Len;
+    const uint8_t* Data;
+    uint8_t Checksum;
+    uint8_t CalculatedChecksum;
+
+    bool IsValid() const
+    {
+      return Checksum == CalculatedChecksum;
+    }
+  };
+
+  enum class ParseResult
+  {
+    Ok,
+    Truncated,
+    NoHeader
+  };
+
+  // Find first frame in buff
+  // end is set to frame end offset if frame is found
+  inline ParseResult ParseFrame(const uint8_t* buff, unsigned int buff_n, Frame& frame, unsigned int& end)
+  {
+    // AM43 Response example
+    // 9a a7 07 0e 32 00 00 00 00 30 36
+    // 0x9a                     HEADER PREFIX
+    // 0x00                     HEADER(CMD)
+    // 0x00                     DATA LENGTH
+    // 0x00                     DATA
+    // 0x00                     CHECKSUM (HEADER PREFIX xor HEADER xor DATA LENGTH xor DATA)
+    unsigned int begin = 0;
+    while(begin < buff_n && buff[begin] != HeaderPrefix)
+    {
+      ++begin;
+    }
+
+    if(begin == buff_n)
+    {
+      return ParseResult::NoHeader;
+    }
+
+    if(begin + 3 > buff_n || begin + 3 + buff[begin + 2] >= buff_n)
+    {
+      return ParseResult::Truncated;
+    }
+
+    frame.Cmd = buff[begin + 1];
+    frame.Len = buff[begin + 2];
+    frame.Data = buff + begin + 3;
+    frame.Checksum = frame.Data[frame.Len];
+
+    end = begin + 3 + frame.Len + 1;
+    frame.CalculatedChecksum = 0;
+    for(unsigned int i = begin; i < end - 1; ++i)
+    {
+      frame.CalculatedChecksum ^= buff[i];
+    }
+
+    return ParseResult::Ok;
+  }
+
+  // Build request and store it to buff
+  // Returns size of request in bytes, 0 if buff is too small
+  inline int BuildRequest(uint8_t* buff, unsigned int buff_n, uint8_t cmd, const uint8_t* data, uint8_t data_n)
+  {
+    if(buff == nullptr || buff_n < RequestSize(data_n))
+    {
+      return 0;
+    }
+
+    // AM43 Request example
+    // 00 ff 00 00 9a 17 02 22 b8 15
+    // 0x00, 0xFF, 0x00, 0x00   REQUEST PREFIX
+    // 0x9a                     HEADER PREFIX
+    // 0x00                     HEADER(CMD)
+    // 0x01                     DATA LENGTH
+    // 0x00                     DATA
+    // 0x00                     REQUEST CHECKSUM (HEADER PREFIX xor HEADER xor DATA LENGTH xor DATA)
+    int buff_offset = 0;
+
+    memcpy(buff + buff_offset, RequestPrefix, sizeof(RequestPrefix));
+    buff_offset += sizeof(RequestPrefix);
+
+    buff[buff_offset++] = HeaderPrefix;
+    buff[buff_offset++] = cmd;
+    buff[buff_offset++] = data_n;
+    for(int i = 0; i < data_n; ++i)
+    {
+      buff[buff_offset++] = data[i];
+    }
+
+    uint8_t checksum = 0;
+    for(int i = sizeof(RequestPrefix); i < buff_offset; ++i)
+    {
+      checksum ^= buff[i];
+    }
+    buff[buff_offset++] = checksum;
+
+    return buff_offset;
+  }
+
+  // Season record, summer and winter records are carried by GetSeason reply
+  // and SetSeason request, every record is preceded by tag byte
+  struct SeasonInfo
+  {
+    uint8_t SeasonState;
+    uint8_t LightSeasonState;
+    uint8_t LightLevel;
+    uint8_t LightStartHour;
+    uint8_t LightStartMinute;
+    uint8_t LightEndHour;
+    uint8_t LightEndMinute;
+  };
+
+  static const unsigned int SeasonRecordSize = 7;
+  static const unsigned int SeasonsSize = (1 + SeasonRecordSize) * 2;
+
+  inline void DecodeSeason(const uint8_t* data, SeasonInfo& season)
+  {
+    season.SeasonState = data[0];
+    season.LightSeasonState = data[1];
+    season.LightLevel = data[2];
+    season.LightStartHour = data[3];
+    season.LightStartMinute = data[4];
+    season.LightEndHour = data[5];
+    season.LightEndMinute = data[6];
+  }
+
+  inline void EncodeSeason(const SeasonInfo& season, uint8_t* buff)
+  {
+    buff[0] = season.SeasonState;
+    buff[1] = season.LightSeasonState;
+    buff[2] = season.LightLevel;
+    buff[3] = season.LightStartHour;
+    buff[4] = season.LightStartMinute;
+    buff[5] = season.LightEndHour;
+    buff[6] = season.LightEndMinute;
+  }
+
+  // Decode GetSeason reply payload
+  // Returns false if payload is too short
+  inline bool DecodeSeasons(const uint8_t* data, unsigned int data_n, SeasonInfo& summer, SeasonInfo& winter, uint8_t tags[2])
+  {
+    if(data_n < SeasonsSize)
+    {
+      return false;
+    }
+
+    tags[0] = data[0];
+    DecodeSeason(data + 1, summer);
+    tags[1] = data[SeasonRecordSize + 1];
+    DecodeSeason(data + SeasonRecordSize + 2, winter);
+    return true;
+  }
+
+  // Encode SetSeason request payload, same layout as GetSeason reply
+  // Returns size of payload in bytes, 0 if buff is too small
+  inline int EncodeSeasons(uint8_t* buff, unsigned int buff_n, const SeasonInfo& summer, const SeasonInfo& winter, const uint8_t tags[2])
+  {
+    if(buff_n < SeasonsSize)
+    {
+      return 0;
+    }
+
+    buff[0] = tags[0];
+    EncodeSeason(summer, buff + 1);
+    buff[SeasonRecordSize + 1] = tags[1];
+    EncodeSeason(winter, buff + SeasonRecordSize + 2);
+    return SeasonsSize;
+  }
+
+  // Settings record of GetSettings reply, which carries position too
+  // Enum fields hold front-end enum values: Dir 1 - forward, Mode 1 - inching
+  struct SettingsInfo
+  {
+    uint8_t Dir;
+    uint8_t Mode;
+    uint8_t Speed;    // RPM
+    uint8_t Position;
+    uint16_t Length;  // mm
+    uint8_t Diameter; // mm
+    uint8_t Type;
+    bool TopLimit;
+    bool BottomLimit;
+    bool LightSensor;
+  };
+
+  static const unsigned int SettingsSize = 7;
+  static const unsigned int SettingsRequestSize = 6;
+
+  // Decode GetSettings reply payload
+  // Returns false if payload is too short
+  inline bool DecodeSettings(const uint8_t* data, unsigned int data_n, SettingsInfo& settings)
+  {
+    if(data_n < SettingsSize)
+    {
+      return false;
+    }
+
+    const uint8_t head = data[0];
+    settings.Dir = head & 1;
+    settings.Mode = (head >> 1) & 1;
+    settings.TopLimit = (head & 4) > 0;
+    settings.BottomLimit = (head & 8) > 0;
+    settings.LightSensor = (head & 16) > 0;
+
+    settings.Speed = data[1];
+    settings.Position = data[2];
+    settings.Length = (data[3] << 8) | data[4];
+    settings.Diameter = data[5];
+    settings.Type = data[6] >> 4;
+    return true;
+  }
+
+  // Encode settings in GetSettings reply layout
+  // Returns size of payload in bytes, 0 if buff is too small
+  inline int EncodeSettings(uint8_t* buff, unsigned int buff_n, const SettingsInfo& settings)
+  {
+    if(buff_n < SettingsSize)
+    {
+      return 0;
+    }
+
+    buff[0] = (settings.Dir & 1) |
+      ((settings.Mode & 1) << 1) |
+      (settings.TopLimit ? 4 : 0) |
+      (settings.BottomLimit ? 8 : 0) |
+      (settings.LightSensor ? 16 : 0);
+    buff[1] = settings.Speed;
+    buff[2] = settings.Position;
+    buff[3] = static_cast<uint8_t>((settings.Length & 0xFF00) >> 8);
+    buff[4] = static_cast<uint8_t>(settings.Length & 0xFF);
+    buff[5] = settings.Diameter;
+    buff[6] = settings.Type << 4;
+    return SettingsSize;
+  }
+
+  // Encode SetSettings request payload, head bits differ from reply layout
+  // and type is in head byte, position and limits are not written
+  // Returns size of payload in bytes, 0 if buff is too small
+  inline int EncodeSettingsRequest(uint8_t* buff, unsigned int buff_n, const SettingsInfo& settings)
+  {
+    if(buff_n < SettingsRequestSize)
+    {
+      return 0;
+    }
+
+    buff[0] = ((settings.Dir & 1) << 1) |
+      ((settings.Mode & 1) << 2) |
+      (settings.Type << 4);
+    buff[1] = settings.Speed;
+    buff[2] = 0;
+    buff[3] = static_cast<uint8_t>((settings.Length & 0xFF00) >> 8);
+    buff[4] = static_cast<uint8_t>(settings.Length & 0xFF);
+    buff[5] = settings.Diameter;
+    return SettingsRequestSize;
+  }
+
+  // Decode GetSpeed reply payload into speed, direction, mode and light sensor
+  // Returns false if payload is too short, other fields are kept
+  inline bool DecodeSpeed(const uint8_t* data, unsigned int data_n, SettingsInfo& settings)
+  {
+    if(data_n < 2)
+    {
+      return false;
+    }
+
+    const uint8_t head = data[0];
+    settings.Dir = (head >> 1) & 1;
+    settings.Mode = (head >> 2) & 1;
+    settings.LightSensor = ((head >> 3) & 1) > 0;
+    settings.Speed = data[1];
+    return true;
+  }
+
+  enum class Operation
+  {
+    Stopped,
+    Opening, // Position decreasing, 0 - fully open
+    Closing  // Position increasing, 100 - fully closed
+  };
+
+  inline const char* OperationName(Operation operation)
+  {
+    switch(operation)
+    {
+      case Operation::Opening:
+        return "opening";
+      case Operation::Closing:
+        return "closing";
+      default:
+        return "stopped";
+    }
+  }
+
+  // Closed loop move tracking
+  // Commanded target is kept apart from measured position, move ends when
+  // measured position reaches target or stops making progress for StallMs
+  // or takes more than twice the travel estimate
+  template<class Clock, unsigned long StallMs, uint8_t Tolerance>
+  class Tracker
+  {
+  public:
+    Tracker():
+    m_operation(Operation::Stopped),
+    m_target(0),
+    m_measured(0),
+    m_started(0),
+    m_last_progress(0),
+    m_expected_ms(0),
+    m_stall_count(0),
+    m_stalled(false)
+    {
+    }
+
+    // travel_ms is full travel time estimate, 0 if unknown
+    void Start(uint8_t target, unsigned long travel_ms)
+    {
+      m_target = target;
+      m_stalled = false;
+      m_started = Clock::Millis();
+      m_last_progress = m_started;
+
+      const unsigned int delta = target > m_measured ? target - m_measured : m_measured - target;
+      m_expected_ms = travel_ms * delta / 100;
+      m_operation = delta <= Tolerance ? Operation::Stopped :
+        (target < m_measured ? Operation::Opening : Operation::Closing);
+    }
+
+    // Target of stopped move is kept
+    void Stop()
+    {
+      m_operation = Operation::Stopped;
+    }
+
+    // Feed measured position, returns true if move has ended
+    bool Update(uint8_t measured)
+    {
+      const unsigned long now = Clock::Millis();
+      if(measured != m_measured)
+      {
+        m_measured = measured;
+        m_last_progress = now;
+      }
+
+      if(m_operation == Operation::Stopped)
+      {
+        return false;
+      }
+
+      const bool arrived = m_operation == Operation::Opening ?
+        m_measured <= m_target + Tolerance :
+        m_measured + Tolerance >= m_target;
+      if(arrived)
+      {
+        m_operation = Operation::Stopped;
+        return true;
+      }
+
+      if(now - m_last_progress >= StallMs || (m_expected_ms > 0 && now - m_started >= 2 * m_expected_ms + StallMs))
+      {
+        m_operation = Operation::Stopped;
+        m_stalled = true;
+        ++m_stall_count;
+        return true;
+      }
+
+      return false;
+    }
+
+    Operation GetOperation() const { return m_operation; }
+    bool IsMoving() const { return m_operation != Operation::Stopped; }
+    uint8_t GetTarget() const { return m_target; }
+    // Last move stopped before reaching target
+    bool IsStalled() const { return m_stalled; }
+    unsigned long GetStallCount() const { return m_stall_count; }
+
+  private:
+    Operation m_operation;
+    uint8_t m_target;
+    uint8_t m_measured;
+    unsigned long m_started;
+    unsigned long m_last_progress;
+    unsigned long m_expected_ms;
+    unsigned long m_stall_count;
+    bool m_stalled;
+  };
+
+  // Non blocking UART link
+  // Received bytes are collected until line goes idle for IdleMs or buffer
+  // is full, then every frame in the burst is passed to sink
+  template<class Transport, class Clock, class Sink, unsigned int RecvN, unsigned long IdleMs>
+  class Link
+  {
+  public:
+    explicit Link(Sink& sink):
+    m_sink(sink),
+    m_transport(),
+    m_recv_n(0),
+    m_last_recv(0)
+    {
+    }
+
+    void Begin(const Transport& transport)
+    {
+      m_transport = transport;
+      m_recv_n = 0;
+    }
+
+    // Returns true if received burst was handled
+    bool Poll()
+    {
+      while(m_recv_n < RecvN && m_transport.Available() > 0)
+      {
+        m_recv[m_recv_n++] = static_cast<uint8_t>(m_transport.Read());
+        m_last_recv = Clock::Millis();
+      }
+
+      if(m_recv_n == 0 || (m_recv_n < RecvN && Clock::Millis() - m_last_recv < IdleMs))
+      {
+        return false;
+      }
+
+      unsigned int offset = 0;
+      if(m_recv_n > 1) // At least we have header prefix and command
+      {
+        Frame frame;
+        unsigned int end = 0;
+        while(offset < m_recv_n && ParseFrame(m_recv + offset, m_recv_n - offset, frame, end) == ParseResult::Ok)
+        {
+          m_sink.OnFrame(frame);
+          offset += end;
+        }
+      }
+
+      // Frame cut by full buffer is kept and completed by following bytes
+      if(m_recv_n == RecvN && offset > 0 && offset < m_recv_n)
+      {
+        memmove(m_recv, m_recv + offset, m_recv_n - offset);
+        m_recv_n -= offset;
+      }
+      else
+      {
+        m_recv_n = 0;
+      }
+
+      return true;
+    }
+
+    // True while burst is being received
+    bool IsReceiving() const
+    {
+      return m_recv_n > 0;
+    }
+
+    unsigned long GetLastRecv() const
+    {
+      return m_last_recv;
+    }
+
+    void Send(const uint8_t* buff, unsigned int buff_n)
+    {
+      if(buff_n > 0)
+      {
+        m_transport.Write(buff, buff_n);
+      }
+    }
+
+  private:
+    Sink& m_sink;
+    Transport m_transport;
+    uint8_t m_recv[RecvN];
+    unsigned int m_recv_n;
+    unsigned long m_last_recv;
+  };
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include "am43.h"
+
+#include "battery.h"
+#include "budget.h"
+
+BatteryClass Battery;
+RAM_BUDGET_CHECK(sizeof(BatteryClass), RAM_BUDGET_BATTERY);
+
+BatteryClass::BatteryClass():
+m_samples_head(0),
+m_samples_n(0),
+m_last_sample(0),
+m_sampled(false),
+m_rate_x100(0),
+m_remaining_days(-1),
+m_poll_scale(1)
+{
+  
+}
+
+void BatteryClass::Loop()
+{
+  if(!AM43.IsInitialized())
+  {
+    return;
+  }
+
+  if(!m_sampled || Clock::Millis() - m_last_sample >= BATTERY_SAMPLE_MS)
+  {
+    m_sampled = true;
+    m_last_sample = Clock::Millis();
+    AddSample(AM43.GetBatteryLevel());
+    Estimate();
+  }
+
+  // Throttle polling as battery gets low, every poll wakes MCU
+  const uint8_t level = AM43.GetBatteryLevel();
+  const uint8_t scale = level < BATTERY_CRITICAL_LEVEL ? 4 : (level < BATTERY_LOW_LEVEL ? 2 : 1);
+  if(scale != m_poll_scale)
+  {
+    m_poll_scale = scale;
+    AM43.SetPollScale(scale);
+  }
+}
+
+void BatteryClass::GetSnapshot(Snapshot& snapshot) const
+{
+  memcpy(snapshot.Samples, m_samples, sizeof(m_samples));
+  snapshot.SamplesHead = m_samples_head;
+  snapshot.SamplesN = m_samples_n;
+}
+
+void BatteryClass::RestoreSnapshot(const Snapshot& snapshot)
+{
+  if(snapshot.SamplesHead >= BATTERY_SAMPLES_N || snapshot.SamplesN > BATTERY_SAMPLES_N)
+  {
+    return;
+  }
+
+  memcpy(m_samples, snapshot.Samples, sizeof(m_samples));
+  m_samples_head = snapshot.SamplesHead;
+  m_samples_n = snapshot.SamplesN;
+  
+  // Time since last sample is lost with reboot, first sample after boot
+  // would be spaced too close to it
+  m_sampled = m_samples_n > 0;
+  m_last_sample = Clock::Millis();
+  Estimate();
+}
+
+void BatteryClass::AddSample(uint8_t level)
+{
+  if(m_samples_n > 0)
+  {
+    const uint8_t last = m_samples[(m_samples_head + m_samples_n - 1) % BATTERY_SAMPLES_N];
+    if(level >= last + BATTERY_CHARGE_JUMP)
+    {
+      // Charged, previous discharge curve is no longer relevant
+      m_samples_head = 0;
+      m_samples_n = 0;
+    }
+  }
+
+  if(m_samples_n < BATTERY_SAMPLES_N)
+  {
+    m_samples[(m_samples_head + m_samples_n++) % BATTERY_SAMPLES_N] = level;
+  }
+  else
+  {
+    m_samples[m_samples_head] = level;
+    m_samples_head = (m_samples_head + 1) % BATTERY_SAMPLES_N;
+  }
+}
+
+void BatteryClass::Estimate()
+{
+  if(m_samples_n < BATTERY_SAMPLES_MIN)
+  {
+    m_rate_x100 = 0;
+    m_remaining_days = -1;
+    return;
+  }
+
+  // Least squares slope, x is sample index
+  int64_t sum_x = 0;
+  int64_t sum_y = 0;
+  int64_t sum_xy = 0;
+  int64_t sum_xx = 0;
+  for(int i = 0; i < m_samples_n; ++i)
+  {
+    const int64_t y = m_samples[(m_samples_head + i) % BATTERY_SAMPLES_N];
+    sum_x += i;
+    sum_y += y;
+    sum_xy += i * y;
+    sum_xx += i * i;
+  }
+
+  const int64_t n = m_samples_n;
+  const int64_t denom = n * sum_xx - sum_x * sum_x;
+  const int64_t samples_per_day = 86400000UL / BATTERY_SAMPLE_MS;
+  m_rate_x100 = (n * sum_xy - sum_x * sum_y) * 100 * samples_per_day / denom;
+
+  const int level = m_samples[(m_samples_head + m_samples_n - 1) % BATTERY_SAMPLES_N];
+  m_remaining_days = m_rate_x100 < 0 ? level * 100 / -m_rate_x100 : -1;
+}
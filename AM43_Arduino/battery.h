@@ -0,0 +1,58 @@
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <Arduino.h>
+
+#define BATTERY_SAMPLE_MS         21600000UL // Battery level series period (6 hours)
+#define BATTERY_SAMPLES_N         56         // Series length, 14 days
+#define BATTERY_SAMPLES_MIN       4          // Samples needed for discharge estimate
+#define BATTERY_CHARGE_JUMP       5          // Level rise which means battery was charged
+#define BATTERY_LOW_LEVEL         20         // Polling is slowed down below this level
+#define BATTERY_CRITICAL_LEVEL    10         // Polling is slowed down even more below this level
+
+// Battery level time series with discharge rate and runtime estimation
+class BatteryClass
+{
+  public:
+    BatteryClass();
+
+    void Loop();
+
+    bool HasEstimate() const { return m_samples_n >= BATTERY_SAMPLES_MIN && m_rate_x100 < 0; }
+    // Discharge rate in 0.01% per day, negative while discharging
+    int GetRateX100() const { return m_rate_x100; }
+    // Estimated days until battery is empty
+    int GetRemainingDays() const { return m_remaining_days; }
+    // Background poll and publish periods multiplier
+    uint8_t GetPollScale() const { return m_poll_scale; }
+
+    // Discharge series kept in warm start snapshot, so estimate survives reboots
+    struct Snapshot
+    {
+      uint8_t Samples[BATTERY_SAMPLES_N];
+      uint8_t SamplesHead;
+      uint8_t SamplesN;
+    };
+
+    void GetSnapshot(Snapshot& snapshot) const;
+    // Restored series continues with next sample BATTERY_SAMPLE_MS from now
+    void RestoreSnapshot(const Snapshot& snapshot);
+
+  private:
+    void AddSample(uint8_t level);
+    void Estimate();
+
+    uint8_t m_samples[BATTERY_SAMPLES_N]; // Ring buffer, oldest at m_samples_head
+    uint8_t m_samples_head;
+    uint8_t m_samples_n;
+    unsigned long m_last_sample;
+    bool m_sampled;
+    
+    int m_rate_x100;
+    int m_remaining_days;
+    uint8_t m_poll_scale;
+};
+
+extern BatteryClass Battery;
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+// Static RAM budget per component in bytes, checked at compile time next to
+// each global instance. Network client/server objects from libraries are not
+// counted, only buffers and state owned by the component.
+// Budgets are for ESP8266 layout with 4 byte pointers. Host builds scale
+// them by pointer size, so checks there catch growing buffers while exact
+// limits are enforced on target. test/ram_report prints sizes per component.
+#define RAM_BUDGET_AM43       1024
+#define RAM_BUDGET_MQTT       576   // Topic strings are in heap arena, sized at Init
+#define RAM_BUDGET_HTTP       160
+#define RAM_BUDGET_MULTICAST  192
+#define RAM_BUDGET_RULES      256
+#define RAM_BUDGET_BATTERY    128
+#define RAM_BUDGET_WARMSTART  128
+#define RAM_BUDGET_CALIBRATION 48
+#define RAM_BUDGET_SPEED      16
+#define RAM_BUDGET_SCHEDULER  288
+
+#define RAM_BUDGET_SCALED(budget) ((budget) * sizeof(void*) / 4)
+#define RAM_BUDGET_CHECK(size, budget) static_assert((size) <= RAM_BUDGET_SCALED(budget), #budget " exceeded")
+
+#endif
@@ -0,0 +1,153 @@
+#include "am43.h"
+
+#include "calibration.h"
+#include "budget.h"
+
+CalibrationClass Calibration;
+RAM_BUDGET_CHECK(sizeof(CalibrationClass), RAM_BUDGET_CALIBRATION);
+
+CalibrationClass::CalibrationClass():
+m_state(State::Idle),
+m_state_since(0),
+m_last_poll(0),
+m_last_user(0),
+m_rev(0)
+{
+  
+}
+
+void CalibrationClass::Loop()
+{
+  if(!IsActive())
+  {
+    return;
+  }
+
+  const unsigned long now = Clock::Millis();
+  const bool jogging = m_state == State::JogTop || m_state == State::JogBottom;
+  if(jogging)
+  {
+    if(now - m_last_user >= CALIB_IDLE_TIMEOUT_MS)
+    {
+      AM43.SendAction(AM43Class::ControlAction::Stop);
+      SetState(State::Failed);
+    }
+    return;
+  }
+
+  if(AM43.GetLimitResult() == static_cast<uint8_t>(AM43Class::ContentResult::LimitSetFailure))
+  {
+    SetState(State::Failed);
+    return;
+  }
+
+  // MCU limit bits are the only trusted confirmation
+  if((m_state == State::Resetting && !AM43.IsTopLimitSet() && !AM43.IsBottomLimitSet()) ||
+    (m_state == State::ConfirmingTop && AM43.IsTopLimitSet()))
+  {
+    SetState(m_state == State::Resetting ? State::JogTop : State::JogBottom);
+    return;
+  }
+
+  if(m_state == State::ConfirmingBottom && AM43.IsBottomLimitSet())
+  {
+    SetState(State::Done);
+    return;
+  }
+
+  if(now - m_state_since >= CALIB_STEP_TIMEOUT_MS)
+  {
+    SetState(State::Failed);
+    return;
+  }
+
+  if(now - m_last_poll >= CALIB_POLL_MS)
+  {
+    m_last_poll = now;
+    AM43.Refresh();
+  }
+}
+
+bool CalibrationClass::Start()
+{
+  if(!IsEnabled() || IsActive())
+  {
+    return false;
+  }
+
+  AM43.ResetLimits();
+  SetState(State::Resetting);
+  return true;
+}
+
+bool CalibrationClass::Jog(AM43Class::ControlAction action)
+{
+  if(m_state != State::JogTop && m_state != State::JogBottom)
+  {
+    return false;
+  }
+
+  m_last_user = Clock::Millis();
+  AM43.SendAction(action);
+  return true;
+}
+
+bool CalibrationClass::Confirm()
+{
+  if(m_state != State::JogTop && m_state != State::JogBottom)
+  {
+    return false;
+  }
+
+  const bool top = m_state == State::JogTop;
+  AM43.SendAction(AM43Class::ControlAction::Stop);
+  if(!AM43.SetLimit(top))
+  {
+    SetState(State::Failed);
+    return false;
+  }
+  SetState(top ? State::ConfirmingTop : State::ConfirmingBottom);
+  return true;
+}
+
+void CalibrationClass::Cancel()
+{
+  if(IsActive())
+  {
+    AM43.SendAction(AM43Class::ControlAction::Stop);
+  }
+
+  SetState(State::Idle);
+}
+
+void CalibrationClass::SetState(State state)
+{
+  m_state = state;
+  m_state_since = Clock::Millis();
+  m_last_user = m_state_since;
+  // Read back right after MCU had time to apply request
+  m_last_poll = m_state_since;
+  ++m_rev;
+
+  if(state == State::Done || state == State::Failed)
+  {
+    AM43.Refresh();
+  }
+}
+
+const char* CalibrationClass::StateName(State state)
+{
+  switch(state)
+  {
+    case State::Idle: return "idle";
+    case State::Resetting: return "resetting";
+    case State::JogTop: return "jog_top";
+    case State::ConfirmingTop: return "confirming_top";
+    case State::JogBottom: return "jog_bottom";
+    case State::ConfirmingBottom: return "confirming_bottom";
+    case State::Done: return "done";
+    case State::Failed: return "failed";
+  }
+
+  return "unknown";
+}
@@ -0,0 +1,69 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <Arduino.h>
+
+#include "am43.h"
+
+#define CALIB_POLL_MS         2000   // Settings read back period while waiting for MCU
+#define CALIB_STEP_TIMEOUT_MS 20000  // MCU must report limit change by then
+#define CALIB_IDLE_TIMEOUT_MS 300000 // Calibration is cancelled if user doesn't jog or confirm
+
+// Remote limits calibration
+// Reset limits, jog to top, confirm, jog to bottom, confirm
+// Every step is verified with limit bits read back by GetSettings
+class CalibrationClass
+{
+  public:
+    enum class State
+    {
+      Idle,
+      Resetting,        // Waiting for MCU to clear both limits
+      JogTop,           // Waiting for user to move blinds to top and confirm
+      ConfirmingTop,    // Waiting for MCU to report top limit
+      JogBottom,        // Waiting for user to move blinds to bottom and confirm
+      ConfirmingBottom, // Waiting for MCU to report bottom limit
+      Done,
+      Failed
+    };
+
+    CalibrationClass();
+
+    void Loop();
+
+    // Commands return false if they are not valid in current state
+    bool Start();
+    bool Jog(AM43Class::ControlAction action);
+    bool Confirm();
+    void Cancel();
+
+    State GetState() const { return m_state; }
+    bool IsActive() const { return m_state != State::Idle && m_state != State::Done && m_state != State::Failed; }
+    // Incremented on every state change
+    uint16_t GetRevision() const { return m_rev; }
+
+    static const char* StateName(State state);
+
+    // Opt-in at build time, see AM43_LIMITS_CALIBRATION
+    static bool IsEnabled()
+    {
+      #ifdef AM43_LIMITS_CALIBRATION
+      return true;
+      #else
+      return false;
+      #endif
+    }
+
+  private:
+    void SetState(State state);
+
+    State m_state;
+    unsigned long m_state_since;
+    unsigned long m_last_poll;
+    unsigned long m_last_user;
+    uint16_t m_rev;
+};
+
+extern CalibrationClass Calibration;
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#ifndef AM43_VIRTUAL_CLOCK
+#include <Arduino.h>
+#endif
+
+// Time source for AM43 and MQTT loops
+// Firmware maps directly to millis()/delay(), define AM43_VIRTUAL_CLOCK for
+// host builds where time only moves when Advance() or Delay() is called
+namespace Clock
+{
+#ifdef AM43_VIRTUAL_CLOCK
+  inline unsigned long& Now()
+  {
+    static unsigned long s_now = 0;
+    return s_now;
+  }
+
+  inline unsigned long Millis() { return Now(); }
+  inline void Delay(unsigned long ms) { Now() += ms; }
+  inline void Advance(unsigned long ms) { Now() += ms; }
+  inline void Set(unsigned long ms) { Now() = ms; }
+#else
+  inline unsigned long Millis() { return millis(); }
+  inline void Delay(unsigned long ms) { delay(ms); }
+#endif
+}
+
+#endif
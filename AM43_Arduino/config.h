@@ -0,0 +1,37 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <Arduino.h>
+
+#define CONFIG_MAGIC          0x43464731 // "CFG1"
+#define CONFIG_BIN_VER        1          // Change this if record layout changes, old record is ignored then
+#define CONFIG_WIFI_FAST_MS   5000       // Direct connect timeout before falling back to full scan
+
+// Binary config record, replaces JSON config file
+// Record is read into fixed buffers without parsing and checked with CRC-32
+struct ConfigRecord
+{
+  uint32_t Magic;
+  uint16_t Version;
+  uint16_t Size;
+
+  char MqttServer[40];
+  char MqttPort[6];
+  char MqttTopic[32];
+  char MqttUser[16];
+  char MqttPass[24];
+  char MqttGroup[32];
+  char UdpGroup[6];
+  char UdpNode[4];
+  char TimeZone[40];
+
+  // Last connected access point, used to connect without scan
+  uint8_t WifiBssid[6];
+  uint8_t WifiValid;
+  uint8_t Reserved;
+  int32_t WifiChannel;
+
+  uint32_t Crc;
+};
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <Arduino.h>
+
+// CRC-32 (IEEE 802.3), bitwise to keep flash footprint small
+inline uint32_t Crc32(const uint8_t* data, size_t data_n, uint32_t crc = 0)
+{
+  crc = ~crc;
+  for(size_t i = 0; i < data_n; ++i)
+  {
+    crc ^= data[i];
+    for(int bit = 0; bit < 8; ++bit)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+#endif
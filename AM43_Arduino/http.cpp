@@ -0,0 +1,100 @@
+#include "am43.h"
+
+#include "http.h"
+#include "speed.h"
+#include "budget.h"
+
+HttpClass Http;
+RAM_BUDGET_CHECK(sizeof(HttpClass) - sizeof(ESP8266WebServer), RAM_BUDGET_HTTP);
+
+const char* s_http_json_fmt = "{\"position\":%i,\"target\":%i,\"state\":\"%s\",\"batt\":%i,\"light\":%i,\"initialized\":%s,\"deferred\":%lu}";
+const char* s_http_type_json = "application/json";
+const char* s_http_type_text = "text/plain";
+
+HttpClass::HttpClass():
+m_server(HTTP_PORT)
+{
+  
+}
+
+void HttpClass::Init()
+{
+  m_server.on("/state", HTTP_GET, [this]() { HandleState(); });
+  m_server.on("/position", HTTP_POST, [this]() { HandlePosition(); });
+  m_server.on("/action", HTTP_POST, [this]() { HandleAction(); });
+  m_server.onNotFound([this]() { m_server.send(404, s_http_type_text, "Not found"); });
+  
+  m_server.begin();
+}
+
+void HttpClass::Loop()
+{
+  m_server.handleClient();
+}
+
+int HttpClass::ReadValue()
+{
+  const char* arg_name = m_server.hasArg("value") ? "value" : "plain";
+  if(!m_server.hasArg(arg_name))
+  {
+    return -1;
+  }
+
+  // Only short values are accepted, keep it in fixed buffer
+  const String value = m_server.arg(arg_name);
+  strlcpy(m_msg, value.c_str(), sizeof(m_msg));
+  return strlen(m_msg);
+}
+
+void HttpClass::HandleState()
+{
+  snprintf(m_msg, sizeof(m_msg), s_http_json_fmt,
+    AM43.GetPosition(), AM43.GetTargetPosition(), AM43Core::OperationName(AM43.GetOperation()), AM43.GetBatteryLevel(), AM43.GetLightLevel(),
+    AM43.IsInitialized() ? "true" : "false", AM43.GetCollisionsAvoided());
+    
+  m_server.send(200, s_http_type_json, m_msg);
+}
+
+void HttpClass::HandlePosition()
+{
+  if(ReadValue() <= 0 || !isdigit(m_msg[0]))
+  {
+    m_server.send(400, s_http_type_text, "Expected position 0-100");
+    return;
+  }
+
+  SpeedProfiles.Select(SpeedProfilesClass::Profile::Normal);
+  AM43.SetPosition(atoi(m_msg));
+  m_server.send(204);
+}
+
+void HttpClass::HandleAction()
+{
+  if(ReadValue() <= 0)
+  {
+    m_server.send(400, s_http_type_text, "Expected OPEN, CLOSE or STOP");
+    return;
+  }
+
+  if(strcasecmp(m_msg, "OPEN") == 0)
+  {
+    SpeedProfiles.Select(SpeedProfilesClass::Profile::Normal);
+    AM43.SendAction(AM43Class::ControlAction::Open);
+  }
+  else if(strcasecmp(m_msg, "CLOSE") == 0)
+  {
+    SpeedProfiles.Select(SpeedProfilesClass::Profile::Normal);
+    AM43.SendAction(AM43Class::ControlAction::Close);
+  }
+  else if(strcasecmp(m_msg, "STOP") == 0)
+  {
+    AM43.SendAction(AM43Class::ControlAction::Stop);
+  }
+  else
+  {
+    m_server.send(400, s_http_type_text, "Expected OPEN, CLOSE or STOP");
+    return;
+  }
+
+  m_server.send(204);
+}
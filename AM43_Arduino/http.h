@@ -0,0 +1,47 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <ESP8266WebServer.h>
+
+#define HTTP_PORT             80
+#define HTTP_MSG_BUFFER_SIZE  (144)   // HTTP response buffer size
+
+// Web server which tells if client connection or request data is waiting
+class HttpServer : public ESP8266WebServer
+{
+  public:
+    explicit HttpServer(int port) : ESP8266WebServer(port) {}
+
+    bool HasPendingInput() { return _server.hasClient() || _currentClient.available() > 0; }
+};
+
+// Local control API, works without MQTT broker
+// GET  /state     JSON with position, battery and light level
+// POST /position  body or "value" argument 0-100
+// POST /action    body or "value" argument OPEN/CLOSE/STOP
+class HttpClass
+{
+  public:
+    HttpClass();
+
+    void Init();
+    void Loop();
+    // Client request is waiting to be handled by next Loop
+    bool HasPendingInput() { return m_server.HasPendingInput(); }
+
+  private:
+    void HandleState();
+    void HandlePosition();
+    void HandleAction();
+
+    // Copy request value to m_msg
+    // Returns value length or -1 if it's missing
+    int ReadValue();
+
+    HttpServer m_server;
+    char m_msg[HTTP_MSG_BUFFER_SIZE];
+};
+
+extern HttpClass Http;
+
+#endif
@@ -1,17 +1,64 @@
 #include "am43.h"
 
 #include "mqtt.h"
+#include "rules.h"
+#include "battery.h"
+#include "calibration.h"
+#include "scheduler.h"
+#include "timeofday.h"
+#include "budget.h"
 
 MqttClass Mqtt;
+RAM_BUDGET_CHECK(sizeof(MqttClass) - sizeof(WiFiClient) - sizeof(PubSubClient), RAM_BUDGET_MQTT);
 
 const char* s_topic_status_fmt = "%s/status";
 const char* s_topic_cmd_cmd_fmt = "%s/command";
 const char* s_topic_pos_cmd_fmt = "%s/position/set";
 const char* s_topic_pos_status_fmt = "%s/position";
+const char* s_topic_state_fmt = "%s/state";
+const char* s_topic_stall_fmt = "%s/stall";
 const char* s_topic_json_fmt = "%s/sensor";
+const char* s_topic_error_fmt = "%s/error";
+const char* s_topic_settings_fmt = "%s/settings";
+const char* s_topic_settings_cmd_fmt = "%s/settings/set";
+const char* s_topic_season_summer_fmt = "%s/season/summer";
+const char* s_topic_season_summer_cmd_fmt = "%s/season/summer/set";
+const char* s_topic_season_winter_fmt = "%s/season/winter";
+const char* s_topic_season_winter_cmd_fmt = "%s/season/winter/set";
+const char* s_topic_timing_fmt = "%s/timing";
+const char* s_topic_timing_cmd_fmt = "%s/timing/set";
+const char* s_topic_rules_fmt = "%s/rules";
+const char* s_topic_rules_cmd_fmt = "%s/rules/set";
+const char* s_topic_light_fmt = "%s/light";
+const char* s_topic_light_cmd_fmt = "%s/light/set";
+const char* s_topic_battery_fmt = "%s/battery";
+const char* s_topic_boot_fmt = "%s/boot";
+const char* s_topic_scheduler_fmt = "%s/scheduler";
+const char* s_topic_raw_tx_fmt = "%s/raw/tx";
+const char* s_topic_raw_rx_fmt = "%s/raw/rx";
+const char* s_topic_raw_rx_cmd_fmt = "%s/raw/rx/set";
+const char* s_topic_calibration_fmt = "%s/calibration";
+const char* s_topic_calibration_cmd_fmt = "%s/calibration/set";
+const char* s_topic_speed_fmt = "%s/speed";
+const char* s_topic_speed_cmd_fmt = "%s/speed/set";
+const char* s_topic_scene_cmd_fmt = "%s/scene";
+const char* s_topic_scene_cfg_fmt = "%s/scene/";
+const char* s_topic_scene_sub_fmt = "%s/scene/+";
 
 const char* s_status_msg = "online";
-const char* s_json_fmt = "{\"batt\":%i,\"light\":%i}";
+const char* s_json_fmt = "{\"batt\":%i,\"light\":%i,\"stale\":%s}";
+const char* s_battery_fmt = "{\"level\":%i,\"rate\":%i,\"days\":%i}";
+const char* s_calibration_fmt = "{\"state\":\"%s\",\"result\":%i,\"top\":%i,\"bottom\":%i}";
+const char* s_speed_fmt = "{\"profile\":\"%s\",\"speed\":%i}";
+const char* s_stall_fmt = "{\"position\":%i,\"target\":%i,\"stalls\":%lu}";
+const char* s_scheduler_fmt = "{\"idle\":%i,\"late\":%lu,\"failed\":%i}";
+const char* s_boot_fmt = "{\"config\":%lu,\"wifi\":%lu,\"mqtt\":%lu,\"publish\":%lu,\"fast\":%s}";
+const char* s_error_fmt = "{\"cmd\":%i,\"failed\":%lu}";
+const char* s_settings_fmt = "{\"dir\":%i,\"mode\":%i,\"speed\":%i,\"length\":%u,\"diameter\":%i,\"type\":%i,\"top\":%i,\"bottom\":%i}";
+// state,light_state,light_level,start HH:MM,end HH:MM
+const char* s_season_fmt = "%i,%i,%i,%02i:%02i,%02i:%02i";
+// separator,state,position,weekday mask,HH:MM
+const char* s_timing_fmt = "%s%i,%i,%i,%02i:%02i";
 
 // Fingerprint if WiFiClientSecure is used for MQTT
 //static const char * s_fingerprint PROGMEM = "59 3C 48 0A B1 8B 39 4E 0D 58 50 47 9A 13 55 60 CC A0 1D AF";
@@ -30,31 +77,166 @@ bool ComparePayloadN(const byte* a, const char* b, int n)
   return true;
 }
 
+// Parse integer from payload which is not null terminated
+int PayloadToInt(const byte* payload, unsigned int length)
+{
+  char buff[12];
+  length = min(length, (unsigned int)sizeof(buff) - 1);
+  memcpy(buff, payload, length);
+  buff[length] = 0;
+  return atoi(buff);
+}
+
+// Split optional ",profile" suffix from command payload, i.e. "40,quiet"
+// Returns payload length without suffix, unknown profile keeps default
+unsigned int SplitProfile(const byte* payload, unsigned int length, SpeedProfilesClass::Profile& profile)
+{
+  for(unsigned int i = 0; i < length; ++i)
+  {
+    if(payload[i] == ',')
+    {
+      SpeedProfilesClass::ParseProfile((const char*)payload + i + 1, length - i - 1, profile);
+      return i;
+    }
+  }
+
+  return length;
+}
+
 MqttClass::MqttClass():
 m_client(m_espClient),
 m_lastMsg(0),
-m_lastReconnectAttempt(0),
+m_reconnectDelay(MQTT_RECONN_MS),
+m_reconnectTimer(-1),
+m_publishTimer(-1),
+m_topics(nullptr),
+m_retain_recv(false),
 m_posLast(0),
+m_operationLast(AM43Core::Operation::Stopped),
+m_stallsLast(0),
 m_batLast(0),
 m_lightLast(0),
-m_retain_recv(false)
+m_staleLast(false),
+m_failedLast(0),
+m_settingsRevLast(0),
+m_calibrationRevLast(0),
+m_speedRevLast(0),
+m_lightPubLast(-1),
+m_lightMargin(MQTT_LIGHT_MARGIN),
+m_lightThreshold(-1),
+m_rawEnabled(false),
+m_rawLast(0),
+m_rawDropped(0),
+m_bootConfigMs(0),
+m_bootWifiMs(0),
+m_bootMqttMs(0),
+m_bootFast(false),
+m_bootPublished(false)
 {
   // Set fingerprint if WiFiClientSecure is used
   //m_espClient.setFingerprint(s_fingerprint);
 }
 
-void MqttClass::Init(char* name, char* user, char* pass, const char* server, int port, const char* topic)
+void MqttClass::Init(char* name, char* user, char* pass, const char* server, int port, const char* topic, const char* group)
 {
-  snprintf(m_topic_status, sizeof(m_topic_status), s_topic_status_fmt, topic);
-  snprintf(m_topic_cmd_cmd, sizeof(m_topic_cmd_cmd), s_topic_cmd_cmd_fmt, topic);
-  snprintf(m_topic_pos_cmd, sizeof(m_topic_pos_cmd), s_topic_pos_cmd_fmt, topic);
-  snprintf(m_topic_pos_status, sizeof(m_topic_pos_status), s_topic_pos_status_fmt, topic);
-  snprintf(m_topic_json, sizeof(m_topic_json), s_topic_json_fmt, topic);
+  // Topics are packed into single arena sized for actual topic lengths
+  // Group topics are left empty if node has no group
+  if(group == nullptr)
+  {
+    group = "";
+  }
+  
+  const struct
+  {
+    const char* MqttClass::* Topic;
+    const char* Fmt;
+    const char* Base;
+  } topics[] =
+  {
+    {&MqttClass::m_topic_status, s_topic_status_fmt, topic},
+    {&MqttClass::m_topic_cmd_cmd, s_topic_cmd_cmd_fmt, topic},
+    {&MqttClass::m_topic_pos_cmd, s_topic_pos_cmd_fmt, topic},
+    {&MqttClass::m_topic_pos_status, s_topic_pos_status_fmt, topic},
+    {&MqttClass::m_topic_state, s_topic_state_fmt, topic},
+    {&MqttClass::m_topic_stall, s_topic_stall_fmt, topic},
+    {&MqttClass::m_topic_json, s_topic_json_fmt, topic},
+    {&MqttClass::m_topic_error, s_topic_error_fmt, topic},
+    {&MqttClass::m_topic_settings, s_topic_settings_fmt, topic},
+    {&MqttClass::m_topic_settings_cmd, s_topic_settings_cmd_fmt, topic},
+    {&MqttClass::m_topic_season_summer, s_topic_season_summer_fmt, topic},
+    {&MqttClass::m_topic_season_summer_cmd, s_topic_season_summer_cmd_fmt, topic},
+    {&MqttClass::m_topic_season_winter, s_topic_season_winter_fmt, topic},
+    {&MqttClass::m_topic_season_winter_cmd, s_topic_season_winter_cmd_fmt, topic},
+    {&MqttClass::m_topic_timing, s_topic_timing_fmt, topic},
+    {&MqttClass::m_topic_timing_cmd, s_topic_timing_cmd_fmt, topic},
+    {&MqttClass::m_topic_rules, s_topic_rules_fmt, topic},
+    {&MqttClass::m_topic_rules_cmd, s_topic_rules_cmd_fmt, topic},
+    {&MqttClass::m_topic_light, s_topic_light_fmt, topic},
+    {&MqttClass::m_topic_light_cmd, s_topic_light_cmd_fmt, topic},
+    {&MqttClass::m_topic_battery, s_topic_battery_fmt, topic},
+    {&MqttClass::m_topic_boot, s_topic_boot_fmt, topic},
+    {&MqttClass::m_topic_scheduler, s_topic_scheduler_fmt, topic},
+    {&MqttClass::m_topic_raw_tx, s_topic_raw_tx_fmt, topic},
+    {&MqttClass::m_topic_raw_rx, s_topic_raw_rx_fmt, topic},
+    {&MqttClass::m_topic_raw_rx_cmd, s_topic_raw_rx_cmd_fmt, topic},
+    {&MqttClass::m_topic_calibration, s_topic_calibration_fmt, topic},
+    {&MqttClass::m_topic_calibration_cmd, s_topic_calibration_cmd_fmt, topic},
+    {&MqttClass::m_topic_speed, s_topic_speed_fmt, topic},
+    {&MqttClass::m_topic_speed_cmd, s_topic_speed_cmd_fmt, topic},
+    {&MqttClass::m_topic_scene_cmd, s_topic_scene_cmd_fmt, topic},
+    {&MqttClass::m_topic_scene_cfg, s_topic_scene_cfg_fmt, topic},
+    {&MqttClass::m_topic_scene_sub, s_topic_scene_sub_fmt, topic},
+    {&MqttClass::m_topic_grp_cmd_cmd, s_topic_cmd_cmd_fmt, group},
+    {&MqttClass::m_topic_grp_pos_cmd, s_topic_pos_cmd_fmt, group},
+    {&MqttClass::m_topic_grp_scene_cmd, s_topic_scene_cmd_fmt, group},
+  };
+
+  // Only group topics of node without group are left empty, they take just terminator
+  const bool no_group = group[0] == 0;
+  size_t arena_n = 0;
+  for(const auto& t : topics)
+  {
+    arena_n += (no_group && t.Base == group ? 0 : snprintf(nullptr, 0, t.Fmt, t.Base)) + 1;
+  }
+
+  // Init is called once, arena is never reallocated after that
+  delete[] m_topics;
+  m_topics = new char[arena_n];
+
+  char* arena = m_topics;
+  for(const auto& t : topics)
+  {
+    this->*t.Topic = arena;
+    arena[0] = 0;
+    if(!no_group || t.Base != group)
+    {
+      arena += snprintf(arena, m_topics + arena_n - arena, t.Fmt, t.Base);
+    }
+    ++arena;
+  }
+
+  memset(m_scenes, -1, sizeof(m_scenes));
 
   m_name = name;
   m_user = user;
   m_pass = pass;
   
+  AM43.SetFrameCallback([](const AM43Core::Frame& frame)
+  {
+    Mqtt.PublishRawFrame(frame);
+  });
+  
+  // First connect is attempted on first loop pass, Wi-Fi is already up
+  m_reconnectTimer = Scheduler.Add([]()
+  {
+    Mqtt.ReconnectTimer();
+  }, 0);
+
+  m_publishTimer = Scheduler.Add([]()
+  {
+    Mqtt.PublishTimer();
+  }, MQTT_PUBLISH_FAST_MS);
+  
   m_client.setServer(server, port);
   m_client.setCallback([this](char* topic, byte* payload, unsigned int length)
   {
@@ -62,39 +244,105 @@ void MqttClass::Init(char* name, char* user, char* pass, const char* server, int
   });
 }
 
-void MqttClass::Loop()
+void MqttClass::ReconnectTimer()
+{
+  // Timer is stopped while connected, Loop restarts it when connection drops
+  if(m_client.connected() || Reconnect())
+  {
+    m_reconnectDelay = MQTT_RECONN_MS;
+    Scheduler.Stop(m_reconnectTimer);
+    // State and boot times go out in the same pass as connect
+    PublishTimer();
+    return;
+  }
+
+  // Exponential backoff with jitter, after broker outage many nodes
+  // would otherwise hit it at the same moment every MQTT_RECONN_MS
+  m_reconnectDelay = constrain(m_reconnectDelay * 2, (unsigned long)MQTT_RECONN_MS, (unsigned long)MQTT_RECONN_MAX_MS);
+  m_reconnectDelay += random(MQTT_RECONN_JITTER_MS);
+  Scheduler.SetPeriod(m_reconnectTimer, m_reconnectDelay);
+}
+
+void MqttClass::PublishTimer()
 {
   if(!m_client.connected())
   {
-    if(millis() - m_lastReconnectAttempt >= MQTT_RECONN_MS)
-    {
-      m_lastReconnectAttempt = millis();
-      
-      // Attempt to reconnect
-      if(Reconnect())
-      {
-        m_lastReconnectAttempt = 0;
-      }
-    }
+    return;
   }
-  else
+
+  if(m_posLast != AM43.GetPosition() ||
+    m_batLast != AM43.GetBatteryLevel() ||
+    m_lightLast != AM43.GetLightLevel() ||
+    m_settingsRevLast != AM43.GetSettingsRevision() ||
+    m_staleLast != AM43.IsStale() ||
+    (Clock::Millis() - m_lastMsg >= MQTT_PUBLISH_MS * Battery.GetPollScale()))
+  {
+    UpdateServerValue();      
+    m_lastMsg = Clock::Millis();
+    PublishBoot();
+  }
+}
+
+void MqttClass::Loop()
+{
+  // Reconnect and periodic state publish run from scheduler timers
+  if(m_client.connected())
   {
     m_client.loop();
 
-    if(millis() - m_lastMsg >= MQTT_PUBLISH_FAST_MS)
+    PublishLight();
+
+    if(m_operationLast != AM43.GetOperation() || m_stallsLast != AM43.GetStallCount())
     {
-      if(m_posLast != AM43.GetPosition() ||
-        m_batLast != AM43.GetBatteryLevel() ||
-        m_lightLast != AM43.GetLightLevel() ||
-        (millis() - m_lastMsg >= MQTT_PUBLISH_MS))
-      {
-        UpdateServerValue();      
-        m_lastMsg = millis();
-      }
+      PublishOperation();
+    }
+
+    if(m_calibrationRevLast != Calibration.GetRevision())
+    {
+      PublishCalibration();
     }
+
+    if(m_speedRevLast != SpeedProfiles.GetRevision())
+    {
+      PublishSpeed();
+    }
+
+    // Report user commands which MCU never confirmed
+    if(m_failedLast != AM43.GetFailedCount())
+    {
+      m_failedLast = AM43.GetFailedCount();
+      snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, s_error_fmt, AM43.GetLastFailedCommand(), m_failedLast);
+      m_client.publish(m_topic_error, m_msg);
+    }
+  }
+  else if(!Scheduler.IsActive(m_reconnectTimer))
+  {
+    // Dropped connection is retried after short random spread instead of instantly
+    Scheduler.Restart(m_reconnectTimer);
+    Scheduler.SetPeriod(m_reconnectTimer, random(MQTT_RECONN_JITTER_MS));
   }
 }
 
+void MqttClass::SetBootTimes(unsigned long config_ms, unsigned long wifi_ms, bool fast)
+{
+  m_bootConfigMs = config_ms;
+  m_bootWifiMs = wifi_ms;
+  m_bootFast = fast;
+}
+
+void MqttClass::PublishBoot()
+{
+  // Boot phases are reported once, time is counted from reset
+  if(m_bootPublished)
+  {
+    return;
+  }
+  
+  m_bootPublished = true;
+  snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, s_boot_fmt, m_bootConfigMs, m_bootWifiMs, m_bootMqttMs, Clock::Millis(), m_bootFast ? "true" : "false");
+  m_client.publish(m_topic_boot, m_msg, true);
+}
+
 bool MqttClass::IsOk()
 {
   return m_client.connected();
@@ -104,9 +352,39 @@ bool MqttClass::Reconnect()
 {
   if(m_client.connect(m_name, m_user, m_pass))
   {
+    if(m_bootMqttMs == 0)
+    {
+      m_bootMqttMs = Clock::Millis();
+    }
     m_retain_recv = false;
     m_client.subscribe(m_topic_cmd_cmd);
     m_client.subscribe(m_topic_pos_cmd);
+    m_client.subscribe(m_topic_scene_cmd);
+    m_client.subscribe(m_topic_settings_cmd);
+    m_client.subscribe(m_topic_season_summer_cmd);
+    m_client.subscribe(m_topic_season_winter_cmd);
+    m_client.subscribe(m_topic_timing_cmd);
+    // Rules are stored as retained message too
+    m_client.subscribe(m_topic_rules_cmd);
+    m_client.subscribe(m_topic_light_cmd);
+    m_client.subscribe(m_topic_raw_tx);
+    m_client.subscribe(m_topic_raw_rx_cmd);
+    m_client.subscribe(m_topic_calibration_cmd);
+    // Speed profiles are stored as retained message too
+    m_client.subscribe(m_topic_speed_cmd);
+    m_lightPubLast = -1;
+    // Settings are not retained, they are published again after reconnect
+    m_settingsRevLast = AM43.GetSettingsRevision() - 1;
+
+    // Scenes are stored as retained messages, broker replays them on subscribe
+    m_client.subscribe(m_topic_scene_sub);
+
+    if(m_topic_grp_cmd_cmd[0] != 0)
+    {
+      m_client.subscribe(m_topic_grp_cmd_cmd);
+      m_client.subscribe(m_topic_grp_pos_cmd);
+      m_client.subscribe(m_topic_grp_scene_cmd);
+    }
   }
   
   return m_client.connected();
@@ -114,36 +392,467 @@ bool MqttClass::Reconnect()
 
 void MqttClass::Callback(char* topic, byte* payload, unsigned int length)
 {
-  if(strcmp(topic, m_topic_cmd_cmd) == 0)
+  if(strcmp(topic, m_topic_cmd_cmd) == 0 ||
+    (m_topic_grp_cmd_cmd[0] != 0 && strcmp(topic, m_topic_grp_cmd_cmd) == 0))
   {
-    if(ComparePayloadN(payload, "OPEN", length) ||
-      ComparePayloadN(payload, "ON", length) ||
-      ComparePayloadN(payload, "UP", length))
+    SpeedProfilesClass::Profile profile = SpeedProfilesClass::Profile::Normal;
+    length = SplitProfile(payload, length, profile);
+    HandleCommand(payload, length, profile);
+  }
+  else if(strcmp(topic, m_topic_pos_cmd) == 0)
+  {
+    if(m_retain_recv)
+    {
+      SpeedProfilesClass::Profile profile = SpeedProfilesClass::Profile::Normal;
+      length = SplitProfile(payload, length, profile);
+      SpeedProfiles.Select(profile);
+      AM43.SetPosition(PayloadToInt(payload, length));
+    }
+    else
     {
-      AM43.SendAction(AM43Class::ControlAction::Open);
+      m_retain_recv = true;
     }
-    else if(ComparePayloadN(payload, "CLOSE", length) ||
-      ComparePayloadN(payload, "OFF", length) ||
-      ComparePayloadN(payload, "DOWN", length))
+  }
+  else if(m_topic_grp_pos_cmd[0] != 0 && strcmp(topic, m_topic_grp_pos_cmd) == 0)
+  {
+    // Group position is not expected to be retained
+    SpeedProfilesClass::Profile profile = SpeedProfilesClass::Profile::Normal;
+    length = SplitProfile(payload, length, profile);
+    SpeedProfiles.Select(profile);
+    AM43.SetPosition(PayloadToInt(payload, length));
+  }
+  else if(strcmp(topic, m_topic_scene_cmd) == 0 ||
+    (m_topic_grp_scene_cmd[0] != 0 && strcmp(topic, m_topic_grp_scene_cmd) == 0))
+  {
+    HandleScene(payload, length);
+  }
+  else if(strcmp(topic, m_topic_settings_cmd) == 0)
+  {
+    HandleSettings(payload, length);
+  }
+  else if(strcmp(topic, m_topic_season_summer_cmd) == 0)
+  {
+    HandleSeason(true, payload, length);
+  }
+  else if(strcmp(topic, m_topic_season_winter_cmd) == 0)
+  {
+    HandleSeason(false, payload, length);
+  }
+  else if(strcmp(topic, m_topic_timing_cmd) == 0)
+  {
+    HandleTiming(payload, length);
+  }
+  else if(strcmp(topic, m_topic_light_cmd) == 0)
+  {
+    HandleLightConfig(payload, length);
+  }
+  else if(strcmp(topic, m_topic_raw_tx) == 0)
+  {
+    HandleRawTx(payload, length);
+  }
+  else if(strcmp(topic, m_topic_calibration_cmd) == 0)
+  {
+    HandleCalibration(payload, length);
+  }
+  else if(strcmp(topic, m_topic_speed_cmd) == 0)
+  {
+    HandleSpeedConfig(payload, length);
+  }
+  else if(strcmp(topic, m_topic_raw_rx_cmd) == 0)
+  {
+    m_rawEnabled = PayloadToInt(payload, length) != 0;
+    m_rawDropped = 0;
+  }
+  else if(strcmp(topic, m_topic_rules_cmd) == 0)
+  {
+    // Publish compiled rules count or failed rule number
+    const int result = Rules.Compile((const char*)payload, length);
+    if(result >= 0)
     {
-      AM43.SendAction(AM43Class::ControlAction::Close);
+      snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, "%i", result);
     }
-    else if(ComparePayloadN(payload, "STOP", length))
+    else
     {
-      AM43.SendAction(AM43Class::ControlAction::Stop);
+      snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, "error:%i", -result);
     }
+    m_client.publish(m_topic_rules, m_msg);
   }
-  else if(strcmp(topic, m_topic_pos_cmd) == 0)
+  else if(strncmp(topic, m_topic_scene_cfg, strlen(m_topic_scene_cfg)) == 0)
   {
-    if(m_retain_recv)
+    // <topic>/scene/<id> with position payload, empty payload removes scene
+    const int scene_id = atoi(topic + strlen(m_topic_scene_cfg));
+    if(scene_id >= 0 && scene_id < MQTT_SCENES_N)
+    {
+      m_scenes[scene_id] = length > 0 ? constrain(PayloadToInt(payload, length), 0, 100) : -1;
+    }
+  }
+}
+
+void MqttClass::HandleCommand(const byte* payload, unsigned int length, SpeedProfilesClass::Profile profile)
+{
+  // Empty command, i.e. ",quiet", would match any keyword
+  if(length == 0)
+  {
+    return;
+  }
+
+  if(ComparePayloadN(payload, "OPEN", length) ||
+    ComparePayloadN(payload, "ON", length) ||
+    ComparePayloadN(payload, "UP", length))
+  {
+    SpeedProfiles.Select(profile);
+    AM43.SendAction(AM43Class::ControlAction::Open);
+  }
+  else if(ComparePayloadN(payload, "CLOSE", length) ||
+    ComparePayloadN(payload, "OFF", length) ||
+    ComparePayloadN(payload, "DOWN", length))
+  {
+    SpeedProfiles.Select(profile);
+    AM43.SendAction(AM43Class::ControlAction::Close);
+  }
+  else if(ComparePayloadN(payload, "STOP", length))
+  {
+    AM43.SendAction(AM43Class::ControlAction::Stop);
+  }
+}
+
+void MqttClass::HandleScene(const byte* payload, unsigned int length)
+{
+  if(length == 0)
+  {
+    return;
+  }
+  
+  const int scene_id = PayloadToInt(payload, length);
+  if(scene_id >= 0 && scene_id < MQTT_SCENES_N && m_scenes[scene_id] >= 0)
+  {
+    SpeedProfiles.Select(SpeedProfilesClass::Profile::Fast);
+    AM43.SetPosition(m_scenes[scene_id]);
+  }
+}
+
+void MqttClass::HandleSettings(const byte* payload, unsigned int length)
+{
+  // Comma separated key=value pairs, i.e. "speed=30,dir=1"
+  // Keys not present keep current values
+  char buff[MQTT_MSG_BUFFER_SIZE];
+  length = min(length, (unsigned int)sizeof(buff) - 1);
+  memcpy(buff, payload, length);
+  buff[length] = 0;
+
+  AM43Class::Settings settings = AM43.GetDeviceSettings();
+  char* save_ptr = nullptr;
+  for(char* pair = strtok_r(buff, ",", &save_ptr); pair != nullptr; pair = strtok_r(nullptr, ",", &save_ptr))
+  {
+    char* value = strchr(pair, '=');
+    if(value == nullptr)
+    {
+      continue;
+    }
+    *value++ = 0;
+    
+    const int val = atoi(value);
+    if(strcasecmp(pair, "dir") == 0)
+    {
+      settings.Dir = val ? AM43Class::Direction::Forward : AM43Class::Direction::Reverse;
+    }
+    else if(strcasecmp(pair, "mode") == 0)
+    {
+      settings.Mode = val ? AM43Class::OperationMode::Inching : AM43Class::OperationMode::Continuous;
+    }
+    else if(strcasecmp(pair, "speed") == 0)
+    {
+      settings.Speed = constrain(val, 0, 255);
+    }
+    else if(strcasecmp(pair, "length") == 0)
     {
-      AM43.SetPosition(atoi((const char*)payload));
+      settings.Length = constrain(val, 0, 65535);
+    }
+    else if(strcasecmp(pair, "diameter") == 0)
+    {
+      settings.Diameter = constrain(val, 0, 255);
+    }
+    else if(strcasecmp(pair, "type") == 0)
+    {
+      settings.Type = static_cast<AM43Class::DeviceType>(constrain(val, 0, 15));
+    }
+  }
+
+  AM43.SetDeviceSettings(settings);
+}
+
+void MqttClass::HandleSeason(bool summer, const byte* payload, unsigned int length)
+{
+  char buff[MQTT_MSG_BUFFER_SIZE];
+  length = min(length, (unsigned int)sizeof(buff) - 1);
+  memcpy(buff, payload, length);
+  buff[length] = 0;
+
+  // %d, not %i, zero padded "08:09" as published is not octal
+  int v[7];
+  if(sscanf(buff, "%d,%d,%d,%d:%d,%d:%d", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]) != 7)
+  {
+    return;
+  }
+
+  AM43Class::SeasonInfo season;
+  season.SeasonState = v[0];
+  season.LightSeasonState = v[1];
+  season.LightLevel = v[2];
+  season.LightStartHour = constrain(v[3], 0, 23);
+  season.LightStartMinute = constrain(v[4], 0, 59);
+  season.LightEndHour = constrain(v[5], 0, 23);
+  season.LightEndMinute = constrain(v[6], 0, 59);
+
+  if(summer)
+  {
+    AM43.SetSeasons(season, AM43.GetWinterSeason());
+  }
+  else
+  {
+    AM43.SetSeasons(AM43.GetSummerSeason(), season);
+  }
+}
+
+void MqttClass::HandleTiming(const byte* payload, unsigned int length)
+{
+  // slot:state,position,weekday mask,HH:MM, i.e. "0:1,100,62,07:30"
+  char buff[MQTT_MSG_BUFFER_SIZE];
+  length = min(length, (unsigned int)sizeof(buff) - 1);
+  memcpy(buff, payload, length);
+  buff[length] = 0;
+
+  // %d, not %i, zero padded "08:09" as published is not octal
+  int v[6];
+  if(sscanf(buff, "%d:%d,%d,%d,%d:%d", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 6)
+  {
+    return;
+  }
+
+  AM43Class::TimingInfo timing;
+  timing.State = v[1] ? 1 : 0;
+  timing.Position = constrain(v[2], 0, 100);
+  timing.RepeatMask = v[3] & 0x7F;
+  timing.Hour = constrain(v[4], 0, 23);
+  timing.Minute = constrain(v[5], 0, 59);
+  
+  AM43.SetTiming(v[0], timing);
+}
+
+void MqttClass::HandleCalibration(const byte* payload, unsigned int length)
+{
+  if(length == 5 && ComparePayloadN(payload, "start", length))
+  {
+    Calibration.Start();
+  }
+  else if(length == 2 && ComparePayloadN(payload, "up", length))
+  {
+    Calibration.Jog(AM43Class::ControlAction::Open);
+  }
+  else if(length == 4 && ComparePayloadN(payload, "down", length))
+  {
+    Calibration.Jog(AM43Class::ControlAction::Close);
+  }
+  else if(length == 4 && ComparePayloadN(payload, "stop", length))
+  {
+    Calibration.Jog(AM43Class::ControlAction::Stop);
+  }
+  else if(length == 7 && ComparePayloadN(payload, "confirm", length))
+  {
+    Calibration.Confirm();
+  }
+  else if(length == 6 && ComparePayloadN(payload, "cancel", length))
+  {
+    Calibration.Cancel();
+  }
+
+  // Rejected commands are visible as unchanged state
+  PublishCalibration();
+}
+
+void MqttClass::PublishCalibration()
+{
+  m_calibrationRevLast = Calibration.GetRevision();
+  snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, s_calibration_fmt,
+    CalibrationClass::IsEnabled() ? CalibrationClass::StateName(Calibration.GetState()) : "disabled", AM43.GetLimitResult(),
+    AM43.IsTopLimitSet() ? 1 : 0, AM43.IsBottomLimitSet() ? 1 : 0);
+  m_client.publish(m_topic_calibration, m_msg);
+}
+
+void MqttClass::HandleRawTx(const byte* payload, unsigned int length)
+{
+  // Hex bytes, command first, then payload, i.e. "a8 01" or "a801"
+  uint8_t data[1 + AM43_TX_DATA_MAX];
+  int data_n = 0;
+  int nibble_n = 0;
+  for(unsigned int i = 0; i < length; ++i)
+  {
+    const char c = payload[i];
+    uint8_t nibble;
+    if(c >= '0' && c <= '9')
+    {
+      nibble = c - '0';
+    }
+    else if(c >= 'a' && c <= 'f')
+    {
+      nibble = c - 'a' + 10;
+    }
+    else if(c >= 'A' && c <= 'F')
+    {
+      nibble = c - 'A' + 10;
+    }
+    else if(c == ' ' || c == ':' || c == ',')
+    {
+      continue;
     }
     else
     {
-      m_retain_recv = true;
+      return;
+    }
+
+    if(nibble_n % 2 == 0)
+    {
+      if(data_n == sizeof(data))
+      {
+        return;
+      }
+      data[data_n++] = nibble << 4;
     }
+    else
+    {
+      data[data_n - 1] |= nibble;
+    }
+    ++nibble_n;
   }
+
+  if(data_n == 0 || nibble_n % 2 != 0)
+  {
+    return;
+  }
+
+  AM43.SendRaw(data[0], data + 1, data_n - 1);
+}
+
+void MqttClass::PublishRawFrame(const AM43Core::Frame& frame)
+{
+  if(!m_rawEnabled || !IsOk())
+  {
+    return;
+  }
+
+  // Frames are dropped instead of queued, drop count goes with next frame
+  if(Clock::Millis() - m_rawLast < MQTT_RAW_MIN_MS)
+  {
+    ++m_rawDropped;
+    return;
+  }
+  m_rawLast = Clock::Millis();
+
+  // cmd len data... chk, followed by checksum status
+  char msg[(3 + AM43_RECV_BUFF_N) * 3 + 24];
+  int msg_n = snprintf(msg, sizeof(msg), "%02x %02x", frame.Cmd, frame.Len);
+  for(int i = 0; i < frame.Len && msg_n < (int)sizeof(msg); ++i)
+  {
+    msg_n += snprintf(msg + msg_n, sizeof(msg) - msg_n, " %02x", frame.Data[i]);
+  }
+  if(msg_n < (int)sizeof(msg))
+  {
+    snprintf(msg + msg_n, sizeof(msg) - msg_n, " %02x %s %u", frame.Checksum, frame.IsValid() ? "ok" : "bad", m_rawDropped);
+  }
+  m_rawDropped = 0;
+  
+  m_client.publish(m_topic_raw_rx, msg);
+}
+
+void MqttClass::HandleLightConfig(const byte* payload, unsigned int length)
+{
+  // Comma separated key=value pairs, i.e. "interval=5000,margin=1,threshold=2"
+  char buff[MQTT_MSG_BUFFER_SIZE];
+  length = min(length, (unsigned int)sizeof(buff) - 1);
+  memcpy(buff, payload, length);
+  buff[length] = 0;
+
+  char* save_ptr = nullptr;
+  for(char* pair = strtok_r(buff, ",", &save_ptr); pair != nullptr; pair = strtok_r(nullptr, ",", &save_ptr))
+  {
+    char* value = strchr(pair, '=');
+    if(value == nullptr)
+    {
+      continue;
+    }
+    *value++ = 0;
+
+    const long val = atol(value);
+    if(strcasecmp(pair, "interval") == 0)
+    {
+      AM43.SetLightSamplePeriod(max(val, 0L));
+    }
+    else if(strcasecmp(pair, "margin") == 0)
+    {
+      m_lightMargin = max(val, 0L);
+    }
+    else if(strcasecmp(pair, "threshold") == 0)
+    {
+      m_lightThreshold = max(val, -1L);
+    }
+  }
+}
+
+void MqttClass::PublishLight()
+{
+  if(!AM43.IsInitialized())
+  {
+    return;
+  }
+  
+  const int light = AM43.GetLightLevelFiltered();
+  if(m_lightPubLast >= 0)
+  {
+    const bool crossed = m_lightThreshold >= 0 &&
+      (m_lightPubLast < m_lightThreshold) != (light < m_lightThreshold);
+    const bool moved = m_lightMargin > 0 && abs(light - m_lightPubLast) >= m_lightMargin;
+    if(!crossed && !moved)
+    {
+      return;
+    }
+  }
+
+  m_lightPubLast = light;
+  snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, "%i", light);
+  m_client.publish(m_topic_light, m_msg);
+}
+
+void MqttClass::PublishSettings()
+{
+  m_settingsRevLast = AM43.GetSettingsRevision();
+  
+  const AM43Class::Settings settings = AM43.GetDeviceSettings();
+  snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, s_settings_fmt,
+    static_cast<int>(settings.Dir), static_cast<int>(settings.Mode), settings.Speed,
+    settings.Length, settings.Diameter, static_cast<int>(settings.Type),
+    AM43.IsTopLimitSet() ? 1 : 0, AM43.IsBottomLimitSet() ? 1 : 0);
+  m_client.publish(m_topic_settings, m_msg);
+
+  const AM43Class::SeasonInfo* seasons[] = { &AM43.GetSummerSeason(), &AM43.GetWinterSeason() };
+  const char* topics[] = { m_topic_season_summer, m_topic_season_winter };
+  for(int i = 0; i < 2; ++i)
+  {
+    const AM43Class::SeasonInfo* s = seasons[i];
+    snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, s_season_fmt,
+      s->SeasonState, s->LightSeasonState, s->LightLevel,
+      s->LightStartHour, s->LightStartMinute, s->LightEndHour, s->LightEndMinute);
+    m_client.publish(topics[i], m_msg);
+  }
+
+  // All timing slots separated by ';'
+  int msg_n = 0;
+  for(int i = 0; i < AM43_TIMINGS_N && msg_n < MQTT_MSG_BUFFER_SIZE; ++i)
+  {
+    const AM43Class::TimingInfo& t = AM43.GetTiming(i);
+    msg_n += snprintf(m_msg + msg_n, MQTT_MSG_BUFFER_SIZE - msg_n, s_timing_fmt,
+      i == 0 ? "" : ";", t.State, t.Position, t.RepeatMask, t.Hour, t.Minute);
+  }
+  m_client.publish(m_topic_timing, m_msg);
 }
 
 void MqttClass::UpdateServerValue()
@@ -155,16 +864,93 @@ void MqttClass::UpdateServerValue()
 
   m_client.publish(m_topic_status, s_status_msg);
 
-  if(AM43.IsInitialized())
+  // Snapshot restored after reboot is published as stale until MCU is polled
+  if(AM43.HasState())
   {
+    m_staleLast = AM43.IsStale();
     m_posLast = AM43.GetPosition();
     m_batLast = AM43.GetBatteryLevel();
     m_lightLast = AM43.GetLightLevel();
     
     snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, "%i", m_posLast);
     m_client.publish(m_topic_pos_status, m_msg);
+    m_client.publish(m_topic_state, AM43Core::OperationName(AM43.GetOperation()));
     
-    snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, s_json_fmt, m_batLast, m_lightLast);
+    snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, s_json_fmt, m_batLast, m_lightLast, m_staleLast ? "true" : "false");
     m_client.publish(m_topic_json, m_msg);
+
+    if(m_settingsRevLast != AM43.GetSettingsRevision())
+    {
+      PublishSettings();
+    }
+
+    if(Battery.HasEstimate())
+    {
+      snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, s_battery_fmt, m_batLast, Battery.GetRateX100(), Battery.GetRemainingDays());
+      m_client.publish(m_topic_battery, m_msg);
+    }
+  }
+
+  // Share of uptime spent sleeping and worst timer lateness
+  snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, s_scheduler_fmt,
+    (int)(Scheduler.GetIdleTime() / max(Clock::Millis() / 100, 1UL)), Scheduler.GetLateMax(), Scheduler.GetAddFailed());
+  m_client.publish(m_topic_scheduler, m_msg);
+}
+
+void MqttClass::HandleSpeedConfig(const byte* payload, unsigned int length)
+{
+  // Comma separated key=value pairs, i.e. "fast=30,quiet=15,night=22:00-07:00"
+  // Profile speed 0 disables profile, night=off disables night window
+  char buff[MQTT_MSG_BUFFER_SIZE];
+  length = min(length, (unsigned int)sizeof(buff) - 1);
+  memcpy(buff, payload, length);
+  buff[length] = 0;
+
+  char* save_ptr = nullptr;
+  for(char* pair = strtok_r(buff, ",", &save_ptr); pair != nullptr; pair = strtok_r(nullptr, ",", &save_ptr))
+  {
+    char* value = strchr(pair, '=');
+    if(value == nullptr)
+    {
+      continue;
+    }
+    *value++ = 0;
+
+    SpeedProfilesClass::Profile profile;
+    if(SpeedProfilesClass::ParseProfile(pair, strlen(pair), profile))
+    {
+      SpeedProfiles.SetProfileSpeed(profile, constrain(atoi(value), 0, 255));
+    }
+    else if(strcasecmp(pair, "night") == 0)
+    {
+      const char* end_txt = strchr(value, '-');
+      const int start = ParseTime(value);
+      const int end = end_txt != nullptr ? ParseTime(end_txt + 1) : -1;
+      SpeedProfiles.SetNightWindow(start, end);
+    }
+  }
+
+  PublishSpeed();
+}
+
+void MqttClass::PublishSpeed()
+{
+  m_speedRevLast = SpeedProfiles.GetRevision();
+  snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, s_speed_fmt,
+    SpeedProfilesClass::ProfileName(SpeedProfiles.GetProfile()), AM43.GetDeviceSettings().Speed);
+  m_client.publish(m_topic_speed, m_msg);
+}
+
+void MqttClass::PublishOperation()
+{
+  m_operationLast = AM43.GetOperation();
+  m_client.publish(m_topic_state, AM43Core::OperationName(m_operationLast));
+
+  // Move ended before reaching target, i.e. obstruction or limit
+  if(m_stallsLast != AM43.GetStallCount())
+  {
+    m_stallsLast = AM43.GetStallCount();
+    snprintf(m_msg, MQTT_MSG_BUFFER_SIZE, s_stall_fmt, AM43.GetPosition(), AM43.GetTargetPosition(), m_stallsLast);
+    m_client.publish(m_topic_stall, m_msg);
   }
 }
@@ -4,25 +4,57 @@
 #include <PubSubClient.h>
 #include <WiFiClient.h>
 
-#define MQTT_MSG_BUFFER_SIZE  (64)   // MQTT message buffer size
+#include "am43_core.h"
+#include "speed.h"
+
+#define MQTT_MSG_BUFFER_SIZE  (96)   // MQTT message buffer size
 #define MQTT_RECONN_MS        5000
+#define MQTT_RECONN_MAX_MS    120000 // Reconnect backoff limit
+#define MQTT_RECONN_JITTER_MS 3000   // Random spread so fleet doesn't reconnect in lockstep
 #define MQTT_PUBLISH_FAST_MS  500
 #define MQTT_PUBLISH_MS       60000
+#define MQTT_LIGHT_MARGIN     1      // Default filtered light change which is published
+#define MQTT_SCENES_N         16     // Stored scenes count, scene ids are 0..MQTT_SCENES_N-1
+#define MQTT_RAW_MIN_MS       100    // Min spacing of published raw frames, frames in between are dropped
 
 class MqttClass
 {
   public:
     MqttClass();
 
-    void Init(char* name, char* user, char* pass, const char* server, int port, const char* topic);
+    void Init(char* name, char* user, char* pass, const char* server, int port, const char* topic, const char* group);
     void Loop();
     void UpdateServerValue();
+    // Boot phase timestamps, published once on first publish
+    void SetBootTimes(unsigned long config_ms, unsigned long wifi_ms, bool fast);
 
     bool IsOk();
+    // Broker data is waiting to be read by next Loop
+    bool HasPendingInput() { return m_espClient.available() > 0; }
+
+    // Publish received AM43 frame to raw topic if enabled
+    void PublishRawFrame(const AM43Core::Frame& frame);
 
   private:
     bool Reconnect();
+    void ReconnectTimer();
+    void PublishTimer();
     void Callback(char* topic, byte* payload, unsigned int length);
+    void HandleCommand(const byte* payload, unsigned int length, SpeedProfilesClass::Profile profile);
+    void HandleScene(const byte* payload, unsigned int length);
+    void HandleSettings(const byte* payload, unsigned int length);
+    void HandleSeason(bool summer, const byte* payload, unsigned int length);
+    void HandleTiming(const byte* payload, unsigned int length);
+    void PublishSettings();
+    void HandleLightConfig(const byte* payload, unsigned int length);
+    void PublishLight();
+    void PublishBoot();
+    void HandleRawTx(const byte* payload, unsigned int length);
+    void HandleCalibration(const byte* payload, unsigned int length);
+    void PublishCalibration();
+    void HandleSpeedConfig(const byte* payload, unsigned int length);
+    void PublishSpeed();
+    void PublishOperation();
 
     //WiFiClientSecure m_espClient;
     WiFiClient m_espClient;
@@ -31,21 +63,81 @@ class MqttClass
     char* m_user;
     char* m_pass;
     unsigned long m_lastMsg;
-    unsigned long m_lastReconnectAttempt;
+    unsigned long m_reconnectDelay;
+    int8_t m_reconnectTimer; // Scheduler timer ids
+    int8_t m_publishTimer;
     char m_msg[MQTT_MSG_BUFFER_SIZE];
     
-    // Must be at least mqtt_topic size + sub topic size
-    char m_topic_status[48];
-    char m_topic_cmd_cmd[48];
-    char m_topic_pos_cmd[48];
-    char m_topic_pos_status[48];
-    char m_topic_json[48];
+    // Topic strings, all point into m_topics arena
+    char* m_topics;
+    const char* m_topic_status;
+    const char* m_topic_cmd_cmd;
+    const char* m_topic_pos_cmd;
+    const char* m_topic_pos_status;
+    const char* m_topic_state;
+    const char* m_topic_stall;
+    const char* m_topic_json;
+    const char* m_topic_error;
+    const char* m_topic_settings;
+    const char* m_topic_settings_cmd;
+    const char* m_topic_season_summer;
+    const char* m_topic_season_summer_cmd;
+    const char* m_topic_season_winter;
+    const char* m_topic_season_winter_cmd;
+    const char* m_topic_timing;
+    const char* m_topic_timing_cmd;
+    const char* m_topic_rules;
+    const char* m_topic_rules_cmd;
+    const char* m_topic_light;
+    const char* m_topic_light_cmd;
+    const char* m_topic_battery;
+    const char* m_topic_boot;
+    const char* m_topic_scheduler;
+    const char* m_topic_raw_tx;
+    const char* m_topic_raw_rx;
+    const char* m_topic_raw_rx_cmd;
+    const char* m_topic_calibration;
+    const char* m_topic_calibration_cmd;
+    const char* m_topic_speed;
+    const char* m_topic_speed_cmd;
+    const char* m_topic_scene_cmd;
+    const char* m_topic_scene_cfg;
+    const char* m_topic_scene_sub;
+
+    // Group topics, empty if node has no group
+    const char* m_topic_grp_cmd_cmd;
+    const char* m_topic_grp_pos_cmd;
+    const char* m_topic_grp_scene_cmd;
+
+    // Scene id to position, -1 if scene is not stored for this node
+    int8_t m_scenes[MQTT_SCENES_N];
 
     bool m_retain_recv;
     // Last AM43 status
     uint8_t m_posLast;
+    AM43Core::Operation m_operationLast;
+    unsigned long m_stallsLast;
     uint8_t m_batLast;
     uint8_t m_lightLast;
+    bool m_staleLast;
+    unsigned long m_failedLast;
+    uint16_t m_settingsRevLast;
+    uint16_t m_calibrationRevLast;
+    uint16_t m_speedRevLast;
+    // Filtered light publication, -1 if nothing published yet
+    int m_lightPubLast;
+    int m_lightMargin;    // Publish on change by margin, 0 - off
+    int m_lightThreshold; // Publish on threshold crossing, -1 - off
+    // Raw frames, off by default
+    bool m_rawEnabled;
+    unsigned long m_rawLast;
+    unsigned int m_rawDropped;
+    // Boot timing
+    unsigned long m_bootConfigMs;
+    unsigned long m_bootWifiMs;
+    unsigned long m_bootMqttMs;
+    bool m_bootFast;
+    bool m_bootPublished;
 };
 
 extern MqttClass Mqtt;
@@ -0,0 +1,175 @@
+#include "am43.h"
+
+#include "multicast.h"
+#include "speed.h"
+#include "budget.h"
+
+MulticastClass Multicast;
+RAM_BUDGET_CHECK(sizeof(MulticastClass) - sizeof(WiFiUDP), RAM_BUDGET_MULTICAST);
+
+namespace {
+static const int s_header_size = 8;
+static const int s_entry_size = 3;
+}
+
+MulticastClass::MulticastClass():
+m_group_id(0),
+m_node_id(0),
+m_last_seq(0),
+m_last_seq_time(0),
+m_seq_valid(false),
+m_packet_n(0)
+{
+  
+}
+
+void MulticastClass::Init(uint16_t group_id, uint8_t node_id)
+{
+  m_group_id = group_id;
+  m_node_id = node_id;
+
+  if(m_group_id != 0 && m_node_id != 0)
+  {
+    m_udp.beginMulticast(WiFi.localIP(), IPAddress(MULTICAST_ADDR), MULTICAST_PORT);
+  }
+}
+
+void MulticastClass::Loop()
+{
+  if(m_group_id == 0 || m_node_id == 0)
+  {
+    return;
+  }
+
+  // Datagram may be already parsed by HasPendingInput
+  int packet_n = m_packet_n > 0 ? m_packet_n : m_udp.parsePacket();
+  m_packet_n = 0;
+  while(packet_n > 0)
+  {
+    const int buff_n = m_udp.read(m_buff, sizeof(m_buff));
+    if(buff_n == packet_n)
+    {
+      HandlePacket(m_buff, buff_n);
+    }
+    
+    packet_n = m_udp.parsePacket();
+  }
+}
+
+bool MulticastClass::HasPendingInput()
+{
+  if(m_group_id == 0 || m_node_id == 0)
+  {
+    return false;
+  }
+
+  // UDP has no peek, next datagram is parsed and kept for Loop
+  if(m_packet_n == 0)
+  {
+    m_packet_n = m_udp.parsePacket();
+  }
+  return m_packet_n > 0;
+}
+
+void MulticastClass::HandlePacket(const uint8_t* buff, int buff_n)
+{
+  if(buff_n < s_header_size || buff[0] != MULTICAST_MAGIC || buff[1] != MULTICAST_VERSION)
+  {
+    return;
+  }
+
+  const uint16_t group_id = buff[2] | (buff[3] << 8);
+  const uint16_t seq = buff[4] | (buff[5] << 8);
+  const uint8_t flags = buff[6];
+  const uint8_t entries_n = buff[7];
+  
+  if(group_id != m_group_id || buff_n < s_header_size + entries_n * s_entry_size)
+  {
+    return;
+  }
+
+  // Senders repeat datagrams for reliability, apply each sequence once
+  // Sequence wraps, so newer means positive signed distance
+  // Restarted sender begins from lower sequence, so tracking expires once
+  // last applied sequence is older than any repeat of it
+  const unsigned long now = Clock::Millis();
+  const bool duplicate = m_seq_valid &&
+    now - m_last_seq_time < MULTICAST_SEQ_RESET_MS &&
+    static_cast<int16_t>(seq - m_last_seq) <= 0;
+  if(!duplicate)
+  {
+    m_last_seq = seq;
+    m_last_seq_time = now;
+    m_seq_valid = true;
+  }
+
+  const uint8_t* entry = buff + s_header_size;
+  for(int i = 0; i < entries_n; ++i, entry += s_entry_size)
+  {
+    if(entry[0] != m_node_id && entry[0] != MULTICAST_NODE_ALL)
+    {
+      continue;
+    }
+
+    // Repeated datagram is acked again, previous ack may be lost
+    if(!duplicate)
+    {
+      Apply(static_cast<Op>(entry[1]), entry[2]);
+    }
+
+    if(flags & Flag::AckRequest)
+    {
+      SendAck(seq);
+    }
+    
+    // Single entry per node is applied
+    break;
+  }
+}
+
+void MulticastClass::Apply(Op op, uint8_t value)
+{
+  switch(op)
+  {
+    case Op::Position:
+    {
+      // Fleet moves should finish together and quickly
+      SpeedProfiles.Select(SpeedProfilesClass::Profile::Fast);
+      AM43.SetPosition(value);
+      break;
+    }
+    case Op::Action:
+    {
+      const AM43Class::ControlAction action = static_cast<AM43Class::ControlAction>(value);
+      if(action == AM43Class::ControlAction::Open ||
+        action == AM43Class::ControlAction::Close ||
+        action == AM43Class::ControlAction::Stop)
+      {
+        if(action != AM43Class::ControlAction::Stop)
+        {
+          SpeedProfiles.Select(SpeedProfilesClass::Profile::Fast);
+        }
+        AM43.SendAction(action);
+      }
+      break;
+    }
+  }
+}
+
+void MulticastClass::SendAck(uint16_t seq)
+{
+  const uint8_t ack[] =
+  {
+    MULTICAST_MAGIC,
+    MULTICAST_VERSION | 0x80,
+    static_cast<uint8_t>(m_group_id & 0xFF),
+    static_cast<uint8_t>(m_group_id >> 8),
+    static_cast<uint8_t>(seq & 0xFF),
+    static_cast<uint8_t>(seq >> 8),
+    m_node_id
+  };
+  
+  m_udp.beginPacket(m_udp.remoteIP(), m_udp.remotePort());
+  m_udp.write(ack, sizeof(ack));
+  m_udp.endPacket();
+}
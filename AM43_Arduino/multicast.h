@@ -0,0 +1,69 @@
+#ifndef MULTICAST_H
+#define MULTICAST_H
+
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+
+#define MULTICAST_PORT        4343
+#define MULTICAST_ADDR        239, 67, 43, 1
+#define MULTICAST_MAGIC       0x43
+#define MULTICAST_VERSION     1
+#define MULTICAST_NODE_ALL    0xFF   // Entry node id which matches every node of group
+#define MULTICAST_PACKET_MAX  128
+#define MULTICAST_SEQ_RESET_MS 2000 // Repeats come within this time, later packet is new even with lower sequence
+
+// Compact UDP control protocol for synchronized fleet commands
+// One multicast datagram carries commands for many nodes of a group
+//
+// Packet (multi-byte values are little-endian):
+// 0x43                     MAGIC
+// 0x01                     VERSION
+// 0x00 0x00                GROUP ID
+// 0x00 0x00                SEQUENCE
+// 0x00                     FLAGS (Flag::AckRequest)
+// 0x00                     ENTRIES COUNT
+// N * [node, op, value]    ENTRIES (Op::Position value 0-100, Op::Action value ControlAction)
+//
+// Ack is sent as unicast to sender for every copy of datagram, so lost ack is
+// answered by next repeat:
+// MAGIC, VERSION | 0x80, GROUP ID, SEQUENCE, NODE ID
+class MulticastClass
+{
+  public:
+    enum class Op
+    {
+      Position = 0x00,
+      Action   = 0x01
+    };
+
+    enum Flag
+    {
+      AckRequest = 0x01
+    };
+
+    MulticastClass();
+
+    // group_id 0 or node_id 0 disables protocol
+    void Init(uint16_t group_id, uint8_t node_id);
+    void Loop();
+    // Datagram is waiting, it is parsed here and handled by next Loop
+    bool HasPendingInput();
+
+  private:
+    void HandlePacket(const uint8_t* buff, int buff_n);
+    void Apply(Op op, uint8_t value);
+    void SendAck(uint16_t seq);
+
+    WiFiUDP m_udp;
+    uint16_t m_group_id;
+    uint8_t m_node_id;
+    uint16_t m_last_seq;
+    unsigned long m_last_seq_time;
+    bool m_seq_valid;
+    int m_packet_n; // Size of datagram parsed but not read yet
+    uint8_t m_buff[MULTICAST_PACKET_MAX];
+};
+
+extern MulticastClass Multicast;
+
+#endif
@@ -0,0 +1,279 @@
+#include "am43.h"
+
+#include "rules.h"
+#include "calibration.h"
+#include "speed.h"
+#include "timeofday.h"
+#include "budget.h"
+
+RulesClass Rules;
+RAM_BUDGET_CHECK(sizeof(RulesClass), RAM_BUDGET_RULES);
+
+static_assert(RULES_N <= 8, "Armed rules mask is single byte");
+
+RulesClass::RulesClass():
+m_armed(0),
+m_fresh(false),
+m_lightLast(0),
+m_batLast(0),
+m_minuteLast(-1)
+{
+  m_program.CodeN = 0;
+  m_program.RulesN = 0;
+}
+
+int RulesClass::Compile(const char* src, unsigned int src_n)
+{
+  if(src_n > RULES_SRC_MAX)
+  {
+    // Don't compile truncated source, fail on the rule which is cut off
+    int failed_rule = 0;
+    for(unsigned int i = 0; i < RULES_SRC_MAX; ++i)
+    {
+      failed_rule += src[i] == ';';
+    }
+    return -(failed_rule + 1);
+  }
+
+  char buff[RULES_SRC_MAX + 1];
+  memcpy(buff, src, src_n);
+  buff[src_n] = 0;
+
+  // Compile aside, active rules are replaced only if all rules compile
+  Program program;
+  program.CodeN = 0;
+  program.RulesN = 0;
+  
+  char* save_ptr = nullptr;
+  for(char* rule = strtok_r(buff, ";", &save_ptr); rule != nullptr; rule = strtok_r(nullptr, ";", &save_ptr))
+  {
+    if(program.RulesN >= RULES_N || !CompileRule(program, rule))
+    {
+      return -(program.RulesN + 1);
+    }
+  }
+
+  m_program = program;
+  m_armed = 0;
+  m_fresh = true;
+  return m_program.RulesN;
+}
+
+bool RulesClass::CompileRule(Program& program, char* rule)
+{
+  char* action = strrchr(rule, ':');
+  // Time conditions contain ':' too, action is after last ':' which is followed by letter
+  if(action == nullptr || !isalpha(action[1]))
+  {
+    return false;
+  }
+  *action++ = 0;
+
+  const int code_begin = program.CodeN;
+  
+  char* save_ptr = nullptr;
+  for(char* cond = strtok_r(rule, "&", &save_ptr); cond != nullptr; cond = strtok_r(nullptr, "&", &save_ptr))
+  {
+    while(*cond == ' ')
+    {
+      ++cond;
+    }
+    
+    bool ok = false;
+    if(strncmp(cond, "light>=", 7) == 0)
+    {
+      ok = program.Emit(static_cast<uint8_t>(Op::LightGe)) && program.Emit(atoi(cond + 7));
+    }
+    else if(strncmp(cond, "light<=", 7) == 0)
+    {
+      ok = program.Emit(static_cast<uint8_t>(Op::LightLe)) && program.Emit(atoi(cond + 7));
+    }
+    else if(strncmp(cond, "batt<=", 6) == 0)
+    {
+      ok = program.Emit(static_cast<uint8_t>(Op::BattLe)) && program.Emit(atoi(cond + 6));
+    }
+    else if(strncmp(cond, "time=", 5) == 0)
+    {
+      const int start = ParseTime(cond + 5);
+      const char* end_txt = strchr(cond + 5, '-');
+      const int end = end_txt != nullptr ? ParseTime(end_txt + 1) : start;
+      ok = start >= 0 && end >= 0 &&
+        program.Emit(static_cast<uint8_t>(Op::Time)) &&
+        program.Emit(start >> 8) && program.Emit(start & 0xFF) &&
+        program.Emit(end >> 8) && program.Emit(end & 0xFF);
+    }
+
+    if(!ok)
+    {
+      program.CodeN = code_begin;
+      return false;
+    }
+  }
+
+  bool ok = false;
+  if(strcasecmp(action, "open") == 0)
+  {
+    ok = program.Emit(static_cast<uint8_t>(Op::Action)) && program.Emit(static_cast<uint8_t>(AM43Class::ControlAction::Open));
+  }
+  else if(strcasecmp(action, "close") == 0)
+  {
+    ok = program.Emit(static_cast<uint8_t>(Op::Action)) && program.Emit(static_cast<uint8_t>(AM43Class::ControlAction::Close));
+  }
+  else if(strcasecmp(action, "stop") == 0)
+  {
+    ok = program.Emit(static_cast<uint8_t>(Op::Action)) && program.Emit(static_cast<uint8_t>(AM43Class::ControlAction::Stop));
+  }
+  else if(strncasecmp(action, "pos=", 4) == 0)
+  {
+    ok = program.Emit(static_cast<uint8_t>(Op::Position)) && program.Emit(constrain(atoi(action + 4), 0, 100));
+  }
+
+  // Rule without conditions is not allowed, it would fire only once at upload
+  if(!ok || !program.Emit(static_cast<uint8_t>(Op::End)) || program.CodeN - code_begin <= 3)
+  {
+    program.CodeN = code_begin;
+    return false;
+  }
+
+  program.RuleStart[program.RulesN++] = code_begin;
+  return true;
+}
+
+bool RulesClass::Program::Emit(uint8_t value)
+{
+  if(CodeN >= RULES_CODE_MAX)
+  {
+    return false;
+  }
+
+  Code[CodeN++] = value;
+  return true;
+}
+
+void RulesClass::Loop()
+{
+  // Rules must not move blinds while limits are being set
+  if(m_program.RulesN == 0 || !AM43.IsInitialized() || Calibration.IsActive())
+  {
+    return;
+  }
+
+  // Evaluate only when relevant state has changed
+  const int minute = GetMinuteOfDay();
+  if(!m_fresh && m_lightLast == AM43.GetLightLevelFiltered() && m_batLast == AM43.GetBatteryLevel() && m_minuteLast == minute)
+  {
+    return;
+  }
+
+  m_lightLast = AM43.GetLightLevelFiltered();
+  m_batLast = AM43.GetBatteryLevel();
+  m_minuteLast = minute;
+
+  if(m_fresh)
+  {
+    // Rules which are already true at upload are not fired until they clear
+    m_fresh = false;
+    for(int i = 0; i < m_program.RulesN; ++i)
+    {
+      if(!EvalConditions(m_program.Code + m_program.RuleStart[i], 0, minute))
+      {
+        m_armed |= 1 << i;
+      }
+    }
+    return;
+  }
+
+  for(int i = 0; i < m_program.RulesN; ++i)
+  {
+    const uint8_t* code = m_program.Code + m_program.RuleStart[i];
+    const uint8_t mask = 1 << i;
+    
+    if(m_armed & mask)
+    {
+      if(EvalConditions(code, 0, minute))
+      {
+        m_armed &= ~mask;
+        Fire(code);
+      }
+    }
+    else if(!EvalConditions(code, RULES_LIGHT_HYST, minute))
+    {
+      m_armed |= mask;
+    }
+  }
+}
+
+bool RulesClass::EvalConditions(const uint8_t* code, int hyst, int minute_of_day) const
+{
+  const int light = AM43.GetLightLevelFiltered();
+  const int batt = AM43.GetBatteryLevel();
+  
+  for(;;)
+  {
+    switch(static_cast<Op>(*code))
+    {
+      case Op::LightGe:
+      {
+        if(light < code[1] - hyst)
+        {
+          return false;
+        }
+        code += 2;
+        break;
+      }
+      case Op::LightLe:
+      {
+        if(light > code[1] + hyst)
+        {
+          return false;
+        }
+        code += 2;
+        break;
+      }
+      case Op::BattLe:
+      {
+        if(batt > code[1] + hyst)
+        {
+          return false;
+        }
+        code += 2;
+        break;
+      }
+      case Op::Time:
+      {
+        const int start = (code[1] << 8) | code[2];
+        const int end = (code[3] << 8) | code[4];
+        if(!IsInTimeWindow(minute_of_day, start, end))
+        {
+          return false;
+        }
+        code += 5;
+        break;
+      }
+      default:
+      {
+        // Action or end, all conditions are met
+        return true;
+      }
+    }
+  }
+}
+
+void RulesClass::Fire(const uint8_t* code)
+{
+  // Skip conditions to action
+  while(*code != static_cast<uint8_t>(Op::Position) && *code != static_cast<uint8_t>(Op::Action))
+  {
+    code += *code == static_cast<uint8_t>(Op::Time) ? 5 : 2;
+  }
+
+  SpeedProfiles.Select(SpeedProfilesClass::Profile::Normal);
+  if(*code == static_cast<uint8_t>(Op::Position))
+  {
+    AM43.SetPosition(code[1]);
+  }
+  else
+  {
+    AM43.SendAction(static_cast<AM43Class::ControlAction>(code[1]));
+  }
+}
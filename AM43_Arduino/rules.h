@@ -0,0 +1,80 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include <Arduino.h>
+
+#define RULES_N               8      // Max rules count
+#define RULES_CODE_MAX        128    // Compiled rules bytecode size
+#define RULES_SRC_MAX         (RULES_CODE_MAX * 2 - 1) // Rules source length
+#define RULES_LIGHT_HYST      1      // Light level must move back by this much to re-arm rule
+
+// On-device rules evaluated on state change without home automation round trip
+//
+// Rules source is list of rules separated by ';'
+// Rule: condition[&condition...]:action
+// Conditions:
+//   light>=N, light<=N     light level threshold
+//   batt<=N                battery level threshold
+//   time=HH:MM[-HH:MM]     local time point or window
+// Actions:
+//   open, close, stop, pos=N
+//
+// i.e. "light>=3&time=09:00-18:00:close;time=07:30:pos=40"
+//
+// Rule fires once when its conditions become true and re-arms after they
+// become false again (light thresholds with RULES_LIGHT_HYST hysteresis)
+class RulesClass
+{
+  public:
+    enum class Op
+    {
+      End       = 0x00, // End of rule
+      LightGe   = 0x01, // byte level
+      LightLe   = 0x02, // byte level
+      BattLe    = 0x03, // byte level
+      Time      = 0x04, // word start minute, word end minute
+      Position  = 0x10, // byte position, terminates conditions
+      Action    = 0x11  // byte ControlAction, terminates conditions
+    };
+
+    RulesClass();
+
+    // Compile rules source into bytecode table, active rules are kept on failure
+    // Returns compiled rules count or -(failed rule index + 1)
+    // Source longer than RULES_SRC_MAX fails on the rule which doesn't fit
+    int Compile(const char* src, unsigned int src_n);
+    void Loop();
+
+    int GetRulesCount() const { return m_program.RulesN; }
+
+  private:
+    struct Program
+    {
+      uint8_t Code[RULES_CODE_MAX];
+      int CodeN;
+      uint8_t RuleStart[RULES_N];
+      int RulesN;
+
+      bool Emit(uint8_t value);
+    };
+
+    // Compile single rule into program, returns false on syntax error
+    static bool CompileRule(Program& program, char* rule);
+    
+    // Returns true if all rule conditions are met
+    // Thresholds are widened by hyst to check re-arm condition
+    bool EvalConditions(const uint8_t* code, int hyst, int minute_of_day) const;
+    void Fire(const uint8_t* code);
+    
+    Program m_program;
+    uint8_t m_armed; // Bit per rule
+    bool m_fresh;    // Rules were just compiled, armed state is not known yet
+
+    uint8_t m_lightLast;
+    uint8_t m_batLast;
+    int m_minuteLast;
+};
+
+extern RulesClass Rules;
+
+#endif
@@ -0,0 +1,109 @@
+#include "scheduler.h"
+#include "budget.h"
+
+SchedulerClass Scheduler;
+RAM_BUDGET_CHECK(sizeof(SchedulerClass), RAM_BUDGET_SCHEDULER);
+
+SchedulerClass::SchedulerClass():
+m_timers_n(0),
+m_add_failed(0),
+m_late_max(0),
+m_idle_ms(0)
+{
+  
+}
+
+int SchedulerClass::Add(Callback callback, unsigned long period_ms, bool active)
+{
+  if(m_timers_n >= SCHED_TIMERS_N)
+  {
+    // Timer would never run, published with scheduler stats
+    ++m_add_failed;
+    return -1;
+  }
+
+  Timer& timer = m_timers[m_timers_n];
+  timer.Fn = callback;
+  timer.Period = period_ms;
+  timer.Last = Clock::Millis();
+  timer.Active = active;
+  return m_timers_n++;
+}
+
+void SchedulerClass::SetPeriod(int id, unsigned long period_ms)
+{
+  if(id >= 0)
+  {
+    m_timers[id].Period = period_ms;
+    m_timers[id].Active = true;
+  }
+}
+
+void SchedulerClass::Restart(int id)
+{
+  if(id >= 0)
+  {
+    m_timers[id].Last = Clock::Millis();
+    m_timers[id].Active = true;
+  }
+}
+
+void SchedulerClass::Stop(int id)
+{
+  if(id >= 0)
+  {
+    m_timers[id].Active = false;
+  }
+}
+
+void SchedulerClass::Run()
+{
+  for(int i = 0; i < m_timers_n; ++i)
+  {
+    Timer& timer = m_timers[i];
+    const unsigned long elapsed = Clock::Millis() - timer.Last;
+    if(!timer.Active || elapsed < timer.Period)
+    {
+      continue;
+    }
+
+    m_late_max = max(m_late_max, elapsed - timer.Period);
+    // Period is counted from actual run, callback may change it
+    timer.Last = Clock::Millis();
+    timer.Fn();
+  }
+}
+
+unsigned long SchedulerClass::GetNextDeadline() const
+{
+  unsigned long next = SCHED_IDLE_MAX_MS;
+  for(int i = 0; i < m_timers_n; ++i)
+  {
+    const Timer& timer = m_timers[i];
+    if(!timer.Active)
+    {
+      continue;
+    }
+
+    const unsigned long elapsed = Clock::Millis() - timer.Last;
+    next = min(next, elapsed >= timer.Period ? 0 : timer.Period - elapsed);
+  }
+
+  return next;
+}
+
+void SchedulerClass::Idle(bool busy)
+{
+  if(busy)
+  {
+    return;
+  }
+
+  // delay() lets WiFi stack run and modem sleep between beacons
+  const unsigned long sleep_ms = GetNextDeadline();
+  if(sleep_ms > 0)
+  {
+    Clock::Delay(sleep_ms);
+    m_idle_ms += sleep_ms;
+  }
+}
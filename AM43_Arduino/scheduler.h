@@ -0,0 +1,66 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+#include "clock.h"
+
+#define SCHED_TIMERS_N        8      // Max registered timers
+#define SCHED_IDLE_MAX_MS     10     // Longest loop sleep, UART and network are polled at least this often
+
+// Cooperative timers for periodic firmware work
+// Timers are kept in flat table which is scanned once per loop pass, so
+// periodic checks live in single place instead of every subsystem loop.
+// Loop sleeps until next deadline (capped by SCHED_IDLE_MAX_MS) unless
+// UART or network input is waiting.
+class SchedulerClass
+{
+  public:
+    typedef void (*Callback)();
+
+    SchedulerClass();
+
+    // Register periodic timer, first run is period_ms from now
+    // Returns timer id or -1 if table is full, failures are counted in GetAddFailed
+    int Add(Callback callback, unsigned long period_ms, bool active = true);
+    // Change period, next run is period_ms after previous one
+    void SetPeriod(int id, unsigned long period_ms);
+    // Restart period from now
+    void Restart(int id);
+    void Stop(int id);
+    bool IsActive(int id) const { return id >= 0 && m_timers[id].Active; }
+
+    // Run due timers
+    void Run();
+    // Time until next deadline, SCHED_IDLE_MAX_MS if there are no timers
+    unsigned long GetNextDeadline() const;
+    // Sleep until next deadline, returns at once if busy
+    void Idle(bool busy);
+
+    // Instrumentation
+    // Worst delay of timer run after its deadline
+    unsigned long GetLateMax() const { return m_late_max; }
+    // Time spent in Idle sleep since boot
+    unsigned long GetIdleTime() const { return m_idle_ms; }
+    // Timers not registered because table was full, raise SCHED_TIMERS_N if not 0
+    uint8_t GetAddFailed() const { return m_add_failed; }
+
+  private:
+    struct Timer
+    {
+      Callback Fn;
+      unsigned long Period;
+      unsigned long Last;
+      bool Active;
+    };
+
+    Timer m_timers[SCHED_TIMERS_N];
+    uint8_t m_timers_n;
+    uint8_t m_add_failed;
+    unsigned long m_late_max;
+    unsigned long m_idle_ms;
+};
+
+extern SchedulerClass Scheduler;
+
+#endif
@@ -0,0 +1,91 @@
+#include "am43.h"
+
+#include "speed.h"
+#include "calibration.h"
+#include "timeofday.h"
+#include "budget.h"
+
+SpeedProfilesClass SpeedProfiles;
+RAM_BUDGET_CHECK(sizeof(SpeedProfilesClass), RAM_BUDGET_SPEED);
+
+static const char* s_profile_names[] = { "normal", "fast", "quiet" };
+static_assert(sizeof(s_profile_names) / sizeof(s_profile_names[0]) == static_cast<int>(SpeedProfilesClass::Profile::Count), "Profile names");
+
+SpeedProfilesClass::SpeedProfilesClass():
+m_base_rpm(0),
+m_night_start(-1),
+m_night_end(-1),
+m_profile(Profile::Normal),
+m_rev(0)
+{
+  memset(m_rpm, 0, sizeof(m_rpm));
+}
+
+void SpeedProfilesClass::SetProfileSpeed(Profile profile, uint8_t rpm)
+{
+  m_rpm[static_cast<int>(profile)] = rpm;
+}
+
+void SpeedProfilesClass::SetNightWindow(int start, int end)
+{
+  m_night_start = start;
+  m_night_end = end;
+}
+
+void SpeedProfilesClass::Select(Profile profile)
+{
+  // Limits are set at speed chosen by user, device speed is not known before init
+  if(Calibration.IsActive() || !AM43.IsInitialized())
+  {
+    return;
+  }
+
+  if(m_night_start >= 0 && m_night_end >= 0 && IsInTimeWindow(GetMinuteOfDay(), m_night_start, m_night_end))
+  {
+    profile = Profile::Quiet;
+  }
+
+  if(m_profile == Profile::Normal)
+  {
+    // Remember user speed while it's still on device
+    m_base_rpm = AM43.GetDeviceSettings().Speed;
+  }
+
+  uint8_t rpm = m_rpm[static_cast<int>(profile)];
+  if(rpm == 0)
+  {
+    profile = Profile::Normal;
+    rpm = m_rpm[static_cast<int>(Profile::Normal)] != 0 ? m_rpm[static_cast<int>(Profile::Normal)] : m_base_rpm;
+  }
+
+  if(rpm == 0)
+  {
+    return;
+  }
+
+  // Settings are written only if speed differs
+  if(AM43.SetDeviceSpeed(rpm) && m_profile != profile)
+  {
+    m_profile = profile;
+    ++m_rev;
+  }
+}
+
+bool SpeedProfilesClass::ParseProfile(const char* name, unsigned int name_n, Profile& profile)
+{
+  for(int i = 0; i < static_cast<int>(Profile::Count); ++i)
+  {
+    if(strlen(s_profile_names[i]) == name_n && strncasecmp(name, s_profile_names[i], name_n) == 0)
+    {
+      profile = static_cast<Profile>(i);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+const char* SpeedProfilesClass::ProfileName(Profile profile)
+{
+  return s_profile_names[static_cast<int>(profile)];
+}
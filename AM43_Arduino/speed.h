@@ -0,0 +1,52 @@
+#ifndef SPEED_H
+#define SPEED_H
+
+#include <Arduino.h>
+
+// Motor speed profiles
+// Profile speed is written with diffed SetSettings right before move command,
+// so settings request is queued ahead of it. Quiet profile replaces any other
+// profile inside night window.
+class SpeedProfilesClass
+{
+  public:
+    enum class Profile
+    {
+      Normal, // Speed set by user, captured from device if not configured
+      Fast,   // Moves where latency matters, i.e. scenes and fleet commands
+      Quiet,  // Night window
+
+      Count
+    };
+
+    SpeedProfilesClass();
+
+    // Profile speed in RPM, 0 - profile not configured, normal speed is used
+    void SetProfileSpeed(Profile profile, uint8_t rpm);
+    uint8_t GetProfileSpeed(Profile profile) const { return m_rpm[static_cast<int>(profile)]; }
+    // Minutes of day, window may wrap over midnight, -1 at either end disables it
+    void SetNightWindow(int start, int end);
+
+    // Switch device speed for following move
+    void Select(Profile profile);
+
+    Profile GetProfile() const { return m_profile; }
+    // Incremented on every profile change
+    uint16_t GetRevision() const { return m_rev; }
+
+    // Returns false if name is unknown
+    static bool ParseProfile(const char* name, unsigned int name_n, Profile& profile);
+    static const char* ProfileName(Profile profile);
+
+  private:
+    uint8_t m_rpm[static_cast<int>(Profile::Count)];
+    uint8_t m_base_rpm; // Device speed before first switch away from normal profile
+    int16_t m_night_start;
+    int16_t m_night_end;
+    Profile m_profile;
+    uint16_t m_rev;
+};
+
+extern SpeedProfilesClass SpeedProfiles;
+
+#endif
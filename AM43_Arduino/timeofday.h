@@ -0,0 +1,50 @@
+#ifndef TIMEOFDAY_H
+#define TIMEOFDAY_H
+
+#include <Arduino.h>
+#include <time.h>
+
+#include "am43.h"
+
+// Local time helpers shared by rules and speed profiles
+
+// Returns local minute of day or -1 if local time is not set yet
+inline int GetMinuteOfDay()
+{
+  const time_t now = time(nullptr);
+  if(now < AM43_TIME_VALID_EPOCH)
+  {
+    return -1;
+  }
+
+  const tm* local = localtime(&now);
+  return local->tm_hour * 60 + local->tm_min;
+}
+
+// Parse HH:MM, returns minute of day or -1
+inline int ParseTime(const char* txt)
+{
+  int hour = 0;
+  int minute = 0;
+  if(sscanf(txt, "%d:%d", &hour, &minute) != 2 || hour < 0 || hour > 23 || minute < 0 || minute > 59)
+  {
+    return -1;
+  }
+
+  return hour * 60 + minute;
+}
+
+// Window ends are inclusive, window may wrap over midnight
+inline bool IsInTimeWindow(int minute_of_day, int start, int end)
+{
+  if(minute_of_day < 0)
+  {
+    return false;
+  }
+
+  return start <= end ?
+    (minute_of_day >= start && minute_of_day <= end) :
+    (minute_of_day >= start || minute_of_day <= end);
+}
+
+#endif
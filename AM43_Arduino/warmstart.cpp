@@ -0,0 +1,135 @@
+#include <FS.h>
+
+#include "crc.h"
+#include "warmstart.h"
+#include "budget.h"
+
+WarmStartClass WarmStart;
+RAM_BUDGET_CHECK(sizeof(WarmStartClass), RAM_BUDGET_WARMSTART);
+
+namespace {
+static const char* s_snapshot_filename = "/snapshot.bin";
+static const char* s_snapshot_tmp_filename = "/snapshot.tmp";
+}
+
+
+WarmStartClass::WarmStartClass():
+m_flash_dirty(false),
+m_last_flash_write(0)
+{
+  memset(&m_record, 0, sizeof(m_record));
+}
+
+bool WarmStartClass::Restore()
+{
+  Record record;
+  bool found = ESP.rtcUserMemoryRead(WARMSTART_RTC_OFFSET, reinterpret_cast<uint32_t*>(&record), sizeof(record)) && IsValid(record);
+  if(!found)
+  {
+    // Cold boot, RTC memory is lost
+    // Complete temporary file is newer one, it's left alone if power was
+    // lost before it replaced snapshot file
+    found = (ReadFlash(s_snapshot_tmp_filename, record) && IsValid(record)) ||
+      (ReadFlash(s_snapshot_filename, record) && IsValid(record));
+  }
+
+  if(!found)
+  {
+    return false;
+  }
+
+  m_record = record;
+  AM43.RestoreSnapshot(m_record.Data);
+  Battery.RestoreSnapshot(m_record.Battery);
+  return true;
+}
+
+void WarmStartClass::Loop()
+{
+  if(AM43.IsInitialized())
+  {
+    AM43Class::Snapshot snapshot;
+    AM43.GetSnapshot(snapshot);
+    BatteryClass::Snapshot battery;
+    Battery.GetSnapshot(battery);
+    
+    if(!IsValid(m_record) ||
+      memcmp(&snapshot, &m_record.Data, sizeof(snapshot)) != 0 ||
+      memcmp(&battery, &m_record.Battery, sizeof(battery)) != 0)
+    {
+      m_record.Data = snapshot;
+      m_record.Battery = battery;
+      Seal(m_record);
+      ESP.rtcUserMemoryWrite(WARMSTART_RTC_OFFSET, reinterpret_cast<uint32_t*>(&m_record), sizeof(m_record));
+      m_flash_dirty = true;
+    }
+  }
+
+  if(m_flash_dirty && (m_last_flash_write == 0 || Clock::Millis() - m_last_flash_write >= WARMSTART_FLASH_MS))
+  {
+    WriteFlash(m_record);
+    m_flash_dirty = false;
+    m_last_flash_write = Clock::Millis();
+  }
+}
+
+bool WarmStartClass::IsValid(const Record& record) const
+{
+  return record.Magic == WARMSTART_MAGIC &&
+    record.Version == WARMSTART_VERSION &&
+    record.Size == sizeof(Record) &&
+    record.Crc == Crc32(reinterpret_cast<const uint8_t*>(&record), offsetof(Record, Crc));
+}
+
+void WarmStartClass::Seal(Record& record) const
+{
+  record.Magic = WARMSTART_MAGIC;
+  record.Version = WARMSTART_VERSION;
+  record.Size = sizeof(Record);
+  memset(record.Padding, 0, sizeof(record.Padding));
+  record.Crc = Crc32(reinterpret_cast<const uint8_t*>(&record), offsetof(Record, Crc));
+}
+
+bool WarmStartClass::ReadFlash(const char* filename, Record& record)
+{
+  if(!SPIFFS.begin() || !SPIFFS.exists(filename))
+  {
+    return false;
+  }
+
+  File file = SPIFFS.open(filename, "r");
+  if(!file)
+  {
+    return false;
+  }
+
+  const bool ok = file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record);
+  file.close();
+  return ok;
+}
+
+void WarmStartClass::WriteFlash(const Record& record)
+{
+  if(!SPIFFS.begin())
+  {
+    return;
+  }
+
+  // Write to temporary file first, so power loss never leaves broken snapshot
+  File file = SPIFFS.open(s_snapshot_tmp_filename, "w");
+  if(!file)
+  {
+    return;
+  }
+
+  const bool ok = file.write(reinterpret_cast<const uint8_t*>(&record), sizeof(record)) == sizeof(record);
+  file.close();
+  
+  // SPIFFS can't rename over existing file, Restore reads temporary file
+  // if power is lost in between
+  if(ok)
+  {
+    SPIFFS.remove(s_snapshot_filename);
+    SPIFFS.rename(s_snapshot_tmp_filename, s_snapshot_filename);
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef WARMSTART_H
+#define WARMSTART_H
+
+#include "am43.h"
+#include "battery.h"
+
+#define WARMSTART_MAGIC       0x41343353 // "AM43" snapshot marker
+#define WARMSTART_VERSION     2
+#define WARMSTART_RTC_OFFSET  32         // RTC user memory offset in 4 byte blocks
+#define WARMSTART_FLASH_MS    600000     // Min period between flash writes (10 minutes)
+
+// Persists AM43 state and battery series snapshot, so last known state is
+// published right after boot
+// Snapshot is written to RTC memory on every change, it survives resets and OTA
+// Flash copy survives power loss, it's written to SPIFFS (which does wear levelling)
+// not more often than WARMSTART_FLASH_MS
+class WarmStartClass
+{
+  public:
+    WarmStartClass();
+
+    // Load snapshot from RTC memory or flash and restore AM43 and battery state from it
+    // Returns true if valid snapshot was found
+    bool Restore();
+    void Loop();
+
+  private:
+    struct Record
+    {
+      uint32_t Magic;
+      uint16_t Version;
+      uint16_t Size;
+      AM43Class::Snapshot Data;
+      BatteryClass::Snapshot Battery;
+      uint8_t Padding[(4 - (sizeof(AM43Class::Snapshot) + sizeof(BatteryClass::Snapshot)) % 4) % 4]; // RTC memory is written in 4 byte blocks
+      uint32_t Crc;
+    };
+    static_assert(sizeof(Record) % 4 == 0, "RTC memory is written in 4 byte blocks");
+
+    bool IsValid(const Record& record) const;
+    void Seal(Record& record) const;
+    bool ReadFlash(const char* filename, Record& record);
+    void WriteFlash(const Record& record);
+
+    Record m_record;
+    bool m_flash_dirty;
+    unsigned long m_last_flash_write;
+};
+
+extern WarmStartClass WarmStart;
+
+#endif
@@ -1,16 +1,17 @@
 #include "esphome.h"
+#include "am43_core.h"
 
 #define AM43_UPDATE_DELAY_FAST_MS 1000
 #define AM43_UPDATE_DELAY_SLOW_MS 15000
 #define AM43_NO_ANSWER_RESET_T 32
+#define AM43_HEAP_REPORT_MS 60000
+#define AM43_TRACK_POLL_MS 1000  // Position read back period while blinds are moving
+#define AM43_TRACK_STALL_MS 5000 // Move is reported as stalled if position doesn't change for this long
+#define AM43_TRACK_TOLERANCE 1   // Target is reached within this many percent
 
 #define AM43_PIN_RESET 5
-
-namespace
-{
-  static uint8_t s_reqPrefix[] = {0x00, 0xFF, 0x00, 0x00};
-  static uint8_t s_reqHeaderPrefix[] = {0x9a};
-} // namespace
+#define AM43_RECV_BUFF_N 64
+#define AM43_RECV_IDLE_MS 20
 
 class AM43Component : public Component, public Cover, public UARTDevice
 {
@@ -18,6 +19,10 @@ public:
 // ESPHome sensors
   Sensor* m_sensor_battery = new Sensor();
   Sensor *m_sensor_light = new Sensor();
+  Sensor *m_sensor_heap_free = new Sensor();
+  Sensor *m_sensor_heap_max_block = new Sensor();
+  Sensor *m_sensor_heap_fragmentation = new Sensor();
+  Sensor *m_sensor_stalls = new Sensor();
 
   enum class UpdateStep
   {
@@ -31,16 +36,8 @@ public:
     Finish
   };
 
-  struct SeasonInfo
-  {
-    uint8_t SeasonState;
-    uint8_t LightSeasonState;
-    uint8_t LightLevel;
-    uint8_t LightStartHour;
-    uint8_t LightStartMinute;
-    uint8_t LightEndHour;
-    uint8_t LightEndMinute;
-  };
+  // Decoded by protocol core, shared with Arduino front-end
+  typedef AM43Core::SeasonInfo SeasonInfo;
 
   struct TimingInfo
   {
@@ -150,89 +147,144 @@ public:
                                          m_position(0),
                                          m_lightLevel(0),
                                          m_batteryLevel(0),
+                                         m_last_heap_report(0),
+                                         m_logged_valid(false),
+                                         m_link(*this),
+                                         m_last_track_poll(0),
                                          m_initialized(false)
   {
+    m_link.Begin(UartTransport{this});
   }
 
-  void PrintData()
+  static const char *DirectionName(Direction direction)
   {
-    ESP_LOGD("am43", "============================================");
+    switch (direction)
+    {
+    case Direction::Forward:
+      return "Forward";
+    case Direction::Reverse:
+      return "Reverse";
+    default:
+      return "Unknown";
+    }
+  }
 
-    if (m_direction == Direction::Forward)
+  static const char *OperationModeName(OperationMode mode)
+  {
+    switch (mode)
     {
-      ESP_LOGD("am43", "Direction: Forward");
+    case OperationMode::Inching:
+      return "Inching";
+    case OperationMode::Continuous:
+      return "Continuous";
+    default:
+      return "Unknown";
     }
-    else if (m_direction == Direction::Reverse)
+  }
+
+  static const char *DeviceTypeName(DeviceType type)
+  {
+    switch (type)
     {
-      ESP_LOGD("am43", "Direction: Reverse");
+    case DeviceType::Baiye:
+      return "Baiye";
+    case DeviceType::Chuizhi:
+      return "Chuizhi";
+    case DeviceType::Juanlian:
+      return "Juanlian";
+    case DeviceType::Fengchao:
+      return "Fengchao";
+    case DeviceType::Rousha:
+      return "Rousha";
+    case DeviceType::Xianggelila:
+      return "Xianggelila";
+    default:
+      return "Unknown";
     }
-    else
+  }
+
+  // Logs only fields changed since previous call, no heap allocations
+  void PrintData()
+  {
+    LoggedState &l = m_logged;
+    const bool all = !m_logged_valid;
+    m_logged_valid = true;
+
+    if (all || l.Dir != m_direction)
     {
-      ESP_LOGD("am43", "Direction: Unknown");
+      ESP_LOGD("am43", "Direction: %s", DirectionName(m_direction));
+      l.Dir = m_direction;
     }
 
-    if (m_operationMode == OperationMode::Inching)
+    if (all || l.Mode != m_operationMode)
     {
-      ESP_LOGD("am43", "OperationMode: Inching");
+      ESP_LOGD("am43", "OperationMode: %s", OperationModeName(m_operationMode));
+      l.Mode = m_operationMode;
     }
-    else if (m_operationMode == OperationMode::Continuous)
+
+    if (all || l.Speed != m_deviceSpeed || l.Length != m_deviceLength || l.Diameter != m_deviceDiameter)
     {
-      ESP_LOGD("am43", "OperationMode: Continuous");
+      ESP_LOGD("am43", "Speed: %i, Length: %i, Diameter: %i", m_deviceSpeed, m_deviceLength, m_deviceDiameter);
+      l.Speed = m_deviceSpeed;
+      l.Length = m_deviceLength;
+      l.Diameter = m_deviceDiameter;
     }
-    else
+
+    if (all || l.Type != m_deviceType)
     {
-      ESP_LOGD("am43", "OperationMode: Unknown");
+      ESP_LOGD("am43", "Type: %s (%i)", DeviceTypeName(m_deviceType), (int)m_deviceType);
+      l.Type = m_deviceType;
     }
 
-    ESP_LOGD("am43", "Speed: %i", m_deviceSpeed);
-    ESP_LOGD("am43", "Length: %i", m_deviceLength);
-    ESP_LOGD("am43", "Diameter: %i", m_deviceDiameter);
+    if (all || l.TopLimitSet != m_topLimitSet || l.BottomLimitSet != m_bottomLimitSet || l.HasLightSensor != m_hasLightSensor)
+    {
+      ESP_LOGD("am43", "TopLimit: %i, BottomLimit: %i, HasLightSensor: %i", (int)m_topLimitSet, (int)m_bottomLimitSet, (int)m_hasLightSensor);
+      l.TopLimitSet = m_topLimitSet;
+      l.BottomLimitSet = m_bottomLimitSet;
+      l.HasLightSensor = m_hasLightSensor;
+    }
 
-    switch (m_deviceType)
+    if (all || l.Position != m_position)
     {
-    case DeviceType::Baiye:
-      ESP_LOGD("am43", "Type: Baiye");
-      break;
-    case DeviceType::Chuizhi:
-      ESP_LOGD("am43", "Type: Chuizhi");
-      break;
-    case DeviceType::Juanlian:
-      ESP_LOGD("am43", "Type: Juanlian");
-      break;
-    case DeviceType::Fengchao:
-      ESP_LOGD("am43", "Type: Fengchao");
-      break;
-    case DeviceType::Rousha:
-      ESP_LOGD("am43", "Type: Rousha");
-      break;
-    case DeviceType::Xianggelila:
-      ESP_LOGD("am43", "Type: Xianggelila");
-      break;
-    default:
-      ESP_LOGD("am43", "Type: %i", (int)m_deviceType);
+      ESP_LOGD("am43", "Position: %i", m_position);
+      l.Position = m_position;
     }
 
-    ESP_LOGD("am43", "TopLimit: %i", (int)m_topLimitSet);
-    ESP_LOGD("am43", "BottomLimit: %i", (int)m_bottomLimitSet);
-    ESP_LOGD("am43", "HasLightSensor: %i", (int)m_hasLightSensor);
+    if (all || l.LightLevel != m_lightLevel)
+    {
+      ESP_LOGD("am43", "LightLevel: %i", m_lightLevel);
+      l.LightLevel = m_lightLevel;
+    }
 
-    ESP_LOGD("am43", "Position: %i", m_position);
-    ESP_LOGD("am43", "LightLevel: %i", m_lightLevel);
-    ESP_LOGD("am43", "BatteryLevel: %i", m_batteryLevel);
+    if (all || l.BatteryLevel != m_batteryLevel)
+    {
+      ESP_LOGD("am43", "BatteryLevel: %i", m_batteryLevel);
+      l.BatteryLevel = m_batteryLevel;
+    }
 
-    SeasonInfo *si[] = {&m_summerSeason, &m_winterSeason};
-    for (SeasonInfo *s : si)
+    const SeasonInfo *si[] = {&m_summerSeason, &m_winterSeason};
+    SeasonInfo *li[] = {&l.Summer, &l.Winter};
+    for (int i = 0; i < 2; ++i)
     {
-      String season;
-      season += s->SeasonState ? String("On, ") : String("Off, ");
-      season += String(s->LightSeasonState) + String(", ");
-      season += String(s->LightLevel) + String(", ");
-      season += String(s->LightStartHour) + String(":") + String(s->LightStartMinute) + String(", ");
-      season += String(s->LightEndHour) + String(":") + String(s->LightEndMinute);
-      ESP_LOGD("am43", "Season: %s", season.c_str());
+      const SeasonInfo *s = si[i];
+      if (all || memcmp(li[i], s, sizeof(SeasonInfo)) != 0)
+      {
+        ESP_LOGD("am43", "Season %s: %s, %i, %i, %i:%02i, %i:%02i", i == 0 ? "summer" : "winter",
+                 s->SeasonState ? "On" : "Off", s->LightSeasonState, s->LightLevel,
+                 s->LightStartHour, s->LightStartMinute, s->LightEndHour, s->LightEndMinute);
+        *li[i] = *s;
+      }
     }
   }
 
+  // Heap metrics to watch fragmentation over long uptime
+  void PublishHeap()
+  {
+    m_sensor_heap_free->publish_state(ESP.getFreeHeap());
+    m_sensor_heap_max_block->publish_state(ESP.getMaxFreeBlockSize());
+    m_sensor_heap_fragmentation->publish_state(ESP.getHeapFragmentation());
+  }
+
   // ESPHome API
   void setup() override
   {
@@ -241,26 +293,29 @@ public:
 
   void loop() override
   {
-    if (available() > 1) // At least we have header prefix and command
+    // Received frames are handled once line goes idle, loop is never blocked
+    if (m_link.Poll())
     {
-      int buff_offset = 0;
-      while (available())
-      {
-        m_aux_recv_buff[buff_offset++] = read();
-        delay(100);
-      }
+      PrintData();
+    }
 
-      int resp_end = 0;
-      uint8_t *buff = m_aux_recv_buff;
-      int buff_n = buff_offset;
-      do
+    // Position is read back faster while blinds are moving, until target is
+    // reached or move stalls, then once more to get final position
+    if (m_tracker.Update(m_position))
+    {
+      if (m_tracker.IsStalled())
       {
-        resp_end = HandleResponse(buff, buff_n);
-        buff += resp_end;
-        buff_n -= resp_end;
-      } while (resp_end > 0 && buff_n > 0);
+        ESP_LOGW("am43", "Move stalled at %i, target %i", m_position, m_tracker.GetTarget());
+        m_sensor_stalls->publish_state(m_tracker.GetStallCount());
+      }
 
-      PrintData();
+      DeviceGetSettings();
+      PublishCover();
+    }
+    else if (m_tracker.IsMoving() && millis() - m_last_track_poll >= AM43_TRACK_POLL_MS)
+    {
+      DeviceGetSettings();
+      m_last_track_poll = millis();
     }
 
     if (millis() - m_last_update >= m_update_delay)
@@ -269,6 +324,13 @@ public:
 
       m_last_update = millis();
     }
+
+    if (millis() - m_last_heap_report >= AM43_HEAP_REPORT_MS)
+    {
+      PublishHeap();
+
+      m_last_heap_report = millis();
+    }
   }
 
   CoverTraits get_traits() override
@@ -351,37 +413,71 @@ public:
     const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), Command::SendAction, static_cast<uint8_t>(action));
     SendRequest(m_aux_buff, len);
 
-    // Update position imadeitely to unlock home automation options
-    // e.g. Home Assistant locks Close command if position is 100% or Open command if position is 0%
+    // Measured position is left as is, opening/closing operation unlocks
+    // Home Assistant options while blinds are moving
     switch (action)
     {
     case ControlAction::Close:
     {
-      ++m_position;
-
+      m_tracker.Start(100, GetTravelTime());
       break;
     }
     case ControlAction::Open:
     {
-      --m_position;
-
+      m_tracker.Start(0, GetTravelTime());
+      break;
+    }
+    case ControlAction::Stop:
+    {
+      m_tracker.Stop();
       break;
     }
     }
 
-    m_position = constrain(m_position, 0, 100);
-    position = (float)(100 - m_position) / 100.0f;
-    publish_state();
+    m_last_track_poll = millis();
+    PublishCover();
   }
 
   void SetPosition(uint8_t position_percent)
   {
-    m_position = constrain(position_percent, 0, 100);
+    // Measured position follows MCU reports, target is tracked separately
+    const uint8_t target = constrain(position_percent, 0, 100);
+    const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), Command::SetPosition, target);
+    SendRequest(m_aux_buff, len);
+
+    m_tracker.Start(target, GetTravelTime());
+    m_last_track_poll = millis();
+    PublishCover();
+  }
+
+  // Full travel time estimate from length, roller diameter and speed, 0 if unknown
+  unsigned long GetTravelTime() const
+  {
+    if (m_deviceSpeed == 0 || m_deviceDiameter == 0)
+    {
+      return 0;
+    }
+
+    return static_cast<unsigned long>(60000.0f * m_deviceLength / (PI * m_deviceDiameter * m_deviceSpeed));
+  }
+
+  // Publish measured position and operation, cover position is inverted
+  void PublishCover()
+  {
     position = (float)(100 - m_position) / 100.0f;
+    switch (m_tracker.GetOperation())
+    {
+    case AM43Core::Operation::Opening:
+      current_operation = COVER_OPERATION_OPENING;
+      break;
+    case AM43Core::Operation::Closing:
+      current_operation = COVER_OPERATION_CLOSING;
+      break;
+    default:
+      current_operation = COVER_OPERATION_IDLE;
+      break;
+    }
     publish_state();
-
-    const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), Command::SetPosition, m_position);
-    SendRequest(m_aux_buff, len);
   }
 
   uint8_t GetPosition() const
@@ -422,13 +518,13 @@ protected:
   {
     uint8_t data[64];
     const int data_n = BuildSettingsData(data, sizeof(data));
-    const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), Command::SetName, data, data_n);
+    const int len = BuildRequest(m_aux_buff, sizeof(m_aux_buff), Command::SetSettings, data, data_n);
     SendRequest(m_aux_buff, len);
   }
   //void DeviceSetTime();
   //void DeviceSetPassword();
   //void DeviceSetPasswordChange();
-  void DeviceSetSeason();
+  //void DeviceSetSeason();
   //void DeviceSetTiming();
 
   void DeviceGetSettings()
@@ -457,92 +553,30 @@ protected:
         ESP_LOGD("am43", "0x%x", buff[i]);
       }
 
-      write_array(buff, buff_n);
+      m_link.Send(buff, buff_n);
     }
   }
-  // handle response from AM43 device
-  // Returns response end offset
-  int HandleResponse(const uint8_t *buff, unsigned int buff_n)
-  {
-    if (buff_n > 0)
-    {
-      ESP_LOGD("am43", "Processing:");
-      for (int i = 0; i < buff_n; ++i)
-      {
-        ESP_LOGD("am43", "0x%x", buff[i]);
-      }
-    }
-
-    int response_begin = -1;
-    int req_herader_prefix_offset = 0;
-
-    for (int i = 0; i < buff_n; ++i)
-    {
-      if (buff[i] == s_reqHeaderPrefix[req_herader_prefix_offset])
-      {
-        ++req_herader_prefix_offset;
-        if (req_herader_prefix_offset == sizeof(s_reqHeaderPrefix))
-        {
-          response_begin = i - sizeof(s_reqHeaderPrefix) + 1;
-          break;
-        }
-      }
-      else
-      {
-        req_herader_prefix_offset = 0;
-      }
-    }
-
-    if (response_begin == -1)
-    {
-      ESP_LOGD("am43", "Header not found");
-      return 0;
-    }
 
+public:
+  // Called by UART link for every received frame
+  void OnFrame(const AM43Core::Frame &frame)
+  {
     m_no_answer_reset_counter = 0;
 
-    int response_offset = response_begin + sizeof(s_reqHeaderPrefix);
-
-    Command response_cmd = static_cast<Command>(buff[response_offset++]);
-    uint8_t response_len = buff[response_offset++];
-    uint8_t response_checksum = buff[response_offset + response_len];
-
-    const int response_size = sizeof(s_reqHeaderPrefix) + response_len + 3;
-    const int response_end = response_begin + response_size;
-
-    uint8_t response_calculated_checksum = 0;
-    for (int i = response_begin; i < response_end - 1; ++i)
-    {
-      response_calculated_checksum ^= buff[i];
-    }
-
-    const uint8_t *data = buff + response_offset;
-    if (response_calculated_checksum == response_checksum)
+    const Command response_cmd = static_cast<Command>(frame.Cmd);
+    const uint8_t response_len = frame.Len;
+    const uint8_t *data = frame.Data;
+    if (frame.IsValid())
     {
       switch (response_cmd)
       {
       case Command::GetSettings:
       {
-        if (response_len >= 7)
+        AM43Core::SettingsInfo settings;
+        if (AM43Core::DecodeSettings(data, response_len, settings))
         {
-          uint8_t dat = data[0];
-          m_direction = static_cast<Direction>(dat & 1);
-          m_operationMode = static_cast<OperationMode>((dat >> 1) & 1);
-
-          m_topLimitSet = (dat & 4) > 0;
-          m_bottomLimitSet = (dat & 8) > 0;
-          m_hasLightSensor = (dat & 16) > 0;
-
-          m_deviceSpeed = data[1];
-          m_position = data[2];
-          
-          m_deviceLength = (data[3] << 8) | data[4];
-          m_deviceDiameter = data[5];
-
-          m_deviceType = static_cast<DeviceType>(abs(data[6] >> 4));
-
-          position = (float)(100 - m_position) / 100.0f;
-          publish_state();
+          SetSettingsInfo(settings);
+          PublishCover();
         }
         break;
       }
@@ -566,8 +600,7 @@ protected:
         if (response_len >= 2)
         {
           m_position = data[1];
-          position = (float)(100 - m_position) / 100.0f;
-          publish_state();
+          PublishCover();
         }
         break;
       }
@@ -588,24 +621,18 @@ protected:
       }
       case Command::GetSpeed:
       {
-        if (response_len >= 2)
+        AM43Core::SettingsInfo settings = GetSettingsInfo();
+        if (AM43Core::DecodeSpeed(data, response_len, settings))
         {
-          m_deviceSpeed = data[1];
-
-          uint8_t dat = data[0];
-          m_direction = static_cast<Direction>((dat >> 1) & 1);
-          m_operationMode = static_cast<OperationMode>((dat >> 2) & 1);
-          m_hasLightSensor = ((dat >> 3) & 1) > 0;
+          SetSettingsInfo(settings);
         }
         break;
       }
       case Command::GetSeason:
       {
-        if (response_len >= sizeof(SeasonInfo) * 2 + 2)
-        {
-          memcpy(&m_summerSeason, data + 1, sizeof(SeasonInfo));
-          memcpy(&m_winterSeason, data + sizeof(SeasonInfo) + 2, sizeof(SeasonInfo));
-        }
+        // Seasons are only read and logged, writing them is Arduino front-end only
+        uint8_t tags[2];
+        AM43Core::DecodeSeasons(data, response_len, m_summerSeason, m_winterSeason, tags);
 
         if (m_update_step == UpdateStep::WaitForSettings)
         {
@@ -622,37 +649,50 @@ protected:
     ESP_LOGD("am43", "LEN: 0x%i", response_len);
     for (int i = 0; i < response_len; ++i)
     {
-      ESP_LOGD("am43", "DAT[%i]: 0x%x", i, buff[response_offset + i]);
+      ESP_LOGD("am43", "DAT[%i]: 0x%x", i, data[i]);
     }
-    ESP_LOGD("am43", "CHK: 0x%x", response_checksum);
-    ESP_LOGD("am43", "CCC: 0x%x", response_calculated_checksum);
+    ESP_LOGD("am43", "CHK: 0x%x", frame.Checksum);
+    ESP_LOGD("am43", "CCC: 0x%x", frame.CalculatedChecksum);
+  }
 
-    return response_end;
+protected:
+
+  // Settings fields as used by protocol core codecs
+  AM43Core::SettingsInfo GetSettingsInfo() const
+  {
+    AM43Core::SettingsInfo settings;
+    settings.Dir = static_cast<uint8_t>(m_direction);
+    settings.Mode = static_cast<uint8_t>(m_operationMode);
+    settings.Speed = m_deviceSpeed;
+    settings.Position = m_position;
+    settings.Length = m_deviceLength;
+    settings.Diameter = m_deviceDiameter;
+    settings.Type = static_cast<uint8_t>(m_deviceType);
+    settings.TopLimit = m_topLimitSet;
+    settings.BottomLimit = m_bottomLimitSet;
+    settings.LightSensor = m_hasLightSensor;
+    return settings;
+  }
+
+  void SetSettingsInfo(const AM43Core::SettingsInfo &settings)
+  {
+    m_direction = static_cast<Direction>(settings.Dir);
+    m_operationMode = static_cast<OperationMode>(settings.Mode);
+    m_deviceSpeed = settings.Speed;
+    m_position = settings.Position;
+    m_deviceLength = settings.Length;
+    m_deviceDiameter = settings.Diameter;
+    m_deviceType = static_cast<DeviceType>(settings.Type);
+    m_topLimitSet = settings.TopLimit;
+    m_bottomLimitSet = settings.BottomLimit;
+    m_hasLightSensor = settings.LightSensor;
   }
 
   // Build data payload for device SetSettings request
   // Returns size of payload in bytes
   int BuildSettingsData(uint8_t *buff, uint8_t buff_n)
   {
-    if (buff_n < 6)
-    {
-      return 0;
-    }
-
-    uint8_t dataHead = (static_cast<uint8_t>(m_direction) & 1) << 1;
-    dataHead |= (static_cast<uint8_t>(m_operationMode) & 1) << 2;
-    dataHead |= static_cast<uint8_t>(m_deviceType) << 4;
-
-    int buff_offset = 0;
-    buff[buff_offset++] = dataHead;
-    buff[buff_offset++] = m_deviceSpeed;
-    buff[buff_offset++] = 0;
-
-    buff[buff_offset++] = static_cast<uint8_t>((m_deviceLength & 0xFF00) >> 8);
-    buff[buff_offset++] = static_cast<uint8_t>(m_deviceLength & 0xFF);
-    buff[buff_offset++] = m_deviceDiameter;
-
-    return buff_offset;
+    return AM43Core::EncodeSettingsRequest(buff, buff_n, GetSettingsInfo());
   }
 
   // Build request and store it to buff
@@ -666,51 +706,10 @@ protected:
   // Returns size of request in bytes
   int BuildRequest(uint8_t *buff, unsigned int buff_n, Command cmd, const uint8_t *data, uint8_t data_n)
   {
-    if (buff == nullptr || buff_n < sizeof(s_reqPrefix) + sizeof(s_reqHeaderPrefix) + data_n + 3)
-    {
-      return 0;
-    }
-
-    // AM43 Request example
-    // 00 ff 00 00 9a 17 02 22 b8 15
-    // 0x00, 0xFF, 0x00, 0x00   REQUEST PREFIX
-    // 0x9a                     HEADER PREFIX
-    // 0x00                     HEADER(CMD)
-    // 0x01                     DATA LENGTH
-    // 0x00                     DATA
-    // 0x00                     REQUEST CHECKSUM (HEADER PREFIX xor HEADER xor DATA LENGTH xor DATA)
-
-    int buff_offset = 0;
-
-    // Request prefix
-    memcpy(buff + buff_offset, s_reqPrefix, sizeof(s_reqPrefix));
-    buff_offset += sizeof(s_reqPrefix);
-
-    // Header
-    // Header prefix
-    memcpy(buff + buff_offset, s_reqHeaderPrefix, sizeof(s_reqHeaderPrefix));
-    buff_offset += sizeof(s_reqHeaderPrefix);
-    // Header(command)
-    buff[buff_offset++] = static_cast<uint8_t>(cmd);
-
-    // Data
-    // Data length
-    buff[buff_offset++] = data_n;
-    for (int i = 0; i < data_n; ++i)
-    {
-      buff[buff_offset++] = data[i];
-    }
-
-    uint8_t checksum = 0;
-    for (int i = sizeof(s_reqPrefix); i < buff_offset; ++i)
-    {
-      checksum ^= buff[i];
-    }
-    buff[buff_offset++] = checksum;
-
-    return buff_offset;
+    return AM43Core::BuildRequest(buff, buff_n, static_cast<uint8_t>(cmd), data, data_n);
   }
 
+
   UpdateStep m_update_step;
   unsigned long m_last_update;
   unsigned long m_update_delay;
@@ -733,7 +732,45 @@ protected:
   SeasonInfo m_winterSeason;
 
 private:
-  byte m_aux_recv_buff[256];
+  // Last values written to log by PrintData
+  struct LoggedState
+  {
+    Direction Dir;
+    OperationMode Mode;
+    uint8_t Speed;
+    uint16_t Length;
+    uint8_t Diameter;
+    DeviceType Type;
+    bool TopLimitSet;
+    bool BottomLimitSet;
+    bool HasLightSensor;
+    uint8_t Position;
+    uint8_t LightLevel;
+    uint8_t BatteryLevel;
+    SeasonInfo Summer;
+    SeasonInfo Winter;
+  };
+
+  unsigned long m_last_heap_report;
+  LoggedState m_logged;
+  bool m_logged_valid;
+  struct UartTransport
+  {
+    UARTDevice *Device;
+
+    int Available() { return Device->available(); }
+    int Read() { return Device->read(); }
+    void Write(const uint8_t *buff, unsigned int buff_n) { Device->write_array(buff, buff_n); }
+  };
+
+  struct MillisClock
+  {
+    static unsigned long Millis() { return millis(); }
+  };
+
+  AM43Core::Link<UartTransport, MillisClock, AM43Component, AM43_RECV_BUFF_N, AM43_RECV_IDLE_MS> m_link;
+  AM43Core::Tracker<MillisClock, AM43_TRACK_STALL_MS, AM43_TRACK_TOLERANCE> m_tracker;
+  unsigned long m_last_track_poll;
   byte m_aux_buff[128];
   bool m_initialized;
 };
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Host benchmarks, results are printed as "name: metric value unit" lines
+// Wall clock is used for CPU cost, firmware time runs on virtual clock
+namespace Bench
+{
+  inline double NowNs()
+  {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  inline void Report(const char* name, const char* metric, double value, const char* unit)
+  {
+    printf("%s: %s %.1f %s\n", name, metric, value, unit);
+  }
+
+  // Percentile of samples, p in 0..100
+  template<class T>
+  T Percentile(std::vector<T> samples, double p)
+  {
+    if(samples.empty())
+    {
+      return T();
+    }
+    std::sort(samples.begin(), samples.end());
+    const size_t i = std::min(samples.size() - 1, static_cast<size_t>(p / 100.0 * samples.size()));
+    return samples[i];
+  }
+}
+
+#endif
@@ -0,0 +1,224 @@
+#include "test.h"
+#include "bench.h"
+#include "fake_mcu.h"
+#include "am43.h"
+
+#include <string.h>
+
+// Response dispatch: descriptor table lookup against switch with hand coded
+// lengths it replaced, both run identical decoders on the same frame mix,
+// full AM43Class::OnFrame cost is reported alongside
+
+namespace {
+FakeMcu s_mcu;
+
+struct State
+{
+  uint8_t Settings[7];
+  uint8_t Light;
+  uint8_t Position;
+  uint8_t Battery;
+  uint8_t Speed;
+  uint8_t Timings[1 + AM43_TIMINGS_N * 5];
+  uint8_t Seasons[AM43Core::SeasonsSize];
+  int Step;
+  unsigned long Decoded;
+};
+
+void DecodeSettings(State& s, const uint8_t* data, uint8_t) { memcpy(s.Settings, data, sizeof(s.Settings)); ++s.Decoded; }
+void DecodeLight(State& s, const uint8_t* data, uint8_t) { s.Light = data[1]; ++s.Decoded; }
+void DecodePosition(State& s, const uint8_t* data, uint8_t) { s.Position = data[1]; ++s.Decoded; }
+void DecodeBattery(State& s, const uint8_t* data, uint8_t) { s.Battery = data[4]; ++s.Decoded; }
+void DecodeSpeed(State& s, const uint8_t* data, uint8_t) { s.Speed = data[1]; ++s.Decoded; }
+void DecodeTiming(State& s, const uint8_t* data, uint8_t data_n) { memcpy(s.Timings, data, std::min<size_t>(data_n, sizeof(s.Timings))); ++s.Decoded; }
+void DecodeSeason(State& s, const uint8_t* data, uint8_t) { memcpy(s.Seasons, data, sizeof(s.Seasons)); ++s.Decoded; }
+
+// Shape of former HandleResponse
+void DispatchSwitch(State& s, const AM43Core::Frame& frame)
+{
+  switch(frame.Cmd)
+  {
+    case 0xa7:
+      if(frame.Len >= 7)
+      {
+        DecodeSettings(s, frame.Data, frame.Len);
+      }
+      break;
+    case 0xaa:
+      if(frame.Len >= 2)
+      {
+        DecodeLight(s, frame.Data, frame.Len);
+      }
+      if(s.Step == 3)
+      {
+        s.Step = 4;
+      }
+      break;
+    case 0xa1:
+      if(frame.Len >= 2)
+      {
+        DecodePosition(s, frame.Data, frame.Len);
+      }
+      break;
+    case 0xa2:
+      if(frame.Len >= 5)
+      {
+        DecodeBattery(s, frame.Data, frame.Len);
+      }
+      if(s.Step == 5)
+      {
+        s.Step = 6;
+      }
+      break;
+    case 0xa3:
+      if(frame.Len >= 2)
+      {
+        DecodeSpeed(s, frame.Data, frame.Len);
+      }
+      break;
+    case 0xa8:
+      if(frame.Len >= 1)
+      {
+        DecodeTiming(s, frame.Data, frame.Len);
+      }
+      break;
+    case 0xa9:
+      if(frame.Len >= AM43Core::SeasonsSize)
+      {
+        DecodeSeason(s, frame.Data, frame.Len);
+      }
+      if(s.Step == 2)
+      {
+        s.Step = 3;
+      }
+      break;
+  }
+}
+
+struct Descriptor
+{
+  uint8_t Cmd;
+  uint8_t MinLen;
+  void (*Decode)(State&, const uint8_t*, uint8_t);
+  int WaitStep;
+  int NextStep;
+};
+
+constexpr Descriptor s_table[AM43_RESPONSE_N] =
+{
+  {},
+  { 0xa1, 2, &DecodePosition, -1, -1 },
+  { 0xa2, 5, &DecodeBattery, 5, 6 },
+  { 0xa3, 2, &DecodeSpeed, -1, -1 },
+  {}, {}, {},
+  { 0xa7, 7, &DecodeSettings, -1, -1 },
+  { 0xa8, 1, &DecodeTiming, -1, -1 },
+  { 0xa9, AM43Core::SeasonsSize, &DecodeSeason, 2, 3 },
+  { 0xaa, 2, &DecodeLight, 3, 4 },
+  {}, {}, {}, {}, {},
+};
+
+void DispatchTable(State& s, const AM43Core::Frame& frame)
+{
+  const unsigned int index = static_cast<uint8_t>(frame.Cmd - AM43_RESPONSE_BASE);
+  if(index < AM43_RESPONSE_N && s_table[index].Cmd == frame.Cmd)
+  {
+    const Descriptor& desc = s_table[index];
+    if(desc.Decode != nullptr && frame.Len >= desc.MinLen)
+    {
+      desc.Decode(s, frame.Data, frame.Len);
+    }
+    if(s.Step == desc.WaitStep)
+    {
+      s.Step = desc.NextStep;
+    }
+  }
+}
+
+struct Payload
+{
+  uint8_t Cmd;
+  std::vector<uint8_t> Data;
+};
+
+// Update cycle replies, position reads while moving, acks and unknown codes
+const Payload s_payloads[] =
+{
+  { 0xa7, {0x1d, 30, 42, 0x03, 0xe8, 28, 0x30} },
+  { 0xa9, {0x10, 1, 0, 5, 6, 30, 21, 15, 0x11, 0, 1, 3, 8, 0, 17, 45} },
+  { 0xa8, {2, 1, 100, 0x3e, 7, 30, 1, 0, 0x7f, 19, 0} },
+  { 0xaa, {0x00, 3} },
+  { 0xa2, {0x00, 0x00, 0x00, 0x00, 87} },
+  { 0xa1, {0x00, 55} },
+  { 0xa1, {0x00, 56} },
+  { 0xa3, {0x0a, 30} },
+  { 0x0d, {0x5a} },
+  { 0xb5, {0x00} },
+};
+
+std::vector<AM43Core::Frame> Frames(size_t n)
+{
+  std::vector<AM43Core::Frame> frames;
+  for(size_t i = 0; i < n; ++i)
+  {
+    // Fixed pseudo random order, branch predictor can't learn the sequence
+    const Payload& p = s_payloads[(i * 7919 + (i >> 3)) % (sizeof(s_payloads) / sizeof(s_payloads[0]))];
+    AM43Core::Frame frame;
+    frame.Cmd = p.Cmd;
+    frame.Len = p.Data.size();
+    frame.Data = p.Data.data();
+    frame.Checksum = 0;
+    frame.CalculatedChecksum = 0;
+    frames.push_back(frame);
+  }
+  return frames;
+}
+
+template<class Dispatch>
+double Measure(const std::vector<AM43Core::Frame>& frames, State& s, Dispatch dispatch)
+{
+  double best = 0;
+  for(int round = 0; round < 5; ++round)
+  {
+    const double begin = Bench::NowNs();
+    for(const AM43Core::Frame& frame : frames)
+    {
+      s.Step = (s.Step + 1) & 7;
+      dispatch(s, frame);
+    }
+    const double ns = (Bench::NowNs() - begin) / frames.size();
+    best = round == 0 ? ns : std::min(best, ns);
+  }
+  return best;
+}
+}
+
+int main()
+{
+  const std::vector<AM43Core::Frame> frames = Frames(200000);
+
+  State by_switch = {};
+  State by_table = {};
+  const double switch_ns = Measure(frames, by_switch, DispatchSwitch);
+  const double table_ns = Measure(frames, by_table, DispatchTable);
+
+  // Same frames reach same decoders either way
+  CHECK_EQ(by_switch.Decoded, by_table.Decoded);
+  CHECK(memcmp(by_switch.Seasons, by_table.Seasons, sizeof(by_table.Seasons)) == 0);
+  CHECK_EQ(by_switch.Position, by_table.Position);
+
+  AM43.Init(&s_mcu);
+  const double begin = Bench::NowNs();
+  for(const AM43Core::Frame& frame : frames)
+  {
+    AM43.OnFrame(frame);
+  }
+  const double firmware_ns = (Bench::NowNs() - begin) / frames.size();
+  CHECK_EQ(AM43.GetBatteryLevel(), 87);
+
+  Bench::Report("dispatch", "switch", switch_ns, "ns/frame");
+  Bench::Report("dispatch", "table", table_ns, "ns/frame");
+  Bench::Report("dispatch", "AM43Class::OnFrame", firmware_ns, "ns/frame");
+
+  return Test::Result("dispatch bench");
+}
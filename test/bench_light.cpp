@@ -0,0 +1,166 @@
+#include "test.h"
+#include "bench.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "mqtt.h"
+#include "scheduler.h"
+
+#include <math.h>
+
+// Simulated day of light sensor readings with noise around level boundaries
+// and two cloud steps. Filtered sampling with margin publication is compared
+// with former behaviour: raw level read every update cycle, published on change
+
+namespace {
+FakeMcu s_mcu;
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+
+const unsigned long s_hour = 3600000;
+
+struct Step
+{
+  unsigned long Begin;
+  unsigned long End;
+  double Level;
+};
+
+// Cloud steps, level drops sharply and comes back
+const Step s_steps[] =
+{
+  { 12 * s_hour, 12 * s_hour + 1800000, 1.0 },
+  { 15 * s_hour, 15 * s_hour + 600000, 0.8 },
+};
+
+// Light level before quantization, 0 at night, 3.4 at noon
+double Light(unsigned long t)
+{
+  for(const Step& step : s_steps)
+  {
+    if(t >= step.Begin && t < step.End)
+    {
+      return step.Level;
+    }
+  }
+
+  const double h = static_cast<double>(t) / s_hour;
+  if(h < 6 || h >= 20)
+  {
+    return 0;
+  }
+  if(h < 8)
+  {
+    return 3.4 * (h - 6) / 2;
+  }
+  if(h >= 18)
+  {
+    return 3.4 * (20 - h) / 2;
+  }
+  return 3.4;
+}
+
+// Sensor reading, noise makes it flap near level boundaries
+uint8_t Raw(unsigned long t, uint32_t& seed)
+{
+  seed = seed * 1103515245 + 12345;
+  const double noise = ((seed >> 16) % 1000) / 1000.0 * 0.7 - 0.35;
+  return static_cast<uint8_t>(std::max(0.0, std::min(3.0, floor(Light(t) + noise + 0.5))));
+}
+
+struct Publish
+{
+  unsigned long Time;
+  int Level;
+};
+
+// Time from step begin to first published level below level before step,
+// and from step end to first published level above step level
+// -1 if step is not seen at all
+void Reaction(const std::vector<Publish>& published, unsigned long begin_ms, std::vector<long>& reactions)
+{
+  for(const Step& step : s_steps)
+  {
+    long down = -1;
+    long up = -1;
+    for(const Publish& p : published)
+    {
+      if(down < 0 && p.Time >= begin_ms + step.Begin && p.Level < 3)
+      {
+        down = p.Time - begin_ms - step.Begin;
+      }
+      if(up < 0 && p.Time >= begin_ms + step.End && p.Level > static_cast<int>(step.Level + 0.5))
+      {
+        up = p.Time - begin_ms - step.End;
+      }
+    }
+    reactions.push_back(down);
+    reactions.push_back(up);
+  }
+}
+}
+
+int main()
+{
+  // Former behaviour, raw level every slow update cycle, cycle isn't aligned with steps
+  std::vector<Publish> raw_published;
+  uint32_t seed = 7;
+  int last = -1;
+  for(unsigned long t = 7000; t < 24 * s_hour; t += AM43_UPDATE_DELAY_SLOW_MS)
+  {
+    const int level = Raw(t, seed);
+    if(level != last)
+    {
+      raw_published.push_back(Publish{t, level});
+      last = level;
+    }
+  }
+
+  // Firmware with filtered sampling
+  AM43.Init(&s_mcu);
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, "blinds/am43", nullptr);
+  const unsigned long begin = Clock::Millis();
+  seed = 7;
+  while(Clock::Millis() - begin < 24 * s_hour)
+  {
+    s_mcu.Light = Raw(Clock::Millis() - begin, seed);
+    Clock::Advance(10);
+    Scheduler.Run();
+    AM43.Loop();
+    Mqtt.Loop();
+    s_mcu.Serve();
+  }
+
+  std::vector<Publish> filtered_published;
+  for(const PubSubClient::Message& msg : PubSubClient::s_published)
+  {
+    if(msg.Topic == "blinds/am43/light")
+    {
+      filtered_published.push_back(Publish{msg.Time, atoi(msg.Payload.c_str())});
+    }
+  }
+
+  std::vector<long> raw_reactions;
+  std::vector<long> filtered_reactions;
+  Reaction(raw_published, 0, raw_reactions);
+  Reaction(filtered_published, begin, filtered_reactions);
+
+  Bench::Report("light day raw", "publishes", raw_published.size(), "");
+  Bench::Report("light day filtered", "publishes", filtered_published.size(), "");
+  for(size_t i = 0; i < raw_reactions.size(); ++i)
+  {
+    char metric[48];
+    snprintf(metric, sizeof(metric), "step %zu reaction", i);
+    Bench::Report("light day raw", metric, raw_reactions[i] / 1000.0, "s");
+    Bench::Report("light day filtered", metric, filtered_reactions[i] / 1000.0, "s");
+  }
+
+  // Flapping is filtered out, every step is still seen within three light samples
+  CHECK(filtered_published.size() * 4 < raw_published.size());
+  for(const long reaction : filtered_reactions)
+  {
+    CHECK(reaction >= 0 && reaction <= 3 * AM43_LIGHT_SAMPLE_MS);
+  }
+
+  return Test::Result("light day bench");
+}
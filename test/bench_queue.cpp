@@ -0,0 +1,120 @@
+#include "test.h"
+#include "bench.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "mqtt.h"
+#include "scheduler.h"
+
+// MQTT command to UART pipeline under broker backpressure: every publish
+// blocks like a full socket buffer. Reports command latency to UART frame,
+// MCU ack servicing latency and event throughput
+
+namespace {
+FakeMcu s_mcu;
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+
+// Returns true if position frame was written to MCU in this pass
+bool Step()
+{
+  Clock::Advance(10);
+  Scheduler.Run();
+  AM43.Loop();
+  Mqtt.Loop();
+  bool sent = false;
+  for(const FakeMcu::Request& req : s_mcu.Serve())
+  {
+    sent = sent || req.Cmd == static_cast<uint8_t>(AM43Class::Command::SetPosition);
+  }
+  return sent;
+}
+
+void Run(unsigned long ms)
+{
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Step();
+  }
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, "blinds/am43", nullptr);
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK(AM43.IsInitialized());
+  // First position message is taken as retained one and skipped
+  PubSubClient::Deliver("blinds/am43/position/set", "50");
+
+  const unsigned long publish_ms[] = {0, 10, 50, 200};
+  const int commands_n = 100;
+  for(const unsigned long delay_ms : publish_ms)
+  {
+    PubSubClient::s_publish_ms = delay_ms;
+    std::vector<unsigned long> to_uart;
+    std::vector<unsigned long> to_ack;
+    const size_t published = PubSubClient::s_published.size();
+    const unsigned long begin_ms = Clock::Millis();
+    const double begin_ns = Bench::NowNs();
+    for(int i = 0; i < commands_n; ++i)
+    {
+      PubSubClient::Deliver("blinds/am43/position/set", i % 2 == 0 ? "30" : "70");
+      const unsigned long start = Clock::Millis();
+      while(!Step() && Clock::Millis() - start < AM43_CMD_DEADLINE_MS)
+      {
+      }
+      to_uart.push_back(Clock::Millis() - start);
+      const unsigned long sent = Clock::Millis();
+      while(AM43.IsCommandPending() && Clock::Millis() - sent < AM43_CMD_DEADLINE_MS)
+      {
+        Step();
+      }
+      to_ack.push_back(Clock::Millis() - sent);
+      // Blinds move and report state between commands
+      Run(2000);
+    }
+    const double wall_s = (Bench::NowNs() - begin_ns) / 1e9;
+    const double virtual_s = (Clock::Millis() - begin_ms) / 1000.0;
+    const size_t events = PubSubClient::s_published.size() - published + commands_n;
+
+    char name[48];
+    snprintf(name, sizeof(name), "queue publish %lums", delay_ms);
+    Bench::Report(name, "command to uart p50", Bench::Percentile(to_uart, 50), "ms");
+    Bench::Report(name, "command to uart p99", Bench::Percentile(to_uart, 99), "ms");
+    Bench::Report(name, "command to uart max", Bench::Percentile(to_uart, 100), "ms");
+    Bench::Report(name, "ack serviced p99", Bench::Percentile(to_ack, 99), "ms");
+    Bench::Report(name, "events per virtual s", events / virtual_s, "");
+    Bench::Report(name, "events per wall s", events / wall_s, "");
+
+    // Commands are never lost or reordered behind publishes, they only wait
+    CHECK_EQ(AM43.GetFailedCount(), 0);
+    CHECK(Bench::Percentile(to_uart, 100) < AM43_CMD_DEADLINE_MS);
+    if(delay_ms == 0)
+    {
+      CHECK(Bench::Percentile(to_uart, 99) <= AM43_TX_REPLY_WAIT_MS + AM43_TX_GAP_MS);
+    }
+  }
+
+  // Burst of commands faster than MCU accepts them, ring holds AM43_TX_QUEUE_N
+  PubSubClient::s_publish_ms = 50;
+  s_mcu.Written.clear();
+  for(int i = 0; i < AM43_TX_QUEUE_N; ++i)
+  {
+    PubSubClient::Deliver("blinds/am43/position/set", i % 2 == 0 ? "30" : "70");
+  }
+  const unsigned long start = Clock::Millis();
+  while(AM43.IsCommandPending())
+  {
+    Step();
+  }
+  const long frames = std::count(s_mcu.Written.begin(), s_mcu.Written.end(), static_cast<uint8_t>(AM43Class::Command::SetPosition));
+  Bench::Report("queue burst", "commands sent", frames, "");
+  Bench::Report("queue burst", "drain time", Clock::Millis() - start, "ms");
+  CHECK_EQ(frames, AM43_TX_QUEUE_N);
+  CHECK_EQ(AM43.GetFailedCount(), 0);
+
+  return Test::Result("queue bench");
+}
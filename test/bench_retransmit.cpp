@@ -0,0 +1,83 @@
+#include "test.h"
+#include "bench.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "scheduler.h"
+
+// User command delivery over noisy line: success rate, latency to MCU
+// confirmation and frames sent per command for several byte drop rates
+
+namespace {
+FakeMcu s_mcu;
+void Step()
+{
+  Clock::Advance(10);
+  Scheduler.Run();
+  AM43.Loop();
+  s_mcu.Serve();
+}
+
+void Run(unsigned long ms)
+{
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Step();
+  }
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK(AM43.IsInitialized());
+
+  const int drops[] = {0, 1, 2, 5, 10};
+  const int commands_n = 200;
+  for(const int drop : drops)
+  {
+    s_mcu.DropPercent = drop;
+    s_mcu.Written.clear();
+    int delivered = 0;
+    std::vector<unsigned long> latencies;
+    for(int i = 0; i < commands_n; ++i)
+    {
+      const unsigned long failed = AM43.GetFailedCount();
+      const unsigned long start = Clock::Millis();
+      AM43.SetPosition(i % 2 == 0 ? 30 : 70);
+      while(AM43.IsCommandPending())
+      {
+        Step();
+      }
+      if(AM43.GetFailedCount() == failed)
+      {
+        ++delivered;
+        latencies.push_back(Clock::Millis() - start);
+      }
+      // Commands are spread apart like user actions, polls run in between
+      Run(2000);
+    }
+
+    const double success = 100.0 * delivered / commands_n;
+    const long frames = std::count(s_mcu.Written.begin(), s_mcu.Written.end(), static_cast<uint8_t>(AM43Class::Command::SetPosition));
+    char name[32];
+    snprintf(name, sizeof(name), "retransmit drop %i%%", drop);
+    Bench::Report(name, "success", success, "%");
+    Bench::Report(name, "latency p50", Bench::Percentile(latencies, 50), "ms");
+    Bench::Report(name, "latency p99", Bench::Percentile(latencies, 99), "ms");
+    Bench::Report(name, "frames per command", static_cast<double>(frames) / commands_n, "");
+
+    if(drop == 0)
+    {
+      CHECK_EQ(delivered, commands_n);
+      CHECK_EQ(frames, commands_n);
+    }
+    else if(drop <= 2)
+    {
+      CHECK(success >= 99.0);
+    }
+  }
+
+  return Test::Result("retransmit bench");
+}
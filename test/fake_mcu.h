@@ -0,0 +1,188 @@
+#ifndef FAKE_MCU_H
+#define FAKE_MCU_H
+
+#include <Arduino.h>
+
+#include <string>
+#include <vector>
+
+// AM43 MCU side of UART, requests written by firmware are collected in Out,
+// replies queued by Reply are read from In
+// Line noise drops DropPercent of bytes in both directions, request with
+// lost byte fails MCU checksum and is ignored as a whole
+class FakeMcu : public Stream
+{
+  public:
+    struct Request
+    {
+      uint8_t Cmd;
+      std::vector<uint8_t> Data;
+    };
+
+    size_t write(uint8_t c) override { Out.push_back(c); return 1; }
+    size_t write(const uint8_t* buff, size_t buff_n) override
+    {
+      if(buff_n > 5)
+      {
+        Written.push_back(buff[5]);
+      }
+      bool lost = false;
+      for(size_t i = 0; i < buff_n; ++i)
+      {
+        lost = Drop() || lost;
+      }
+      if(!lost)
+      {
+        Out.append(reinterpret_cast<const char*>(buff), buff_n);
+      }
+      return buff_n;
+    }
+    int available() override { return In.size(); }
+    int read() override
+    {
+      if(In.empty())
+      {
+        return -1;
+      }
+      const int c = static_cast<uint8_t>(In[0]);
+      In.erase(0, 1);
+      return c;
+    }
+    int peek() override { return In.empty() ? -1 : static_cast<uint8_t>(In[0]); }
+
+    // Queue reply frame: 0x9a, cmd, len, data, xor checksum
+    void Reply(uint8_t cmd, const std::vector<uint8_t>& data)
+    {
+      std::string frame;
+      frame.push_back(static_cast<char>(0x9a));
+      frame.push_back(static_cast<char>(cmd));
+      frame.push_back(static_cast<char>(data.size()));
+      frame.append(data.begin(), data.end());
+
+      uint8_t checksum = 0;
+      for(const char c : frame)
+      {
+        checksum ^= static_cast<uint8_t>(c);
+      }
+      frame.push_back(static_cast<char>(checksum));
+      for(const char c : frame)
+      {
+        if(!Drop())
+        {
+          In.push_back(c);
+        }
+      }
+    }
+
+    // Parse requests written so far: 00 ff 00 00 9a cmd len data checksum
+    std::vector<Request> TakeRequests()
+    {
+      std::vector<Request> requests;
+      while(Out.size() >= 8)
+      {
+        const uint8_t len = Out[6];
+        Request req;
+        req.Cmd = Out[5];
+        req.Data.assign(Out.begin() + 7, Out.begin() + 7 + len);
+        Out.erase(0, 8 + len);
+        requests.push_back(req);
+      }
+      return requests;
+    }
+
+    // Answer requests the way MCU does, user requests are acked unless Silent
+    // GetSettings is answered with settings and seasons burst
+    std::vector<Request> Serve()
+    {
+      std::vector<Request> requests = TakeRequests();
+      for(const Request& req : requests)
+      {
+        switch(req.Cmd)
+        {
+          case 0xa7:
+            Reply(0xa7, {static_cast<uint8_t>(0x11 | Limits), Speed, Position, 0x03, 0xe8, 28, 0x30});
+            Reply(0xa9, Seasons);
+            break;
+          case 0xa8:
+            Reply(0xa8, Timings);
+            break;
+          case 0xaa:
+            Reply(0xaa, {0x00, Light});
+            break;
+          case 0xa2:
+            Reply(0xa2, {0x00, 0x00, 0x00, 0x00, Battery});
+            break;
+          case 0x0d:
+            if(!Silent)
+            {
+              Position = Jammed ? Position : req.Data[0];
+              Reply(0x0d, {0x5a});
+            }
+            break;
+          case 0x22:
+            // Limits reset and set, top and bottom payloads as assumed by firmware
+            if(!Silent)
+            {
+              const std::vector<uint8_t> reset = {0x00, 0x00, 0x01};
+              const std::vector<uint8_t> top = {0x01, 0x00, 0x00};
+              const std::vector<uint8_t> bottom = {0x00, 0x01, 0x00};
+              uint8_t result = 0xb5;
+              if(req.Data == reset)
+              {
+                Limits = 0;
+                result = 0xc5;
+              }
+              else if(req.Data == top)
+              {
+                Limits |= 0x04;
+                result = 0x5b;
+              }
+              else if(req.Data == bottom)
+              {
+                Limits |= 0x08;
+                result = 0x5b;
+              }
+              Reply(0x22, {result});
+            }
+            break;
+          default:
+            if(!Silent && req.Cmd < 0xa0)
+            {
+              Reply(req.Cmd, {0x5a});
+            }
+            break;
+        }
+      }
+      return requests;
+    }
+
+    // Deterministic noise, same seed gives same drops
+    bool Drop()
+    {
+      if(DropPercent <= 0)
+      {
+        return false;
+      }
+      Seed = Seed * 1103515245 + 12345;
+      return static_cast<int>((Seed >> 16) % 100) < DropPercent;
+    }
+
+    std::string Out;
+    // Command of every request frame written by firmware, including lost ones
+    std::vector<uint8_t> Written;
+    std::string In;
+
+    bool Silent = false;
+    bool Jammed = false; // Position requests are acked but blinds don't move
+    int DropPercent = 0;
+    uint32_t Seed = 1;
+    uint8_t Limits = 0x0c; // Top and bottom limit bits of GetSettings reply
+    uint8_t Speed = 30;
+    uint8_t Position = 20;
+    uint8_t Light = 3;
+    uint8_t Battery = 87;
+    std::vector<uint8_t> Seasons = {0x10, 1, 0, 5, 6, 30, 21, 15, 0x11, 0, 1, 3, 8, 0, 17, 45};
+    std::vector<uint8_t> Timings = {2, 1, 100, 0x3e, 7, 30, 1, 0, 0x7f, 19, 0};
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include "am43.h"
+#include "battery.h"
+#include "budget.h"
+#include "calibration.h"
+#include "http.h"
+#include "mqtt.h"
+#include "multicast.h"
+#include "rules.h"
+#include "scheduler.h"
+#include "speed.h"
+#include "warmstart.h"
+
+#include <stdio.h>
+
+// Static RAM per component against budget.h, sizes are of this build,
+// budgets are scaled by pointer size the same way RAM_BUDGET_CHECK does
+// Fails if any component is over budget
+
+namespace {
+struct Component
+{
+  const char* Name;
+  size_t Size;
+  size_t Budget;
+};
+
+const Component s_components[] =
+{
+  { "AM43", sizeof(AM43Class), RAM_BUDGET_AM43 },
+  { "MQTT", sizeof(MqttClass) - sizeof(WiFiClient) - sizeof(PubSubClient), RAM_BUDGET_MQTT },
+  { "HTTP", sizeof(HttpClass) - sizeof(ESP8266WebServer), RAM_BUDGET_HTTP },
+  { "Multicast", sizeof(MulticastClass) - sizeof(WiFiUDP), RAM_BUDGET_MULTICAST },
+  { "Rules", sizeof(RulesClass), RAM_BUDGET_RULES },
+  { "Battery", sizeof(BatteryClass), RAM_BUDGET_BATTERY },
+  { "WarmStart", sizeof(WarmStartClass), RAM_BUDGET_WARMSTART },
+  { "Calibration", sizeof(CalibrationClass), RAM_BUDGET_CALIBRATION },
+  { "Speed", sizeof(SpeedProfilesClass), RAM_BUDGET_SPEED },
+  { "Scheduler", sizeof(SchedulerClass), RAM_BUDGET_SCHEDULER },
+};
+}
+
+int main()
+{
+  printf("pointer size %zu, budgets scaled x%zu/4\n", sizeof(void*), sizeof(void*));
+  printf("%-12s %8s %8s %8s\n", "component", "size", "budget", "scaled");
+
+  int over = 0;
+  size_t total = 0;
+  for(const Component& c : s_components)
+  {
+    const size_t scaled = RAM_BUDGET_SCALED(c.Budget);
+    printf("%-12s %8zu %8zu %8zu%s\n", c.Name, c.Size, c.Budget, scaled, c.Size > scaled ? "  OVER" : "");
+    over += c.Size > scaled;
+    total += c.Size;
+  }
+  printf("%-12s %8zu\n", "total", total);
+
+  return over == 0 ? 0 : 1;
+}
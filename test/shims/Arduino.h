@@ -0,0 +1,133 @@
+#ifndef ARDUINO_SHIM_H
+#define ARDUINO_SHIM_H
+
+// Minimal Arduino API for host builds, time comes from virtual clock
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <strings.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+#define PI      3.14159265358979f
+#define INPUT   0
+#define OUTPUT  1
+#define LOW     0
+#define HIGH    1
+#define HEX     16
+#define PROGMEM
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+long random(long max_value);
+long random(long min_value, long max_value);
+
+class String
+{
+  public:
+    String(const char* str = "") : m_str(str) {}
+    String(int value, int base = 10) : m_str(base == HEX ? Format("%x", value) : Format("%d", value)) {}
+
+    const char* c_str() const { return m_str.c_str(); }
+    unsigned int length() const { return m_str.length(); }
+    int toInt() const { return atoi(m_str.c_str()); }
+    String operator+(const String& other) const { return String((m_str + other.m_str).c_str()); }
+    String& operator+=(const String& other) { m_str += other.m_str; return *this; }
+
+  private:
+    static std::string Format(const char* fmt, int value)
+    {
+      char buff[16];
+      snprintf(buff, sizeof(buff), fmt, value);
+      return buff;
+    }
+
+    std::string m_str;
+};
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buff, size_t buff_n)
+    {
+      for(size_t i = 0; i < buff_n; ++i)
+      {
+        write(buff[i]);
+      }
+      return buff_n;
+    }
+    size_t print(const char* str) { return write(reinterpret_cast<const uint8_t*>(str), strlen(str)); }
+    size_t println(const char* str) { return print(str) + print("\n"); }
+};
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream
+{
+  public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t) override { return 1; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+
+extern HardwareSerial Serial;
+
+#define ESP_RTC_USER_MEMORY_N 512
+
+class EspClass
+{
+  public:
+    uint32_t getFreeHeap() { return 40000; }
+    uint32_t getMaxFreeBlockSize() { return 30000; }
+    uint8_t getHeapFragmentation() { return 10; }
+    uint32_t getChipId() { return 0x434343; }
+    void reset() {}
+
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size);
+
+    // Host only, RTC user memory contents, cleared to emulate power loss
+    uint8_t RtcMemory[ESP_RTC_USER_MEMORY_N];
+};
+
+extern EspClass ESP;
+
+inline size_t strlcpy(char* dst, const char* src, size_t dst_n)
+{
+  const size_t src_n = strlen(src);
+  if(dst_n > 0)
+  {
+    const size_t n = src_n < dst_n - 1 ? src_n : dst_n - 1;
+    memcpy(dst, src, n);
+    dst[n] = 0;
+  }
+  return src_n;
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef ESP8266WEBSERVER_SHIM_H
+#define ESP8266WEBSERVER_SHIM_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+enum HTTPMethod
+{
+  HTTP_ANY,
+  HTTP_GET,
+  HTTP_POST
+};
+
+// Listening socket, client is waiting while request is pending
+class WiFiServer
+{
+  public:
+    bool hasClient();
+};
+
+// Request set by Request is dispatched on next handleClient call, as real
+// server does, last response is recorded in s_response
+class ESP8266WebServer
+{
+  public:
+    struct Response
+    {
+      int Code;
+      std::string Type;
+      std::string Body;
+    };
+
+    ESP8266WebServer(int) {}
+
+    void begin() {}
+    void handleClient()
+    {
+      if(!s_pending)
+      {
+        return;
+      }
+
+      s_pending = false;
+      for(const Route& route : m_routes)
+      {
+        if(route.Uri == s_uri && (route.Method == HTTP_ANY || route.Method == s_method))
+        {
+          route.Handler();
+          return;
+        }
+      }
+      if(m_not_found)
+      {
+        m_not_found();
+      }
+    }
+    void on(const char* uri, HTTPMethod method, std::function<void()> handler) { m_routes.push_back(Route{uri, method, handler}); }
+    void onNotFound(std::function<void()> handler) { m_not_found = handler; }
+    bool hasArg(const char* name) { return s_args.count(name) > 0; }
+    String arg(const char* name) { return hasArg(name) ? String(s_args[name].c_str()) : String(); }
+    void send(int code, const char* type = nullptr, const char* body = nullptr)
+    {
+      s_response = Response{code, type != nullptr ? type : "", body != nullptr ? body : ""};
+    }
+
+    // Host only, client request waiting for next handleClient
+    static void Request(HTTPMethod method, const char* uri, const char* arg_name = nullptr, const char* value = nullptr)
+    {
+      s_method = method;
+      s_uri = uri;
+      s_args.clear();
+      if(arg_name != nullptr)
+      {
+        s_args[arg_name] = value;
+      }
+      s_response = Response{0, "", ""};
+      s_pending = true;
+    }
+    static bool HasPending() { return s_pending; }
+
+    static Response s_response;
+
+  protected:
+    WiFiServer _server;
+    WiFiClient _currentClient;
+
+  private:
+    struct Route
+    {
+      std::string Uri;
+      HTTPMethod Method;
+      std::function<void()> Handler;
+    };
+
+    std::vector<Route> m_routes;
+    std::function<void()> m_not_found;
+
+    static bool s_pending;
+    static HTTPMethod s_method;
+    static std::string s_uri;
+    static std::map<std::string, std::string> s_args;
+};
+
+inline bool WiFiServer::hasClient()
+{
+  return ESP8266WebServer::HasPending();
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef ESP8266WIFI_SHIM_H
+#define ESP8266WIFI_SHIM_H
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+#define WL_CONNECTED 3
+
+class WiFiClass
+{
+  public:
+    IPAddress localIP() { return IPAddress(192, 168, 1, 43); }
+    int status() { return WL_CONNECTED; }
+};
+
+extern WiFiClass WiFi;
+
+#endif
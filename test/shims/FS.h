@@ -0,0 +1,72 @@
+#ifndef FS_SHIM_H
+#define FS_SHIM_H
+
+#include <Arduino.h>
+
+#include <map>
+#include <string>
+
+// SPIFFS kept in memory, files are plain strings
+// rename fails if target exists, same as on SPIFFS
+class File : public Stream
+{
+  public:
+    File(std::string* content = nullptr) : m_content(content), m_pos(0) {}
+
+    operator bool() const { return m_content != nullptr; }
+    size_t size() const { return m_content->size(); }
+    size_t read(uint8_t* buff, size_t buff_n)
+    {
+      const size_t n = min(buff_n, m_content->size() - m_pos);
+      memcpy(buff, m_content->data() + m_pos, n);
+      m_pos += n;
+      return n;
+    }
+    int read() override { return m_pos < m_content->size() ? static_cast<uint8_t>((*m_content)[m_pos++]) : -1; }
+    int available() override { return m_content->size() - m_pos; }
+    int peek() override { return m_pos < m_content->size() ? static_cast<uint8_t>((*m_content)[m_pos]) : -1; }
+    size_t write(uint8_t c) override { m_content->push_back(c); return 1; }
+    size_t write(const uint8_t* buff, size_t buff_n) override { m_content->append(reinterpret_cast<const char*>(buff), buff_n); return buff_n; }
+    void close() { m_content = nullptr; }
+
+  private:
+    std::string* m_content;
+    size_t m_pos;
+};
+
+class FSClass
+{
+  public:
+    bool begin() { return true; }
+    bool exists(const char* path) { return Files.count(path) > 0; }
+    File open(const char* path, const char* mode)
+    {
+      if(mode[0] == 'w')
+      {
+        Files[path].clear();
+      }
+      else if(!exists(path))
+      {
+        return File();
+      }
+      return File(&Files[path]);
+    }
+    bool remove(const char* path) { return Files.erase(path) > 0; }
+    bool rename(const char* from, const char* to)
+    {
+      if(!exists(from) || exists(to))
+      {
+        return false;
+      }
+      Files[to] = Files[from];
+      Files.erase(from);
+      return true;
+    }
+
+    // Host only, file system contents
+    std::map<std::string, std::string> Files;
+};
+
+extern FSClass SPIFFS;
+
+#endif
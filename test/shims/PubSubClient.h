@@ -0,0 +1,72 @@
+#ifndef PUBSUBCLIENT_SHIM_H
+#define PUBSUBCLIENT_SHIM_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Broker connection is accepted or refused by s_accept, published
+// messages are recorded in s_published and subscriptions in s_subscribed, publish blocks for s_publish_ms
+// like a full socket buffer of slow broker
+class PubSubClient
+{
+  public:
+    struct Message
+    {
+      std::string Topic;
+      std::string Payload;
+      bool Retained;
+      unsigned long Time;
+    };
+
+    PubSubClient(WiFiClient&) : m_connected(false) {}
+
+    void setServer(const char*, int) {}
+    void setCallback(std::function<void(char*, uint8_t*, unsigned int)> callback) { s_callback = callback; }
+    bool setBufferSize(uint16_t) { return true; }
+
+    bool connect(const char*, const char*, const char*)
+    {
+      ++s_connects;
+      m_connected = s_accept;
+      return m_connected;
+    }
+    // Refused broker drops connection, it stays down until next connect
+    bool connected() { m_connected = m_connected && s_accept; return m_connected; }
+    bool loop() { return connected(); }
+    bool subscribe(const char* topic) { s_subscribed.push_back(topic); return connected(); }
+
+    bool publish(const char* topic, const char* payload, bool retained = false)
+    {
+      return publish(topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload), retained);
+    }
+    bool publish(const char* topic, const uint8_t* payload, unsigned int payload_n, bool retained = false)
+    {
+      delay(s_publish_ms);
+      s_published.push_back(Message{topic, std::string(reinterpret_cast<const char*>(payload), payload_n), retained, millis()});
+      return connected();
+    }
+
+    // Host only, deliver message to firmware client as if it was received from broker
+    static void Deliver(const char* topic, const char* payload)
+    {
+      std::string t(topic);
+      std::string p(payload);
+      s_callback(&t[0], reinterpret_cast<uint8_t*>(&p[0]), p.size());
+    }
+
+    static bool s_accept;
+    static int s_connects;
+    static unsigned long s_publish_ms;
+    static std::vector<Message> s_published;
+    static std::vector<std::string> s_subscribed;
+
+  private:
+    bool m_connected;
+    static std::function<void(char*, uint8_t*, unsigned int)> s_callback;
+};
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef WIFICLIENT_SHIM_H
+#define WIFICLIENT_SHIM_H
+
+#include <Arduino.h>
+
+// Bytes waiting in socket are set by s_available
+class WiFiClient
+{
+  public:
+    int available() { return s_available; }
+
+    static int s_available;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef WIFIUDP_SHIM_H
+#define WIFIUDP_SHIM_H
+
+#include <Arduino.h>
+
+#include <deque>
+#include <vector>
+
+class IPAddress
+{
+  public:
+    IPAddress() : m_addr(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : m_addr(a << 24 | b << 16 | c << 8 | d) {}
+
+  private:
+    uint32_t m_addr;
+};
+
+// Datagrams queued in s_received are returned by parsePacket/read,
+// sent datagrams are recorded in s_sent
+class WiFiUDP : public Stream
+{
+  public:
+    uint8_t beginMulticast(IPAddress, IPAddress, uint16_t) { return 1; }
+    uint8_t begin(uint16_t) { return 1; }
+    void stop() {}
+
+    int parsePacket()
+    {
+      if(s_received.empty())
+      {
+        return 0;
+      }
+      m_packet = s_received.front();
+      s_received.pop_front();
+      m_pos = 0;
+      return m_packet.size();
+    }
+    int read(uint8_t* buff, size_t buff_n)
+    {
+      const size_t n = min(buff_n, m_packet.size() - m_pos);
+      memcpy(buff, m_packet.data() + m_pos, n);
+      m_pos += n;
+      return n;
+    }
+    int read() override { return m_pos < m_packet.size() ? m_packet[m_pos++] : -1; }
+    int available() override { return m_packet.size() - m_pos; }
+    int peek() override { return m_pos < m_packet.size() ? m_packet[m_pos] : -1; }
+    IPAddress remoteIP() { return IPAddress(192, 168, 1, 2); }
+    uint16_t remotePort() { return 4343; }
+
+    int beginPacket(IPAddress, uint16_t) { m_out.clear(); return 1; }
+    size_t write(uint8_t c) override { m_out.push_back(c); return 1; }
+    size_t write(const uint8_t* buff, size_t buff_n) override { m_out.insert(m_out.end(), buff, buff + buff_n); return buff_n; }
+    int endPacket() { s_sent.push_back(m_out); return 1; }
+
+    static std::deque<std::vector<uint8_t>> s_received;
+    static std::vector<std::vector<uint8_t>> s_sent;
+
+  private:
+    std::vector<uint8_t> m_packet;
+    size_t m_pos = 0;
+    std::vector<uint8_t> m_out;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include <Arduino.h>
+#include <FS.h>
+#include <PubSubClient.h>
+#include <WiFiUdp.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266WebServer.h>
+
+#include "clock.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+FSClass SPIFFS;
+
+unsigned long millis()
+{
+  return Clock::Millis();
+}
+
+unsigned long micros()
+{
+  return Clock::Millis() * 1000;
+}
+
+void delay(unsigned long ms)
+{
+  Clock::Delay(ms);
+}
+
+void yield()
+{
+
+}
+
+void pinMode(int, int)
+{
+
+}
+
+void digitalWrite(int, int)
+{
+
+}
+
+int digitalRead(int)
+{
+  return HIGH;
+}
+
+long random(long max_value)
+{
+  return max_value > 0 ? rand() % max_value : 0;
+}
+
+long random(long min_value, long max_value)
+{
+  return min_value + random(max_value - min_value);
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size)
+{
+  if(offset * 4 + size > sizeof(RtcMemory))
+  {
+    return false;
+  }
+
+  memcpy(data, RtcMemory + offset * 4, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size)
+{
+  if(offset * 4 + size > sizeof(RtcMemory))
+  {
+    return false;
+  }
+
+  memcpy(RtcMemory + offset * 4, data, size);
+  return true;
+}
+
+int WiFiClient::s_available = 0;
+
+bool PubSubClient::s_accept = true;
+int PubSubClient::s_connects = 0;
+unsigned long PubSubClient::s_publish_ms = 0;
+std::vector<PubSubClient::Message> PubSubClient::s_published;
+std::vector<std::string> PubSubClient::s_subscribed;
+std::function<void(char*, uint8_t*, unsigned int)> PubSubClient::s_callback;
+
+std::deque<std::vector<uint8_t>> WiFiUDP::s_received;
+std::vector<std::vector<uint8_t>> WiFiUDP::s_sent;
+
+bool ESP8266WebServer::s_pending = false;
+HTTPMethod ESP8266WebServer::s_method = HTTP_ANY;
+std::string ESP8266WebServer::s_uri;
+std::map<std::string, std::string> ESP8266WebServer::s_args;
+ESP8266WebServer::Response ESP8266WebServer::s_response;
@@ -0,0 +1,44 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// Minimal checks for host tests, failures are counted and returned from main
+namespace Test
+{
+  inline int& Failures()
+  {
+    static int s_failures = 0;
+    return s_failures;
+  }
+
+  inline int Result(const char* name)
+  {
+    printf("%s: %s\n", name, Failures() == 0 ? "passed" : "FAILED");
+    return Failures() == 0 ? 0 : 1;
+  }
+}
+
+#define CHECK(cond) \
+  do \
+  { \
+    if(!(cond)) \
+    { \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      ++Test::Failures(); \
+    } \
+  } while(0)
+
+#define CHECK_EQ(a, b) \
+  do \
+  { \
+    const long long a_ = (a); \
+    const long long b_ = (b); \
+    if(a_ != b_) \
+    { \
+      printf("%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+      ++Test::Failures(); \
+    } \
+  } while(0)
+
+#endif
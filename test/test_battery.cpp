@@ -0,0 +1,81 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "battery.h"
+#include "scheduler.h"
+#include "warmstart.h"
+
+// Battery discharge estimate replayed over weeks of virtual time, series
+// survives reboot through warm start snapshot
+
+namespace {
+FakeMcu s_mcu;
+const unsigned long s_day_ms = 86400000UL;
+
+// Battery drains 1% per day from start_level
+void Run(unsigned long days, uint8_t start_level)
+{
+  const unsigned long start = Clock::Millis();
+  while(Clock::Millis() - start < days * s_day_ms)
+  {
+    Clock::Advance(5000);
+    s_mcu.Battery = start_level - (Clock::Millis() - start) / s_day_ms;
+    Scheduler.Run();
+    AM43.Loop();
+    Battery.Loop();
+    WarmStart.Loop();
+    s_mcu.Serve();
+  }
+}
+}
+
+int main()
+{
+  s_mcu.Battery = 40;
+  AM43.Init(&s_mcu);
+  CHECK(!WarmStart.Restore());
+
+  // Not enough samples yet
+  Run(BATTERY_SAMPLE_MS * (BATTERY_SAMPLES_MIN - 2) / s_day_ms + 1, 40);
+  CHECK(!Battery.HasEstimate());
+
+  Run(3, 39);
+  CHECK(Battery.HasEstimate());
+  CHECK(Battery.GetRateX100() <= -80 && Battery.GetRateX100() >= -120);
+  CHECK(Battery.GetRemainingDays() >= 30 && Battery.GetRemainingDays() <= 45);
+  CHECK_EQ(Battery.GetPollScale(), 1);
+
+  // Two weeks later estimate follows, polling is throttled on low battery
+  Run(14, 32);
+  CHECK(Battery.GetRateX100() <= -90 && Battery.GetRateX100() >= -110);
+  CHECK(Battery.GetRemainingDays() >= 15 && Battery.GetRemainingDays() <= 22);
+  CHECK_EQ(Battery.GetPollScale(), 2);
+  const int rate = Battery.GetRateX100();
+  const int remaining = Battery.GetRemainingDays();
+
+  // Reboot keeps RTC memory, series and estimate are restored
+  Battery = BatteryClass();
+  CHECK(!Battery.HasEstimate());
+  CHECK(WarmStart.Restore());
+  CHECK(Battery.HasEstimate());
+  CHECK_EQ(Battery.GetRateX100(), rate);
+  CHECK_EQ(Battery.GetRemainingDays(), remaining);
+
+  // Power loss clears RTC memory, flash copy is used
+  memset(ESP.RtcMemory, 0, sizeof(ESP.RtcMemory));
+  Battery = BatteryClass();
+  CHECK(WarmStart.Restore());
+  CHECK_EQ(Battery.GetRateX100(), rate);
+
+  // Restored series continues, next sample is a full period later
+  Run(2, 18);
+  CHECK(Battery.HasEstimate());
+  CHECK(Battery.GetRateX100() <= -90 && Battery.GetRateX100() >= -110);
+
+  // Charged battery starts new series
+  Run(1, 100);
+  CHECK(!Battery.HasEstimate());
+  CHECK_EQ(Battery.GetPollScale(), 1);
+
+  return Test::Result("battery");
+}
@@ -0,0 +1,57 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "mqtt.h"
+#include "scheduler.h"
+
+// MQTT connects on first loop pass after Wi-Fi is up and publishes state right away
+
+namespace {
+FakeMcu s_mcu;
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+
+const PubSubClient::Message* First(const char* topic)
+{
+  for(const PubSubClient::Message& msg : PubSubClient::s_published)
+  {
+    if(msg.Topic == topic)
+    {
+      return &msg;
+    }
+  }
+  return nullptr;
+}
+}
+
+int main()
+{
+  // Setup as in sketch, Wi-Fi came up after 3 s
+  Clock::Set(3000);
+  AM43.Init(&s_mcu);
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, "blinds/am43", nullptr);
+  Mqtt.SetBootTimes(100, 3000, false);
+  CHECK_EQ(PubSubClient::s_connects, 0);
+
+  // First loop pass
+  Scheduler.Run();
+  AM43.Loop();
+  Mqtt.Loop();
+  CHECK_EQ(PubSubClient::s_connects, 1);
+  CHECK(Mqtt.IsOk());
+
+  const PubSubClient::Message* status = First("blinds/am43/status");
+  const PubSubClient::Message* boot = First("blinds/am43/boot");
+  CHECK(status != nullptr);
+  CHECK(boot != nullptr);
+  if(status != nullptr && boot != nullptr)
+  {
+    CHECK_EQ(status->Time, 3000);
+    CHECK_EQ(boot->Time, 3000);
+    CHECK(boot->Retained);
+    CHECK(boot->Payload.find("\"mqtt\":3000,\"publish\":3000") != std::string::npos);
+  }
+
+  return Test::Result("boot");
+}
@@ -0,0 +1,72 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "calibration.h"
+#include "mqtt.h"
+#include "scheduler.h"
+
+// Limits calibration is off unless AM43_LIMITS_CALIBRATION is defined,
+// unverified limit set payloads never reach MCU
+
+namespace {
+FakeMcu s_mcu;
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+
+void Run(unsigned long ms)
+{
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Clock::Advance(10);
+    Scheduler.Run();
+    AM43.Loop();
+    Calibration.Loop();
+    Mqtt.Loop();
+    s_mcu.Serve();
+  }
+}
+
+int LimitRequests()
+{
+  int n = 0;
+  for(const FakeMcu::Request& req : s_mcu.TakeRequests())
+  {
+    n += req.Cmd == static_cast<uint8_t>(AM43Class::Command::ResetLimits);
+  }
+  return n;
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, "blinds/am43", nullptr);
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  s_mcu.TakeRequests();
+
+  CHECK(!CalibrationClass::IsEnabled());
+  CHECK(!Calibration.Start());
+  CHECK(!Calibration.IsActive());
+  CHECK(!AM43.SetLimit(true));
+  CHECK(!AM43.SetLimit(false));
+
+  PubSubClient::s_published.clear();
+  PubSubClient::Deliver("blinds/am43/calibration/set", "start");
+  Run(1000);
+  CHECK(!Calibration.IsActive());
+  CHECK_EQ(LimitRequests(), 0);
+
+  bool disabled = false;
+  for(const PubSubClient::Message& msg : PubSubClient::s_published)
+  {
+    if(msg.Topic == "blinds/am43/calibration")
+    {
+      disabled = msg.Payload.find("\"disabled\"") != std::string::npos;
+    }
+  }
+  CHECK(disabled);
+
+  return Test::Result("calibration");
+}
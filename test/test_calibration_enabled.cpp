@@ -0,0 +1,113 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "calibration.h"
+#include "mqtt.h"
+#include "scheduler.h"
+
+// Built with AM43_LIMITS_CALIBRATION, remote calibration sequence driven
+// over MQTT against simulated MCU which applies limit set payloads
+
+namespace {
+FakeMcu s_mcu;
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+std::vector<FakeMcu::Request> s_limits;
+
+void Run(unsigned long ms)
+{
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Clock::Advance(10);
+    Scheduler.Run();
+    AM43.Loop();
+    Calibration.Loop();
+    Mqtt.Loop();
+    for(const FakeMcu::Request& req : s_mcu.Serve())
+    {
+      if(req.Cmd == static_cast<uint8_t>(AM43Class::Command::ResetLimits))
+      {
+        s_limits.push_back(req);
+      }
+    }
+  }
+}
+
+// Run until calibration reaches state, returns false on timeout
+bool RunUntil(CalibrationClass::State state, unsigned long timeout_ms)
+{
+  const unsigned long until = Clock::Millis() + timeout_ms;
+  while(Calibration.GetState() != state && Clock::Millis() < until)
+  {
+    Run(10);
+  }
+  return Calibration.GetState() == state;
+}
+
+std::string LastCalibration()
+{
+  std::string payload;
+  for(const PubSubClient::Message& msg : PubSubClient::s_published)
+  {
+    if(msg.Topic == "blinds/am43/calibration")
+    {
+      payload = msg.Payload;
+    }
+  }
+  return payload;
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, "blinds/am43", nullptr);
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK(CalibrationClass::IsEnabled());
+  CHECK(AM43.IsTopLimitSet() && AM43.IsBottomLimitSet());
+
+  // Reset clears both limits, verified by GetSettings read back
+  PubSubClient::Deliver("blinds/am43/calibration/set", "start");
+  CHECK(Calibration.GetState() == CalibrationClass::State::Resetting);
+  CHECK(RunUntil(CalibrationClass::State::JogTop, CALIB_STEP_TIMEOUT_MS));
+  CHECK(!AM43.IsTopLimitSet() && !AM43.IsBottomLimitSet());
+
+  // Jog to top and confirm
+  PubSubClient::Deliver("blinds/am43/calibration/set", "up");
+  Run(1000);
+  PubSubClient::Deliver("blinds/am43/calibration/set", "confirm");
+  CHECK(Calibration.GetState() == CalibrationClass::State::ConfirmingTop);
+  CHECK(RunUntil(CalibrationClass::State::JogBottom, CALIB_STEP_TIMEOUT_MS));
+  CHECK(AM43.IsTopLimitSet() && !AM43.IsBottomLimitSet());
+
+  // Jog to bottom and confirm
+  PubSubClient::Deliver("blinds/am43/calibration/set", "down");
+  Run(1000);
+  PubSubClient::Deliver("blinds/am43/calibration/set", "confirm");
+  CHECK(RunUntil(CalibrationClass::State::Done, CALIB_STEP_TIMEOUT_MS));
+  CHECK(AM43.IsTopLimitSet() && AM43.IsBottomLimitSet());
+  Run(MQTT_PUBLISH_FAST_MS * 2);
+  CHECK(LastCalibration().find("\"done\"") != std::string::npos);
+  CHECK(LastCalibration().find("\"result\":91") != std::string::npos);
+
+  // Reset, top and bottom payloads, each sent once
+  const std::vector<std::vector<uint8_t>> expected = {{0x00, 0x00, 0x01}, {0x01, 0x00, 0x00}, {0x00, 0x01, 0x00}};
+  CHECK_EQ(s_limits.size(), expected.size());
+  for(size_t i = 0; i < s_limits.size() && i < expected.size(); ++i)
+  {
+    CHECK(s_limits[i].Data == expected[i]);
+  }
+
+  // MCU doesn't report top limit, step times out
+  CHECK(Calibration.Start());
+  CHECK(RunUntil(CalibrationClass::State::JogTop, CALIB_STEP_TIMEOUT_MS));
+  s_mcu.Silent = true;
+  CHECK(Calibration.Confirm());
+  CHECK(RunUntil(CalibrationClass::State::Failed, CALIB_STEP_TIMEOUT_MS + 1000));
+  CHECK(!AM43.IsTopLimitSet());
+  s_mcu.Silent = false;
+
+  return Test::Result("calibration enabled");
+}
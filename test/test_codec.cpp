@@ -0,0 +1,63 @@
+#include "test.h"
+#include "am43_core.h"
+
+#include <vector>
+
+// Payload codecs of protocol core shared by both front-ends
+
+int main()
+{
+  // GetSettings reply as sent by MCU: forward, continuous, both limits, light sensor
+  const std::vector<uint8_t> reply = {0x1d, 30, 20, 0x03, 0xe8, 28, 0x30};
+  AM43Core::SettingsInfo settings;
+  CHECK(AM43Core::DecodeSettings(reply.data(), reply.size(), settings));
+  CHECK_EQ(settings.Dir, 1);
+  CHECK_EQ(settings.Mode, 0);
+  CHECK(settings.TopLimit && settings.BottomLimit && settings.LightSensor);
+  CHECK_EQ(settings.Speed, 30);
+  CHECK_EQ(settings.Position, 20);
+  CHECK_EQ(settings.Length, 1000);
+  CHECK_EQ(settings.Diameter, 28);
+  CHECK_EQ(settings.Type, 3);
+  CHECK(!AM43Core::DecodeSettings(reply.data(), reply.size() - 1, settings));
+
+  // Reply layout round trips
+  uint8_t buff[AM43Core::SettingsSize];
+  CHECK_EQ(AM43Core::EncodeSettings(buff, sizeof(buff), settings), AM43Core::SettingsSize);
+  CHECK(std::vector<uint8_t>(buff, buff + sizeof(buff)) == reply);
+  CHECK_EQ(AM43Core::EncodeSettings(buff, sizeof(buff) - 1, settings), 0);
+
+  // Request has direction, mode and type in head byte, no position
+  settings.Mode = 1;
+  CHECK_EQ(AM43Core::EncodeSettingsRequest(buff, sizeof(buff), settings), AM43Core::SettingsRequestSize);
+  const std::vector<uint8_t> request = {0x36, 30, 0, 0x03, 0xe8, 28};
+  CHECK(std::vector<uint8_t>(buff, buff + AM43Core::SettingsRequestSize) == request);
+  CHECK_EQ(AM43Core::EncodeSettingsRequest(buff, AM43Core::SettingsRequestSize - 1, settings), 0);
+
+  // GetSpeed reply changes its own fields only
+  const uint8_t speed[] = {0x04, 45};
+  CHECK(AM43Core::DecodeSpeed(speed, sizeof(speed), settings));
+  CHECK_EQ(settings.Speed, 45);
+  CHECK_EQ(settings.Dir, 0);
+  CHECK_EQ(settings.Mode, 1);
+  CHECK(!settings.LightSensor);
+  CHECK_EQ(settings.Position, 20);
+  CHECK_EQ(settings.Length, 1000);
+  CHECK(!AM43Core::DecodeSpeed(speed, 1, settings));
+
+  // Seasons with tags round trip
+  const std::vector<uint8_t> seasons = {0x10, 1, 0, 5, 6, 30, 21, 15, 0x11, 0, 1, 3, 8, 0, 17, 45};
+  AM43Core::SeasonInfo summer;
+  AM43Core::SeasonInfo winter;
+  uint8_t tags[2];
+  CHECK(AM43Core::DecodeSeasons(seasons.data(), seasons.size(), summer, winter, tags));
+  CHECK_EQ(tags[0], 0x10);
+  CHECK_EQ(summer.LightStartHour, 6);
+  CHECK_EQ(winter.LightEndMinute, 45);
+  uint8_t season_buff[AM43Core::SeasonsSize];
+  CHECK_EQ(AM43Core::EncodeSeasons(season_buff, sizeof(season_buff), summer, winter, tags), AM43Core::SeasonsSize);
+  CHECK(std::vector<uint8_t>(season_buff, season_buff + sizeof(season_buff)) == seasons);
+  CHECK(!AM43Core::DecodeSeasons(seasons.data(), seasons.size() - 1, summer, winter, tags));
+
+  return Test::Result("codec");
+}
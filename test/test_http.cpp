@@ -0,0 +1,89 @@
+#include "test.h"
+#include "bench.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "http.h"
+#include "scheduler.h"
+
+// Local HTTP API: latency from request arrival to SetPosition frame on UART
+
+namespace {
+FakeMcu s_mcu;
+unsigned long s_request;
+unsigned long s_position_tx;
+
+// Sketch loop pass, request arriving while loop is about to idle is the worst case
+void Pass(bool request)
+{
+  Scheduler.Run();
+  AM43.Loop();
+  if(!s_mcu.Written.empty() && s_mcu.Written.back() == static_cast<uint8_t>(AM43Class::Command::SetPosition) && s_position_tx == 0)
+  {
+    s_position_tx = Clock::Millis();
+  }
+  Http.Loop();
+  if(request)
+  {
+    ESP8266WebServer::Request(HTTP_POST, "/position", "plain", "60");
+    s_request = Clock::Millis();
+  }
+  Scheduler.Idle(s_mcu.available() > 0 || Http.HasPendingInput());
+  s_mcu.Serve();
+}
+
+void Run(unsigned long ms)
+{
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Pass(false);
+  }
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+  Http.Init();
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK(AM43.IsInitialized());
+
+  // State and validation
+  ESP8266WebServer::Request(HTTP_GET, "/state");
+  Pass(false);
+  CHECK_EQ(ESP8266WebServer::s_response.Code, 200);
+  CHECK(ESP8266WebServer::s_response.Body.find("\"position\":20") != std::string::npos);
+  ESP8266WebServer::Request(HTTP_POST, "/position", "plain", "high");
+  Pass(false);
+  CHECK_EQ(ESP8266WebServer::s_response.Code, 400);
+  ESP8266WebServer::Request(HTTP_POST, "/action", "value", "UP");
+  Pass(false);
+  CHECK_EQ(ESP8266WebServer::s_response.Code, 400);
+
+  // Requests spread over update cycle, some land while line waits for poll reply
+  std::vector<unsigned long> latencies;
+  for(int i = 0; i < 50; ++i)
+  {
+    Run(AM43_CMD_DEADLINE_MS + 37 * i % 1000);
+    s_mcu.Written.clear();
+    s_position_tx = 0;
+    Pass(true);
+    while(s_position_tx == 0 && Clock::Millis() - s_request < 1000)
+    {
+      Pass(false);
+    }
+    CHECK_EQ(ESP8266WebServer::s_response.Code, 204);
+    CHECK(s_position_tx != 0);
+    latencies.push_back(s_position_tx - s_request);
+  }
+
+  const unsigned long p50 = Bench::Percentile(latencies, 50);
+  const unsigned long worst = Bench::Percentile(latencies, 100);
+  Bench::Report("http", "request to UART p50", p50, "ms");
+  Bench::Report("http", "request to UART max", worst, "ms");
+  // Waiting request wakes loop, only the pass which queues the frame may sleep
+  CHECK(p50 <= SCHED_IDLE_MAX_MS);
+  CHECK(worst <= AM43_TX_REPLY_WAIT_MS + 2 * SCHED_IDLE_MAX_MS);
+
+  return Test::Result("http");
+}
@@ -0,0 +1,75 @@
+#include "test.h"
+#include "am43.h"
+
+// Light level EMA filter with hysteresis around level boundaries
+
+namespace {
+void Sample(uint8_t level)
+{
+  const uint8_t data[] = {0x00, level};
+  AM43Core::Frame frame;
+  frame.Cmd = static_cast<uint8_t>(AM43Class::Command::GetLightLevel);
+  frame.Len = sizeof(data);
+  frame.Data = data;
+  frame.Checksum = 0;
+  frame.CalculatedChecksum = 0;
+  AM43.OnFrame(frame);
+}
+
+// Samples until filtered level reaches level, 0 if it doesn't within limit
+int SamplesUntil(uint8_t raw, uint8_t level, int limit)
+{
+  for(int i = 1; i <= limit; ++i)
+  {
+    Sample(raw);
+    if(AM43.GetLightLevelFiltered() == level)
+    {
+      return i;
+    }
+  }
+  return 0;
+}
+}
+
+int main()
+{
+  // First sample is taken as is
+  Sample(2);
+  CHECK_EQ(AM43.GetLightLevelFiltered(), 2);
+
+  // Raw level flapping between neighbours stays on one filtered level
+  for(int i = 0; i < 40; ++i)
+  {
+    Sample(i % 2 == 0 ? 3 : 2);
+  }
+  Sample(2);
+  const uint8_t settled = AM43.GetLightLevelFiltered();
+  CHECK(settled == 2 || settled == 3);
+  for(int i = 0; i < 40; ++i)
+  {
+    Sample(i % 2 == 0 ? 3 : 2);
+    CHECK_EQ(AM43.GetLightLevelFiltered(), settled);
+  }
+
+  // Step by one level is followed within few samples, filter ends exactly on raw level
+  CHECK(SamplesUntil(3, 3, 6) > 0);
+  for(int i = 0; i < 20; ++i)
+  {
+    Sample(3);
+  }
+  CHECK_EQ(AM43.GetLightLevelFiltered(), 3);
+
+  // Large step moves filtered level on second sample and settles on raw level
+  const int first_move = SamplesUntil(0, 2, 3);
+  CHECK(first_move > 0 && first_move <= 2);
+  CHECK(SamplesUntil(0, 0, 20) > 0);
+  CHECK_EQ(AM43.GetLightLevel(), 0);
+
+  // Single outlier sample is ignored
+  Sample(1);
+  CHECK_EQ(AM43.GetLightLevelFiltered(), 0);
+  Sample(0);
+  CHECK_EQ(AM43.GetLightLevelFiltered(), 0);
+
+  return Test::Result("light");
+}
@@ -0,0 +1,123 @@
+#include "test.h"
+#include "clock.h"
+#include "am43_core.h"
+
+#include <string>
+#include <vector>
+
+// Non-blocking UART link: bursts end on idle line, cut frames are completed
+
+namespace {
+struct Received
+{
+  uint8_t Cmd;
+  std::vector<uint8_t> Data;
+  bool Valid;
+};
+
+struct Sink
+{
+  void OnFrame(const AM43Core::Frame& frame)
+  {
+    Frames.push_back(Received{frame.Cmd, std::vector<uint8_t>(frame.Data, frame.Data + frame.Len), frame.IsValid()});
+  }
+
+  std::vector<Received> Frames;
+};
+
+struct Transport
+{
+  std::string* In;
+
+  int Available() { return In->size(); }
+  int Read() { const int c = static_cast<uint8_t>((*In)[0]); In->erase(0, 1); return c; }
+  void Write(const uint8_t*, unsigned int) {}
+};
+
+struct HostClock
+{
+  static unsigned long Millis() { return Clock::Millis(); }
+};
+
+const unsigned int s_recv_n = 20;
+const unsigned long s_idle_ms = 20;
+
+std::string Frame(uint8_t cmd, const std::vector<uint8_t>& data)
+{
+  std::string frame;
+  frame.push_back(static_cast<char>(0x9a));
+  frame.push_back(static_cast<char>(cmd));
+  frame.push_back(static_cast<char>(data.size()));
+  frame.append(data.begin(), data.end());
+
+  uint8_t checksum = 0;
+  for(const char c : frame)
+  {
+    checksum ^= static_cast<uint8_t>(c);
+  }
+  frame.push_back(static_cast<char>(checksum));
+  return frame;
+}
+}
+
+int main()
+{
+  Sink sink;
+  std::string in;
+  AM43Core::Link<Transport, HostClock, Sink, s_recv_n, s_idle_ms> link(sink);
+  link.Begin(Transport{&in});
+
+  // Bytes trickle in, Poll never waits and frame is handled once line is idle
+  const std::string reply = Frame(0xaa, {0x00, 0x03});
+  for(const char c : reply)
+  {
+    in.push_back(c);
+    CHECK(!link.Poll());
+    CHECK(link.IsReceiving());
+    Clock::Advance(2);
+  }
+  CHECK(sink.Frames.empty());
+  Clock::Advance(s_idle_ms);
+  CHECK(link.Poll());
+  CHECK(!link.IsReceiving());
+  CHECK_EQ(sink.Frames.size(), 1);
+  CHECK_EQ(sink.Frames[0].Cmd, 0xaa);
+  CHECK(sink.Frames[0].Valid);
+  CHECK(sink.Frames[0].Data == std::vector<uint8_t>({0x00, 0x03}));
+
+  // Burst of two frames with line noise in front
+  sink.Frames.clear();
+  in = std::string("\x00\x11", 2) + Frame(0xa2, {0, 0, 0, 0, 87}) + Frame(0xa1, {0, 40});
+  CHECK(!link.Poll());
+  Clock::Advance(s_idle_ms);
+  CHECK(link.Poll());
+  CHECK_EQ(sink.Frames.size(), 2);
+  CHECK_EQ(sink.Frames[0].Cmd, 0xa2);
+  CHECK_EQ(sink.Frames[1].Cmd, 0xa1);
+
+  // Corrupted checksum is passed to sink marked as invalid
+  sink.Frames.clear();
+  in = Frame(0xa1, {0, 40});
+  in.back() ^= 0x01;
+  link.Poll();
+  Clock::Advance(s_idle_ms);
+  CHECK(link.Poll());
+  CHECK(sink.Frames.size() == 1 && !sink.Frames[0].Valid);
+
+  // Full buffer is handled at once, frame cut by it is completed by next bytes
+  sink.Frames.clear();
+  const std::string first = Frame(0xa7, {0x1d, 30, 40, 0x03, 0xe8, 30, 0x30});
+  const std::string second = Frame(0xa1, {0, 41});
+  in = first + first + second;
+  CHECK(link.Poll());
+  CHECK_EQ(sink.Frames.size(), 1);
+  CHECK_EQ(sink.Frames[0].Cmd, 0xa7);
+  CHECK(!link.Poll());
+  Clock::Advance(s_idle_ms);
+  CHECK(link.Poll());
+  CHECK_EQ(sink.Frames.size(), 3);
+  CHECK(sink.Frames[1].Cmd == 0xa7 && sink.Frames[1].Valid && sink.Frames[1].Data[2] == 40);
+  CHECK(sink.Frames[2].Cmd == 0xa1 && sink.Frames[2].Valid && sink.Frames[2].Data[1] == 41);
+
+  return Test::Result("link");
+}
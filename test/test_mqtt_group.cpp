@@ -0,0 +1,111 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "mqtt.h"
+#include "scheduler.h"
+
+#include <string>
+
+// Group and scene topics queue MCU commands, topic arena fits long names
+
+namespace {
+FakeMcu s_mcu;
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+
+const std::string s_topic = "home/first-floor/living-room/window-left/blinds/am43-4f2a";
+const std::string s_group = "home/first-floor/living-room/all-windows/blinds";
+
+std::vector<FakeMcu::Request> Run(unsigned long ms)
+{
+  std::vector<FakeMcu::Request> sent;
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Clock::Advance(10);
+    Scheduler.Run();
+    AM43.Loop();
+    Mqtt.Loop();
+    for(const FakeMcu::Request& req : s_mcu.Serve())
+    {
+      sent.push_back(req);
+    }
+  }
+  return sent;
+}
+
+std::vector<FakeMcu::Request> Only(const std::vector<FakeMcu::Request>& sent, AM43Class::Command cmd)
+{
+  std::vector<FakeMcu::Request> only;
+  for(const FakeMcu::Request& req : sent)
+  {
+    if(req.Cmd == static_cast<uint8_t>(cmd))
+    {
+      only.push_back(req);
+    }
+  }
+  return only;
+}
+
+bool Subscribed(const std::string& topic)
+{
+  return std::find(PubSubClient::s_subscribed.begin(), PubSubClient::s_subscribed.end(), topic) != PubSubClient::s_subscribed.end();
+}
+
+void Deliver(const std::string& topic, const char* payload)
+{
+  PubSubClient::Deliver(topic.c_str(), payload);
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, s_topic.c_str(), s_group.c_str());
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK(AM43.IsInitialized());
+
+  // Every topic is formatted in full into the arena, first and last ones too
+  CHECK(Subscribed(s_topic + "/command"));
+  CHECK(Subscribed(s_topic + "/speed/set"));
+  CHECK(Subscribed(s_topic + "/scene/+"));
+  CHECK(Subscribed(s_group + "/command"));
+  CHECK(Subscribed(s_group + "/position/set"));
+  CHECK(Subscribed(s_group + "/scene"));
+  bool status = false;
+  for(const PubSubClient::Message& msg : PubSubClient::s_published)
+  {
+    status = status || msg.Topic == s_topic + "/status";
+  }
+  CHECK(status);
+
+  // Group position isn't retained, first message is taken
+  Deliver(s_group + "/position/set", "40");
+  std::vector<FakeMcu::Request> sent = Only(Run(1000), AM43Class::Command::SetPosition);
+  CHECK(sent.size() == 1 && sent[0].Data[0] == 40);
+
+  // Scene position is stored by retained config message, group and own scene topic move to it
+  Deliver(s_topic + "/scene/3", "65");
+  Deliver(s_group + "/scene", "3");
+  sent = Only(Run(1000), AM43Class::Command::SetPosition);
+  CHECK(sent.size() == 1 && sent[0].Data[0] == 65);
+
+  Deliver(s_topic + "/scene/4", "10");
+  Deliver(s_topic + "/scene", "4");
+  sent = Only(Run(1000), AM43Class::Command::SetPosition);
+  CHECK(sent.size() == 1 && sent[0].Data[0] == 10);
+
+  // Unknown or removed scene doesn't move
+  Deliver(s_topic + "/scene/4", "");
+  Deliver(s_group + "/scene", "4");
+  Deliver(s_group + "/scene", "7");
+  CHECK(Only(Run(1000), AM43Class::Command::SetPosition).empty());
+
+  // Group command with speed profile suffix
+  Deliver(s_group + "/command", "close,fast");
+  sent = Only(Run(1000), AM43Class::Command::SendAction);
+  CHECK(!sent.empty() && sent[0].Data[0] == static_cast<uint8_t>(AM43Class::ControlAction::Close));
+
+  return Test::Result("mqtt group");
+}
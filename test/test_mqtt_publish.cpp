@@ -0,0 +1,96 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "mqtt.h"
+#include "scheduler.h"
+
+// Status is published periodically, settings only when they change or after reconnect
+
+namespace {
+FakeMcu s_mcu;
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+
+void Run(unsigned long ms)
+{
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Clock::Advance(10);
+    Scheduler.Run();
+    AM43.Loop();
+    Mqtt.Loop();
+    s_mcu.Serve();
+  }
+}
+
+int Published(const char* topic)
+{
+  int n = 0;
+  for(const PubSubClient::Message& msg : PubSubClient::s_published)
+  {
+    n += msg.Topic == topic;
+  }
+  return n;
+}
+
+std::string Last(const char* topic)
+{
+  std::string payload;
+  for(const PubSubClient::Message& msg : PubSubClient::s_published)
+  {
+    if(msg.Topic == topic)
+    {
+      payload = msg.Payload;
+    }
+  }
+  return payload;
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, "blinds/am43", nullptr);
+
+  Run(5 * MQTT_PUBLISH_MS);
+  CHECK(AM43.IsInitialized());
+  CHECK(Published("blinds/am43/status") >= 5);
+  CHECK_EQ(Published("blinds/am43/settings"), 1);
+
+  // Every timer is registered
+  CHECK(Last("blinds/am43/scheduler").find("\"failed\":0}") != std::string::npos);
+
+  // Broker data waiting in socket keeps loop awake
+  CHECK(!Mqtt.HasPendingInput());
+  WiFiClient::s_available = 2;
+  CHECK(Mqtt.HasPendingInput());
+  WiFiClient::s_available = 0;
+
+  // Node without group subscribes to its own topics only
+  CHECK(!PubSubClient::s_subscribed.empty());
+  for(const std::string& topic : PubSubClient::s_subscribed)
+  {
+    CHECK(topic.compare(0, 12, "blinds/am43/") == 0);
+  }
+
+  // Speed changed on MCU side
+  s_mcu.Speed = 25;
+  Run(2 * AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK_EQ(AM43.GetDeviceSettings().Speed, 25);
+  CHECK_EQ(Published("blinds/am43/settings"), 2);
+
+  // Broker connection drop
+  PubSubClient::s_accept = false;
+  Run(1000);
+  PubSubClient::s_accept = true;
+  Run(2 * MQTT_RECONN_MS + 2 * MQTT_RECONN_JITTER_MS);
+  CHECK(Mqtt.IsOk());
+  CHECK_EQ(Published("blinds/am43/settings"), 3);
+
+  Run(2 * MQTT_PUBLISH_MS);
+  CHECK_EQ(Published("blinds/am43/settings"), 3);
+
+  return Test::Result("mqtt publish");
+}
@@ -0,0 +1,78 @@
+#include "test.h"
+#include "mqtt.h"
+#include "scheduler.h"
+
+// MQTT reconnect backoff with jitter while broker is down
+
+namespace {
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+
+// Run loop until clock passes until_ms, returns connect attempt times
+std::vector<unsigned long> Run(unsigned long until_ms)
+{
+  std::vector<unsigned long> attempts;
+  int connects = PubSubClient::s_connects;
+  while(Clock::Millis() < until_ms)
+  {
+    Scheduler.Run();
+    Mqtt.Loop();
+    if(PubSubClient::s_connects != connects)
+    {
+      connects = PubSubClient::s_connects;
+      attempts.push_back(Clock::Millis());
+    }
+    Scheduler.Idle(false);
+  }
+  return attempts;
+}
+}
+
+int main()
+{
+  PubSubClient::s_accept = false;
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, "blinds/am43", nullptr);
+
+  // Broker is down for an hour
+  const std::vector<unsigned long> attempts = Run(3600000);
+  CHECK(attempts.size() > 8);
+  CHECK_EQ(attempts[0], 0);
+
+  // Every gap at least doubles until backoff limit, jitter spreads nodes apart
+  bool spread = false;
+  for(size_t i = 2; i < attempts.size(); ++i)
+  {
+    const unsigned long prev = attempts[i - 1] - attempts[i - 2];
+    const unsigned long gap = attempts[i] - attempts[i - 1];
+    CHECK(gap >= min(2 * prev, (unsigned long)MQTT_RECONN_MAX_MS));
+    CHECK(gap < MQTT_RECONN_MAX_MS + MQTT_RECONN_JITTER_MS);
+    if(gap < MQTT_RECONN_MAX_MS && gap - 2 * prev != attempts[2] - attempts[1] - 2 * (attempts[1] - attempts[0]))
+    {
+      spread = true;
+    }
+  }
+  CHECK(spread);
+
+  // Broker is back, node connects on next attempt at the latest
+  PubSubClient::s_accept = true;
+  const unsigned long back = Clock::Millis();
+  std::vector<unsigned long> reconnects = Run(back + MQTT_RECONN_MAX_MS + MQTT_RECONN_JITTER_MS);
+  CHECK_EQ(reconnects.size(), 1);
+  CHECK(Mqtt.IsOk());
+
+  // Connected node sleeps between publish timer runs
+  const unsigned long idle = Scheduler.GetIdleTime();
+  const unsigned long connected = Clock::Millis();
+  CHECK(Run(connected + MQTT_PUBLISH_MS).empty());
+  CHECK(Scheduler.GetIdleTime() - idle >= MQTT_PUBLISH_MS * 9 / 10);
+
+  // Connection drop is retried soon, not after backoff of previous outage
+  PubSubClient::s_accept = false;
+  const unsigned long dropped = Clock::Millis();
+  reconnects = Run(dropped + MQTT_RECONN_MS + MQTT_RECONN_JITTER_MS);
+  CHECK(!reconnects.empty());
+  CHECK(reconnects.empty() || reconnects[0] - dropped <= MQTT_RECONN_JITTER_MS);
+
+  return Test::Result("mqtt reconnect");
+}
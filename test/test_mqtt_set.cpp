@@ -0,0 +1,76 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "mqtt.h"
+#include "scheduler.h"
+
+// Season and timing values published by device are accepted back on SET topics
+
+namespace {
+FakeMcu s_mcu;
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+
+void Run(unsigned long ms)
+{
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Clock::Advance(10);
+    Scheduler.Run();
+    AM43.Loop();
+    Mqtt.Loop();
+    s_mcu.Serve();
+  }
+}
+
+std::string Last(const char* topic)
+{
+  std::string payload;
+  for(const PubSubClient::Message& msg : PubSubClient::s_published)
+  {
+    if(msg.Topic == topic)
+    {
+      payload = msg.Payload;
+    }
+  }
+  return payload;
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, "blinds/am43", nullptr);
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK(AM43.IsInitialized());
+
+  // Zero padded hours and minutes, 08 and 09 are not octal
+  PubSubClient::Deliver("blinds/am43/season/summer/set", "1,0,4,08:09,09:08");
+  CHECK_EQ(AM43.GetSummerSeason().LightStartHour, 8);
+  CHECK_EQ(AM43.GetSummerSeason().LightStartMinute, 9);
+  CHECK_EQ(AM43.GetSummerSeason().LightEndHour, 9);
+  CHECK_EQ(AM43.GetSummerSeason().LightEndMinute, 8);
+
+  // Published summer season is written back as winter season
+  Run(MQTT_PUBLISH_FAST_MS * 2);
+  const std::string summer = Last("blinds/am43/season/summer");
+  CHECK(summer == "1,0,4,08:09,09:08");
+  PubSubClient::Deliver("blinds/am43/season/winter/set", summer.c_str());
+  CHECK(memcmp(&AM43.GetWinterSeason(), &AM43.GetSummerSeason(), sizeof(AM43Class::SeasonInfo)) == 0);
+
+  // Published timing slot is written back to another slot
+  PubSubClient::Deliver("blinds/am43/timing/set", "2:1,80,62,08:09");
+  CHECK_EQ(AM43.GetTiming(2).Position, 80);
+  CHECK_EQ(AM43.GetTiming(2).Hour, 8);
+  CHECK_EQ(AM43.GetTiming(2).Minute, 9);
+  Run(MQTT_PUBLISH_FAST_MS * 2);
+  const std::string timing = Last("blinds/am43/timing");
+  const size_t slot = timing.find("1,80,62,08:09");
+  CHECK(slot != std::string::npos);
+  PubSubClient::Deliver("blinds/am43/timing/set", ("3:" + timing.substr(slot, timing.find(';', slot) - slot)).c_str());
+  CHECK(memcmp(&AM43.GetTiming(3), &AM43.GetTiming(2), sizeof(AM43Class::TimingInfo)) == 0);
+
+  return Test::Result("mqtt set");
+}
@@ -0,0 +1,118 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "multicast.h"
+
+// Multicast sequence tracking and acks
+
+namespace {
+FakeMcu s_mcu;
+const uint16_t s_group = 0x0102;
+const uint8_t s_node = 3;
+
+void Send(uint16_t group, uint16_t seq, bool ack, const std::vector<uint8_t>& entries)
+{
+  std::vector<uint8_t> packet =
+  {
+    MULTICAST_MAGIC, MULTICAST_VERSION,
+    static_cast<uint8_t>(group & 0xFF), static_cast<uint8_t>(group >> 8),
+    static_cast<uint8_t>(seq & 0xFF), static_cast<uint8_t>(seq >> 8),
+    static_cast<uint8_t>(ack ? MulticastClass::Flag::AckRequest : 0),
+    static_cast<uint8_t>(entries.size() / 3)
+  };
+  packet.insert(packet.end(), entries.begin(), entries.end());
+  WiFiUDP::s_received.push_back(packet);
+  Multicast.Loop();
+}
+
+void Position(uint16_t seq, uint8_t node, uint8_t position, bool ack = true)
+{
+  Send(s_group, seq, ack, {node, static_cast<uint8_t>(MulticastClass::Op::Position), position});
+}
+
+size_t Acks()
+{
+  return WiFiUDP::s_sent.size();
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+  Multicast.Init(s_group, s_node);
+
+  // Applied and acked
+  Position(10, s_node, 40);
+  CHECK_EQ(AM43.GetTargetPosition(), 40);
+  CHECK_EQ(Acks(), 1);
+  const std::vector<uint8_t> ack = {MULTICAST_MAGIC, MULTICAST_VERSION | 0x80, 0x02, 0x01, 10, 0, s_node};
+  CHECK(WiFiUDP::s_sent.back() == ack);
+
+  // Repeat of same sequence is acked again but not applied again
+  Clock::Advance(100);
+  Position(10, s_node, 70);
+  CHECK_EQ(AM43.GetTargetPosition(), 40);
+  CHECK_EQ(Acks(), 2);
+  CHECK(WiFiUDP::s_sent.back() == ack);
+
+  // Older sequence shortly after is a late repeat
+  Position(9, s_node, 70);
+  CHECK_EQ(AM43.GetTargetPosition(), 40);
+  CHECK_EQ(Acks(), 3);
+
+  // Entries for other nodes, other group, broken packets
+  Position(11, 4, 70);
+  CHECK_EQ(AM43.GetTargetPosition(), 40);
+  CHECK_EQ(Acks(), 3);
+  Send(0x0103, 12, true, {s_node, 0, 70});
+  WiFiUDP::s_received.push_back({MULTICAST_MAGIC, MULTICAST_VERSION, 0x02, 0x01, 12, 0, MulticastClass::Flag::AckRequest, 1, s_node, 0});
+  Multicast.Loop();
+  CHECK_EQ(AM43.GetTargetPosition(), 40);
+  CHECK_EQ(Acks(), 3);
+
+  // Broadcast entry, no ack requested
+  Position(12, MULTICAST_NODE_ALL, 50, false);
+  CHECK_EQ(AM43.GetTargetPosition(), 50);
+  CHECK_EQ(Acks(), 3);
+
+  // Action entry
+  Send(s_group, 13, true, {s_node, static_cast<uint8_t>(MulticastClass::Op::Action), static_cast<uint8_t>(AM43Class::ControlAction::Close)});
+  CHECK_EQ(AM43.GetTargetPosition(), 100);
+  CHECK_EQ(Acks(), 4);
+
+  // Sender restarts and sends frequently from sequence 1, it's accepted once
+  // last applied sequence is older than any repeat
+  Clock::Advance(MULTICAST_SEQ_RESET_MS / 2);
+  Position(1, s_node, 20);
+  CHECK_EQ(AM43.GetTargetPosition(), 100);
+  Clock::Advance(MULTICAST_SEQ_RESET_MS / 2);
+  Position(1, s_node, 20);
+  CHECK_EQ(AM43.GetTargetPosition(), 20);
+  Clock::Advance(100);
+  Position(2, s_node, 25);
+  CHECK_EQ(AM43.GetTargetPosition(), 25);
+  Position(1, s_node, 20);
+  CHECK_EQ(AM43.GetTargetPosition(), 25);
+
+  // Sequence wraps
+  Clock::Advance(MULTICAST_SEQ_RESET_MS);
+  Position(0xFFFE, s_node, 59);
+  CHECK_EQ(AM43.GetTargetPosition(), 59);
+  Position(0xFFFF, s_node, 60);
+  CHECK_EQ(AM43.GetTargetPosition(), 60);
+  Position(0x0000, s_node, 61);
+  CHECK_EQ(AM43.GetTargetPosition(), 61);
+
+  // Waiting datagram keeps loop awake and is handled by next Loop
+  CHECK(!Multicast.HasPendingInput());
+  std::vector<uint8_t> packet = {MULTICAST_MAGIC, MULTICAST_VERSION, 0x02, 0x01, 0x01, 0x00, 0, 1, s_node, 0, 62};
+  WiFiUDP::s_received.push_back(packet);
+  CHECK(Multicast.HasPendingInput());
+  CHECK(Multicast.HasPendingInput());
+  CHECK(WiFiUDP::s_received.empty());
+  Multicast.Loop();
+  CHECK_EQ(AM43.GetTargetPosition(), 62);
+  CHECK(!Multicast.HasPendingInput());
+
+  return Test::Result("multicast");
+}
@@ -0,0 +1,81 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+
+// Request ring: full/empty, wrap of free running indexes and user over poll priority
+
+namespace {
+FakeMcu s_mcu;
+
+// Run loop on virtual time and collect requests sent to MCU
+std::vector<FakeMcu::Request> Drain(unsigned long ms)
+{
+  std::vector<FakeMcu::Request> sent;
+  for(unsigned long t = 0; t < ms; t += 10)
+  {
+    Clock::Advance(10);
+    AM43.Loop();
+    for(const FakeMcu::Request& req : s_mcu.TakeRequests())
+    {
+      // User requests are confirmed, so they are not retransmitted
+      if(req.Cmd == static_cast<uint8_t>(AM43Class::Command::SetPosition))
+      {
+        s_mcu.Reply(req.Cmd, {0x5a});
+      }
+      sent.push_back(req);
+    }
+  }
+  return sent;
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+  // Polls are held back right after boot as if user request was just sent
+  Clock::Advance(AM43_TX_POLL_DEFER_MS);
+
+  // Empty ring sends nothing
+  CHECK(Drain(1000).empty());
+
+  // Ring holds AM43_TX_QUEUE_N records, indexes wrap after 256 pushes
+  for(int round = 0; round < 40; ++round)
+  {
+    for(int i = 0; i < AM43_TX_QUEUE_N; ++i)
+    {
+      const uint8_t data = round;
+      CHECK(AM43.SendRaw(0x50 + i, &data, 1));
+    }
+    CHECK(!AM43.SendRaw(0x5f, nullptr, 0));
+
+    const std::vector<FakeMcu::Request> sent = Drain(AM43_TX_QUEUE_N * (AM43_TX_REPLY_WAIT_MS + 20));
+    CHECK_EQ(sent.size(), AM43_TX_QUEUE_N);
+    for(size_t i = 0; i < sent.size(); ++i)
+    {
+      CHECK_EQ(sent[i].Cmd, 0x50 + i);
+      CHECK(sent[i].Data.size() == 1 && sent[i].Data[0] == round);
+    }
+  }
+
+  // User request queued after polls goes first, polls wait until motor starts
+  CHECK(AM43.SendRaw(0x60, nullptr, 0));
+  CHECK(AM43.SendRaw(0x61, nullptr, 0));
+  AM43.SetPosition(40);
+
+  std::vector<FakeMcu::Request> sent = Drain(AM43_TX_POLL_DEFER_MS - 100);
+  CHECK_EQ(sent.size(), 1);
+  CHECK_EQ(sent[0].Cmd, static_cast<uint8_t>(AM43Class::Command::SetPosition));
+  CHECK(sent[0].Data.size() == 1 && sent[0].Data[0] == 40);
+
+  sent = Drain(1000);
+  CHECK_EQ(sent.size(), 2);
+  CHECK_EQ(sent[0].Cmd, 0x60);
+  CHECK_EQ(sent[1].Cmd, 0x61);
+
+  // Oversized payload is refused instead of truncated
+  uint8_t big[AM43_TX_DATA_MAX + 1] = {};
+  CHECK(!AM43.SendRaw(0x62, big, sizeof(big)));
+  CHECK(Drain(1000).empty());
+
+  return Test::Result("queue");
+}
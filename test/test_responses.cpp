@@ -0,0 +1,99 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+
+// Response descriptor table: every reply reaches its decoder, short,
+// corrupted and unknown replies are dropped
+
+namespace {
+FakeMcu s_mcu;
+
+// Deliver reply as single burst
+void Feed(uint8_t cmd, const std::vector<uint8_t>& data, bool corrupt = false)
+{
+  s_mcu.Reply(cmd, data);
+  if(corrupt)
+  {
+    s_mcu.In.back() ^= 0x01;
+  }
+  AM43.Loop();
+  Clock::Advance(AM43_RECV_IDLE_MS);
+  AM43.Loop();
+  Clock::Advance(AM43_TX_GAP_MS);
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+
+  // GetSettings: limits and light sensor bits, speed, position, length, diameter, type
+  Feed(0xa7, {0x1d, 30, 42, 0x03, 0xe8, 28, 0x30});
+  const AM43Class::Settings settings = AM43.GetDeviceSettings();
+  CHECK(settings.Dir == AM43Class::Direction::Forward);
+  CHECK(settings.Mode == AM43Class::OperationMode::Continuous);
+  CHECK(AM43.IsTopLimitSet() && AM43.IsBottomLimitSet());
+  CHECK_EQ(settings.Speed, 30);
+  CHECK_EQ(AM43.GetPosition(), 42);
+  CHECK_EQ(settings.Length, 1000);
+  CHECK_EQ(settings.Diameter, 28);
+  CHECK(settings.Type == AM43Class::DeviceType::Juanlian);
+  const uint16_t rev = AM43.GetSettingsRevision();
+
+  // Same settings again don't bump revision
+  Feed(0xa7, {0x1d, 30, 43, 0x03, 0xe8, 28, 0x30});
+  CHECK_EQ(AM43.GetPosition(), 43);
+  CHECK_EQ(AM43.GetSettingsRevision(), rev);
+
+  Feed(0xa1, {0x00, 44});
+  CHECK_EQ(AM43.GetPosition(), 44);
+
+  Feed(0xa2, {0, 0, 0, 0, 87});
+  CHECK_EQ(AM43.GetBatteryLevel(), 87);
+
+  Feed(0xa3, {0x00, 25});
+  CHECK_EQ(AM43.GetDeviceSettings().Speed, 25);
+
+  Feed(0xaa, {0x00, 7});
+  CHECK_EQ(AM43.GetLightLevel(), 7);
+
+  // GetSeason: tag and 7 bytes per season
+  Feed(0xa9, {0x10, 1, 0, 5, 6, 30, 21, 15, 0x11, 0, 1, 3, 8, 0, 17, 45});
+  CHECK_EQ(AM43.GetSummerSeason().LightLevel, 5);
+  CHECK_EQ(AM43.GetSummerSeason().LightEndMinute, 15);
+  CHECK_EQ(AM43.GetWinterSeason().LightSeasonState, 1);
+  CHECK_EQ(AM43.GetWinterSeason().LightStartHour, 8);
+  CHECK_EQ(AM43.GetSettingsRevision(), rev + 1);
+
+  // GetTiming: count and 5 bytes per slot, slots not reported are off
+  Feed(0xa8, {2, 1, 100, 0x3e, 7, 30, 1, 0, 0x7f, 19, 0});
+  CHECK_EQ(AM43.GetTiming(0).Position, 100);
+  CHECK_EQ(AM43.GetTiming(0).RepeatMask, 0x3e);
+  CHECK_EQ(AM43.GetTiming(1).Hour, 19);
+  CHECK_EQ(AM43.GetTiming(2).State, 0);
+  CHECK_EQ(AM43.GetSettingsRevision(), rev + 2);
+
+  // Timing count larger than payload is ignored
+  Feed(0xa8, {3, 0, 0, 0, 0, 0});
+  CHECK_EQ(AM43.GetTiming(0).Position, 100);
+
+  // Shorter than descriptor MinLen, decoder is skipped
+  Feed(0xa2, {0, 0, 0, 10});
+  CHECK_EQ(AM43.GetBatteryLevel(), 87);
+  Feed(0xa9, {0x10, 1, 0, 9});
+  CHECK_EQ(AM43.GetSummerSeason().LightLevel, 5);
+
+  // Bad checksum
+  Feed(0xa1, {0x00, 60}, true);
+  CHECK_EQ(AM43.GetPosition(), 44);
+
+  // Empty table slots and codes outside of table
+  Feed(0xa0, {0x00, 61});
+  Feed(0xab, {0x00, 62});
+  Feed(0x21, {0x00, 63});
+  Feed(0xb1, {0x00, 64});
+  CHECK_EQ(AM43.GetPosition(), 44);
+  CHECK_EQ(AM43.GetSettingsRevision(), rev + 2);
+
+  return Test::Result("responses");
+}
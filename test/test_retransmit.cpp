@@ -0,0 +1,159 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "mqtt.h"
+#include "scheduler.h"
+
+// Unconfirmed user requests are retransmitted with backoff, then reported as failed
+
+namespace {
+FakeMcu s_mcu;
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+
+struct Sent
+{
+  unsigned long Time;
+  uint8_t Cmd;
+};
+
+std::vector<Sent> Run(unsigned long ms)
+{
+  std::vector<Sent> sent;
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Clock::Advance(10);
+    Scheduler.Run();
+    AM43.Loop();
+    Mqtt.Loop();
+    for(const FakeMcu::Request& req : s_mcu.Serve())
+    {
+      sent.push_back(Sent{Clock::Millis(), req.Cmd});
+    }
+  }
+  return sent;
+}
+
+std::vector<Sent> Only(const std::vector<Sent>& sent, AM43Class::Command cmd)
+{
+  std::vector<Sent> only;
+  for(const Sent& s : sent)
+  {
+    if(s.Cmd == static_cast<uint8_t>(cmd))
+    {
+      only.push_back(s);
+    }
+  }
+  return only;
+}
+
+int Published(const char* topic)
+{
+  int n = 0;
+  for(const PubSubClient::Message& msg : PubSubClient::s_published)
+  {
+    n += msg.Topic == topic;
+  }
+  return n;
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, "blinds/am43", nullptr);
+  Run(20000);
+  CHECK(AM43.IsInitialized());
+  CHECK(Mqtt.IsOk());
+
+  // Confirmed request is sent once
+  AM43.SetPosition(60);
+  std::vector<Sent> sent = Only(Run(AM43_CMD_DEADLINE_MS + 1000), AM43Class::Command::SetPosition);
+  CHECK_EQ(sent.size(), 1);
+  CHECK_EQ(AM43.GetFailedCount(), 0);
+
+  // MCU doesn't answer: initial send and AM43_RETRY_MAX retransmits with doubled timeouts
+  s_mcu.Silent = true;
+  const unsigned long start = Clock::Millis();
+  AM43.SetPosition(30);
+  sent = Only(Run(AM43_CMD_DEADLINE_MS - 100), AM43Class::Command::SetPosition);
+  CHECK_EQ(sent.size(), 1 + AM43_RETRY_MAX);
+  for(size_t i = 1; i < sent.size(); ++i)
+  {
+    const unsigned long gap = sent[i].Time - sent[i - 1].Time;
+    const unsigned long timeout = static_cast<unsigned long>(AM43_RETRY_MS) << (i - 1);
+    CHECK(gap >= timeout && gap <= timeout + AM43_TX_GAP_MS);
+  }
+  CHECK_EQ(AM43.GetFailedCount(), 0);
+
+  // Reported as failed at deadline, published to error topic
+  Run(200);
+  CHECK(Clock::Millis() - start >= AM43_CMD_DEADLINE_MS);
+  CHECK_EQ(AM43.GetFailedCount(), 1);
+  CHECK_EQ(AM43.GetLastFailedCommand(), static_cast<uint8_t>(AM43Class::Command::SetPosition));
+  CHECK_EQ(Published("blinds/am43/error"), 1);
+  CHECK(Only(Run(AM43_CMD_DEADLINE_MS), AM43Class::Command::SetPosition).empty());
+
+  // Failed settings write resyncs cache from MCU right away
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  AM43Class::Settings settings = AM43.GetDeviceSettings();
+  settings.Speed = 40;
+  CHECK(AM43.SetDeviceSettings(settings));
+  CHECK_EQ(AM43.GetDeviceSettings().Speed, 40);
+  sent = Run(AM43_CMD_DEADLINE_MS + AM43_UPDATE_DELAY_FAST_MS + AM43_TX_POLL_DEFER_MS);
+  CHECK_EQ(AM43.GetFailedCount(), 2);
+  CHECK(!Only(sent, AM43Class::Command::GetSettings).empty());
+  CHECK_EQ(AM43.GetDeviceSettings().Speed, 30);
+
+  // MCU answers again, action is confirmed by first send
+  s_mcu.Silent = false;
+  AM43.SendAction(AM43Class::ControlAction::Open);
+  sent = Only(Run(AM43_CMD_DEADLINE_MS + 1000), AM43Class::Command::SendAction);
+  CHECK_EQ(sent.size(), 1);
+  CHECK_EQ(AM43.GetFailedCount(), 2);
+
+  // Next user request is held until pending one is confirmed, it doesn't
+  // take over retransmit protection of unconfirmed settings write
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  s_mcu.Silent = true;
+  settings = AM43.GetDeviceSettings();
+  settings.Speed = 35;
+  CHECK(AM43.SetDeviceSettings(settings));
+  AM43.SetPosition(70);
+  sent = Run(AM43_RETRY_MS + AM43_TX_GAP_MS);
+  CHECK_EQ(Only(sent, AM43Class::Command::SetSettings).size(), 2);
+  CHECK(Only(sent, AM43Class::Command::SetPosition).empty());
+  s_mcu.Silent = false;
+  sent = Run(AM43_CMD_DEADLINE_MS);
+  const std::vector<Sent> settings_sent = Only(sent, AM43Class::Command::SetSettings);
+  const std::vector<Sent> position_sent = Only(sent, AM43Class::Command::SetPosition);
+  CHECK_EQ(settings_sent.size(), 1);
+  CHECK_EQ(position_sent.size(), 1);
+  CHECK(settings_sent.size() == 1 && position_sent.size() == 1 && settings_sent[0].Time < position_sent[0].Time);
+  CHECK_EQ(AM43.GetFailedCount(), 2);
+
+  // Verification frame confirms pending request only if it was the last frame sent
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  s_mcu.Silent = true;
+  AM43.SetPosition(10);
+  Run(AM43_RETRY_MS + AM43_TX_GAP_MS);
+  s_mcu.Reply(0x00, {0x5a});
+  Run(AM43_CMD_DEADLINE_MS);
+  CHECK_EQ(AM43.GetFailedCount(), 2);
+
+  AM43.SetPosition(90);
+  Run(100);
+  const uint8_t raw[] = {0x01};
+  CHECK(AM43.SendRaw(0x33, raw, sizeof(raw)));
+  // Raw frame goes out once polls are no longer deferred after last retransmit
+  sent = Run(AM43_CMD_DEADLINE_MS - 500);
+  CHECK_EQ(Only(sent, static_cast<AM43Class::Command>(0x33)).size(), 1);
+  s_mcu.Reply(0x00, {0x5a});
+  Run(AM43_CMD_DEADLINE_MS);
+  CHECK_EQ(AM43.GetFailedCount(), 3);
+  s_mcu.Silent = false;
+
+  return Test::Result("retransmit");
+}
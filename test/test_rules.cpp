@@ -0,0 +1,148 @@
+#include <string>
+
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "rules.h"
+#include "scheduler.h"
+#include "timeofday.h"
+
+// Rules compiler results and bytecode evaluation against polled MCU state
+
+namespace {
+FakeMcu s_mcu;
+
+// Returns positions sent to MCU
+std::vector<uint8_t> Run(unsigned long ms)
+{
+  std::vector<uint8_t> positions;
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Clock::Advance(10);
+    Scheduler.Run();
+    AM43.Loop();
+    Rules.Loop();
+    for(const FakeMcu::Request& req : s_mcu.Serve())
+    {
+      if(req.Cmd == static_cast<uint8_t>(AM43Class::Command::SetPosition))
+      {
+        positions.push_back(req.Data[0]);
+      }
+    }
+  }
+  return positions;
+}
+
+int Compile(const std::string& src)
+{
+  return Rules.Compile(src.c_str(), src.size());
+}
+
+// Light filter needs several samples to settle on new level
+#define SETTLE_MS (20 * AM43_LIGHT_SAMPLE_MS)
+}
+
+int main()
+{
+  // Compiler
+  CHECK_EQ(Compile("light>=3:close"), 1);
+  CHECK_EQ(Compile("light>=3&time=09:00-18:00:close;time=07:30:pos=40"), 2);
+  CHECK_EQ(Compile("batt<=10:open; light<=1:stop"), 2);
+  CHECK_EQ(Rules.GetRulesCount(), 2);
+  CHECK_EQ(Compile(""), 0);
+
+  // Syntax errors report failed rule number
+  CHECK_EQ(Compile("light>=3:jump"), -1);
+  CHECK_EQ(Compile("light>=3:close;dark>=3:close"), -2);
+  CHECK_EQ(Compile("light>=3:close;time=25:00:open"), -2);
+  CHECK_EQ(Compile("light>=3:close;light>=2:open;:open"), -3);
+  CHECK_EQ(Compile("light>=3:close;light>=2:open;open"), -3);
+
+  // Too many rules
+  std::string src;
+  for(int i = 0; i < RULES_N + 1; ++i)
+  {
+    src += "light>=3:close;";
+  }
+  CHECK_EQ(Compile(src), -(RULES_N + 1));
+
+  // Bytecode table overflow, rule takes 4 * 5 + 2 + 1 bytes
+  src.clear();
+  for(int i = 0; i < 5; ++i)
+  {
+    src += "time=1:0&time=2:0&time=3:0&time=4:0:open;";
+  }
+  CHECK_EQ(Compile(src), 5);
+  CHECK_EQ(Compile(src + "time=1:0&time=2:0&time=3:0&time=4:0:open"), -6);
+
+  // Source over RULES_SRC_MAX is rejected, not cut off into a different rule
+  src = std::string(RULES_SRC_MAX - 14, ' ') + "light>=3:close";
+  CHECK_EQ(Compile(src), 1);
+  src = std::string(RULES_SRC_MAX - 20, ' ') + "light>=3:close;time=10:00:open";
+  CHECK_EQ(Compile(src), -2);
+  src = "light>=3:close;light>=2:pos=" + std::string(RULES_SRC_MAX, '1');
+  CHECK_EQ(Compile(src), -2);
+
+  // Evaluation
+  AM43.Init(&s_mcu);
+  s_mcu.Light = 1;
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK(AM43.IsInitialized());
+  CHECK_EQ(AM43.GetLightLevelFiltered(), 1);
+
+  // Rule fires once when condition becomes true
+  CHECK_EQ(Compile("light>=3:pos=40"), 1);
+  CHECK(Run(SETTLE_MS).empty());
+  s_mcu.Light = 4;
+  std::vector<uint8_t> positions = Run(SETTLE_MS);
+  CHECK_EQ(positions.size(), 1);
+  CHECK(positions.size() == 1 && positions[0] == 40);
+  CHECK(Run(SETTLE_MS).empty());
+
+  // Re-armed only after level moves back past hysteresis
+  s_mcu.Light = 2;
+  CHECK(Run(SETTLE_MS).empty());
+  s_mcu.Light = 4;
+  CHECK(Run(SETTLE_MS).empty());
+  s_mcu.Light = 1;
+  CHECK(Run(SETTLE_MS).empty());
+  s_mcu.Light = 4;
+  CHECK_EQ(Run(SETTLE_MS).size(), 1);
+
+  // Rule which is already true at upload doesn't fire
+  CHECK_EQ(Compile("light>=3:pos=60"), 1);
+  CHECK(Run(SETTLE_MS).empty());
+
+  // Failed compile keeps active rules
+  s_mcu.Light = 0;
+  Run(SETTLE_MS);
+  CHECK_EQ(Compile("light>=3:pos=70;light>=3:jump"), -2);
+  CHECK_EQ(Compile(std::string(RULES_SRC_MAX + 1, ' ')), -1);
+  CHECK_EQ(Rules.GetRulesCount(), 1);
+  s_mcu.Light = 4;
+  positions = Run(SETTLE_MS);
+  CHECK(positions.size() == 1 && positions[0] == 60);
+
+  // All conditions must be met, time window around current local time
+  const int minute = GetMinuteOfDay();
+  CHECK(minute >= 0);
+  char rule[64];
+  snprintf(rule, sizeof(rule), "light<=1&time=%02d:%02d-%02d:%02d:pos=30",
+    (minute + 120) / 60 % 24, (minute + 120) % 60, (minute + 180) / 60 % 24, (minute + 180) % 60);
+  CHECK_EQ(Compile(std::string(rule) + ";" + rule), 2);
+  CHECK(Run(SETTLE_MS).empty());
+  s_mcu.Light = 0;
+  CHECK(Run(SETTLE_MS).empty());
+
+  snprintf(rule, sizeof(rule), "light<=1&time=%02d:%02d-%02d:%02d:pos=20",
+    (minute + 1439) / 60 % 24, (minute + 1439) % 60, (minute + 2) / 60 % 24, (minute + 2) % 60);
+  s_mcu.Light = 4;
+  Run(SETTLE_MS);
+  CHECK_EQ(Compile(rule), 1);
+  s_mcu.Light = 0;
+  positions = Run(SETTLE_MS);
+  CHECK(positions.size() == 1 && positions[0] == 20);
+
+  return Test::Result("rules");
+}
@@ -0,0 +1,76 @@
+#include "test.h"
+#include "scheduler.h"
+
+// Scheduler runs on virtual clock, Idle sleeps move time forward
+
+namespace {
+int s_fast_runs = 0;
+int s_slow_runs = 0;
+int s_fast_id = -1;
+}
+
+int main()
+{
+  s_fast_id = Scheduler.Add([]() { ++s_fast_runs; }, 100);
+  const int slow_id = Scheduler.Add([]() { ++s_slow_runs; }, 1000);
+  const int stopped_id = Scheduler.Add([]() { CHECK(false); }, 50, false);
+  CHECK(s_fast_id >= 0 && slow_id >= 0 && stopped_id >= 0);
+  CHECK(!Scheduler.IsActive(stopped_id));
+
+  // Next deadline is capped, so UART and network are polled often enough
+  CHECK_EQ(Scheduler.GetNextDeadline(), SCHED_IDLE_MAX_MS);
+
+  // Busy loop never sleeps
+  Scheduler.Idle(true);
+  CHECK_EQ(Clock::Millis(), 0);
+
+  // One simulated second of idle loop passes
+  while(Clock::Millis() < 1000)
+  {
+    Scheduler.Run();
+    Scheduler.Idle(false);
+  }
+  Scheduler.Run();
+  CHECK_EQ(s_fast_runs, 10);
+  CHECK_EQ(s_slow_runs, 1);
+  CHECK_EQ(Scheduler.GetIdleTime(), 1000);
+  CHECK_EQ(Scheduler.GetLateMax(), 0);
+
+  // Late loop pass is recorded
+  Clock::Advance(130);
+  Scheduler.Run();
+  CHECK_EQ(Scheduler.GetLateMax(), 30);
+
+  // Stopped timer doesn't run, restart counts period from now
+  Scheduler.Stop(s_fast_id);
+  Clock::Advance(500);
+  Scheduler.Run();
+  CHECK_EQ(s_fast_runs, 11);
+  Scheduler.Restart(s_fast_id);
+  Clock::Advance(99);
+  Scheduler.Run();
+  CHECK_EQ(s_fast_runs, 11);
+  Clock::Advance(1);
+  Scheduler.Run();
+  CHECK_EQ(s_fast_runs, 12);
+
+  // New period applies from previous run
+  Scheduler.SetPeriod(s_fast_id, 300);
+  Clock::Advance(200);
+  Scheduler.Run();
+  CHECK_EQ(s_fast_runs, 12);
+  Clock::Advance(100);
+  Scheduler.Run();
+  CHECK_EQ(s_fast_runs, 13);
+
+  // Full table refuses timer and counts it
+  CHECK_EQ(Scheduler.GetAddFailed(), 0);
+  for(int i = 3; i < SCHED_TIMERS_N; ++i)
+  {
+    CHECK(Scheduler.Add([]() {}, 100) >= 0);
+  }
+  CHECK_EQ(Scheduler.Add([]() {}, 100), -1);
+  CHECK_EQ(Scheduler.GetAddFailed(), 1);
+
+  return Test::Result("scheduler");
+}
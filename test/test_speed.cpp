@@ -0,0 +1,97 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "mqtt.h"
+#include "speed.h"
+#include "scheduler.h"
+
+// Speed profile switch writes speed only and waits for MCU settings
+
+namespace {
+FakeMcu s_mcu;
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+
+std::vector<FakeMcu::Request> Run(unsigned long ms)
+{
+  std::vector<FakeMcu::Request> sent;
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Clock::Advance(10);
+    Scheduler.Run();
+    AM43.Loop();
+    Mqtt.Loop();
+    for(const FakeMcu::Request& req : s_mcu.Serve())
+    {
+      sent.push_back(req);
+    }
+  }
+  return sent;
+}
+
+std::vector<FakeMcu::Request> Only(const std::vector<FakeMcu::Request>& sent, AM43Class::Command cmd)
+{
+  std::vector<FakeMcu::Request> only;
+  for(const FakeMcu::Request& req : sent)
+  {
+    if(req.Cmd == static_cast<uint8_t>(cmd))
+    {
+      only.push_back(req);
+    }
+  }
+  return only;
+}
+}
+
+int main()
+{
+  SpeedProfiles.SetProfileSpeed(SpeedProfilesClass::Profile::Fast, 60);
+  AM43.Init(&s_mcu);
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, "blinds/am43", nullptr);
+
+  // Device speed isn't known yet, nothing is written
+  SpeedProfiles.Select(SpeedProfilesClass::Profile::Fast);
+  CHECK(SpeedProfiles.GetProfile() == SpeedProfilesClass::Profile::Normal);
+  std::vector<FakeMcu::Request> sent = Run(AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK(AM43.IsInitialized());
+  CHECK(Only(sent, AM43Class::Command::SetSettings).empty());
+
+  // Only speed differs from settings read from MCU
+  const AM43Class::Settings before = AM43.GetDeviceSettings();
+  SpeedProfiles.Select(SpeedProfilesClass::Profile::Fast);
+  CHECK(SpeedProfiles.GetProfile() == SpeedProfilesClass::Profile::Fast);
+  const AM43Class::Settings after = AM43.GetDeviceSettings();
+  CHECK_EQ(after.Speed, 60);
+  CHECK(after.Dir == before.Dir);
+  CHECK(after.Mode == before.Mode);
+  CHECK_EQ(after.Length, before.Length);
+  CHECK_EQ(after.Diameter, before.Diameter);
+  CHECK(after.Type == before.Type);
+  sent = Only(Run(AM43_UPDATE_DELAY_FAST_MS), AM43Class::Command::SetSettings);
+  CHECK_EQ(sent.size(), 1);
+  CHECK(sent.size() == 1 && sent[0].Data.size() == 6 && sent[0].Data[1] == 60);
+  CHECK(sent.size() == 1 && sent[0].Data.size() == 6 && sent[0].Data[3] == 0x03 && sent[0].Data[4] == 0xe8 && sent[0].Data[5] == 28);
+
+  // Normal profile restores speed captured from device
+  SpeedProfiles.Select(SpeedProfilesClass::Profile::Normal);
+  CHECK(SpeedProfiles.GetProfile() == SpeedProfilesClass::Profile::Normal);
+  CHECK_EQ(AM43.GetDeviceSettings().Speed, s_mcu.Speed);
+  Run(AM43_UPDATE_DELAY_FAST_MS);
+
+  // Profile without command is ignored, empty command matched every keyword
+  PubSubClient::Deliver("blinds/am43/command", ",fast");
+  sent = Run(AM43_UPDATE_DELAY_FAST_MS);
+  CHECK(Only(sent, AM43Class::Command::SendAction).empty());
+  CHECK(Only(sent, AM43Class::Command::SetSettings).empty());
+  CHECK(SpeedProfiles.GetProfile() == SpeedProfilesClass::Profile::Normal);
+
+  PubSubClient::Deliver("blinds/am43/command", "open,fast");
+  sent = Run(AM43_UPDATE_DELAY_FAST_MS);
+  CHECK_EQ(Only(sent, AM43Class::Command::SetSettings).size(), 1);
+  CHECK(!Only(sent, AM43Class::Command::SendAction).empty());
+  CHECK(SpeedProfiles.GetProfile() == SpeedProfilesClass::Profile::Fast);
+
+  return Test::Result("speed");
+}
@@ -0,0 +1,99 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "scheduler.h"
+
+// Timings are read before first write, MCU clock is synced periodically
+
+namespace {
+FakeMcu s_mcu;
+
+std::vector<FakeMcu::Request> Run(unsigned long ms)
+{
+  std::vector<FakeMcu::Request> sent;
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Clock::Advance(10);
+    Scheduler.Run();
+    AM43.Loop();
+    for(const FakeMcu::Request& req : s_mcu.Serve())
+    {
+      sent.push_back(req);
+    }
+  }
+  return sent;
+}
+
+std::vector<FakeMcu::Request> Only(const std::vector<FakeMcu::Request>& sent, AM43Class::Command cmd)
+{
+  std::vector<FakeMcu::Request> only;
+  for(const FakeMcu::Request& req : sent)
+  {
+    if(req.Cmd == static_cast<uint8_t>(cmd))
+    {
+      only.push_back(req);
+    }
+  }
+  return only;
+}
+}
+
+int main()
+{
+  AM43.Init(&s_mcu);
+
+  // Nothing is known about MCU slots yet, write would erase them
+  AM43Class::TimingInfo timing = {1, 0, 0x41, 9, 15};
+  CHECK(!AM43.SetTiming(2, timing));
+
+  std::vector<FakeMcu::Request> sent = Run(AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK(AM43.IsInitialized());
+  CHECK_EQ(Only(sent, AM43Class::Command::GetTiming).size(), 1);
+  CHECK_EQ(AM43.GetTiming(0).Position, 100);
+  CHECK_EQ(AM43.GetTiming(1).Hour, 19);
+
+  // Clock is set once local time is valid
+  std::vector<FakeMcu::Request> time_sent = Only(sent, AM43Class::Command::SetTime);
+  CHECK_EQ(time_sent.size(), 1);
+  CHECK(time_sent.size() == 1 && time_sent[0].Data.size() == sizeof(AM43Class::TimeInfo));
+  CHECK(time_sent.size() == 1 && time_sent[0].Data[0] < 7 && time_sent[0].Data[1] < 24 && time_sent[0].Data[2] < 60);
+
+  // Write keeps slots reported by MCU
+  CHECK(AM43.SetTiming(2, timing));
+  sent = Only(Run(AM43_UPDATE_DELAY_SLOW_MS), AM43Class::Command::SetTiming);
+  CHECK_EQ(sent.size(), 1);
+  const std::vector<uint8_t> expected = {AM43_TIMINGS_N, 1, 100, 0x3e, 7, 30, 1, 0, 0x7f, 19, 0, 1, 0, 0x41, 9, 15, 0, 0, 0, 0, 0};
+  CHECK(sent.size() == 1 && sent[0].Data == expected);
+
+  // Timings are not polled again, clock is resynced every AM43_TIME_SYNC_MS
+  sent = Run(AM43_TIME_SYNC_MS - 3 * AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK(Only(sent, AM43Class::Command::GetTiming).empty());
+  CHECK(Only(sent, AM43Class::Command::SetTime).empty());
+  sent = Run(3 * AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK_EQ(Only(sent, AM43Class::Command::SetTime).size(), 1);
+
+  // Failed timing write invalidates cache, it's read back before next write
+  s_mcu.Silent = true;
+  timing.Hour = 10;
+  CHECK(AM43.SetTiming(2, timing));
+  sent = Run(AM43_CMD_DEADLINE_MS + AM43_TX_GAP_MS);
+  CHECK_EQ(AM43.GetFailedCount(), 1);
+  s_mcu.Silent = false;
+  for(const FakeMcu::Request& req : Run(AM43_UPDATE_DELAY_SLOW_MS))
+  {
+    sent.push_back(req);
+  }
+  CHECK_EQ(Only(sent, AM43Class::Command::GetTiming).size(), 1);
+  CHECK_EQ(AM43.GetTiming(2).State, 0);
+  CHECK(AM43.SetTiming(2, timing));
+
+  // Failed clock write is retried on next update cycle
+  s_mcu.Silent = true;
+  sent = Run(AM43_TIME_SYNC_MS);
+  s_mcu.Silent = false;
+  sent = Run(2 * AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK_EQ(Only(sent, AM43Class::Command::SetTime).size(), 1);
+
+  return Test::Result("timing");
+}
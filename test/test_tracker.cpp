@@ -0,0 +1,170 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "mqtt.h"
+#include "scheduler.h"
+
+#include <string>
+
+// Move tracking on virtual clock: arrival, stall, overrun of travel
+// estimate, and operation published over MQTT
+
+namespace {
+struct HostClock
+{
+  static unsigned long Millis() { return Clock::Millis(); }
+};
+
+const unsigned long s_stall_ms = 5000;
+typedef AM43Core::Tracker<HostClock, s_stall_ms, 1> Tracker;
+
+FakeMcu s_mcu;
+char s_name[] = "am43";
+char s_user[] = "";
+char s_pass[] = "";
+
+void Run(unsigned long ms)
+{
+  const unsigned long until = Clock::Millis() + ms;
+  while(Clock::Millis() < until)
+  {
+    Clock::Advance(10);
+    Scheduler.Run();
+    AM43.Loop();
+    Mqtt.Loop();
+    s_mcu.Serve();
+  }
+}
+
+// State changes published since index, periodic state publish repeats them
+std::vector<std::string> States(size_t from)
+{
+  std::vector<std::string> states;
+  for(size_t i = from; i < PubSubClient::s_published.size(); ++i)
+  {
+    if(PubSubClient::s_published[i].Topic == "blinds/am43/state" &&
+      (states.empty() || states.back() != PubSubClient::s_published[i].Payload))
+    {
+      states.push_back(PubSubClient::s_published[i].Payload);
+    }
+  }
+  return states;
+}
+}
+
+int main()
+{
+  Tracker tracker;
+  CHECK(!tracker.IsMoving());
+  CHECK(!tracker.Update(0));
+
+  // Arrival within Tolerance, direction follows target
+  tracker.Start(50, 20000);
+  CHECK(tracker.GetOperation() == AM43Core::Operation::Closing);
+  Clock::Advance(1000);
+  CHECK(!tracker.Update(30));
+  CHECK(!tracker.Update(48));
+  CHECK(tracker.Update(49));
+  CHECK(!tracker.IsMoving());
+  CHECK(!tracker.IsStalled());
+  CHECK_EQ(tracker.GetStallCount(), 0);
+
+  tracker.Start(10, 20000);
+  CHECK(tracker.GetOperation() == AM43Core::Operation::Opening);
+  CHECK(tracker.Update(11));
+
+  // Target within Tolerance of current position is not a move
+  tracker.Start(12, 20000);
+  CHECK(!tracker.IsMoving());
+
+  // Stall once position doesn't change for StallMs
+  tracker.Start(90, 20000);
+  Clock::Advance(s_stall_ms - 10);
+  CHECK(!tracker.Update(11));
+  Clock::Advance(10);
+  CHECK(tracker.Update(11));
+  CHECK(tracker.IsStalled());
+  CHECK_EQ(tracker.GetStallCount(), 1);
+  CHECK_EQ(tracker.GetTarget(), 90);
+
+  // Progress resets stall timer
+  tracker.Start(90, 20000);
+  CHECK(!tracker.IsStalled());
+  for(uint8_t pos = 12; pos < 16; ++pos)
+  {
+    Clock::Advance(s_stall_ms - 10);
+    CHECK(!tracker.Update(pos));
+  }
+  CHECK(tracker.IsMoving());
+
+  // Overrun, still moving but slower than 2 * expected + StallMs
+  // 70% of 10 s travel is expected to take 7 s
+  tracker.Start(85, 10000);
+  const unsigned long overrun_ms = 2 * 7000 + s_stall_ms;
+  uint8_t pos = 15;
+  unsigned long elapsed = 0;
+  while(elapsed + 1000 < overrun_ms)
+  {
+    Clock::Advance(1000);
+    elapsed += 1000;
+    CHECK(!tracker.Update(++pos));
+  }
+  Clock::Advance(overrun_ms - elapsed);
+  CHECK(tracker.Update(++pos));
+  CHECK(tracker.IsStalled());
+  CHECK_EQ(tracker.GetStallCount(), 2);
+
+  // Unknown travel time only stalls on missing progress
+  tracker.Start(0, 0);
+  for(int i = 0; i < 10; ++i)
+  {
+    Clock::Advance(s_stall_ms - 10);
+    CHECK(!tracker.Update(--pos));
+  }
+
+  // Stop keeps target, doesn't count as stall
+  tracker.Stop();
+  CHECK(!tracker.IsMoving());
+  CHECK(!tracker.Update(pos));
+  CHECK_EQ(tracker.GetTarget(), 0);
+  CHECK_EQ(tracker.GetStallCount(), 2);
+
+  // Firmware publishes operation and stalls
+  AM43.Init(&s_mcu);
+  Mqtt.Init(s_name, s_user, s_pass, "broker", 1883, "blinds/am43", nullptr);
+  Run(AM43_UPDATE_DELAY_SLOW_MS);
+  CHECK(AM43.IsInitialized());
+  // First position message is taken as retained one and skipped
+  PubSubClient::Deliver("blinds/am43/position/set", "50");
+
+  size_t from = PubSubClient::s_published.size();
+  PubSubClient::Deliver("blinds/am43/position/set", "80");
+  CHECK(AM43.GetOperation() == AM43Core::Operation::Closing);
+  Run(AM43_TRACK_POLL_MS * 3);
+  CHECK(AM43.GetOperation() == AM43Core::Operation::Stopped);
+  CHECK_EQ(AM43.GetPosition(), 80);
+  std::vector<std::string> states = States(from);
+  CHECK(states.size() == 2 && states[0] == "closing" && states[1] == "stopped");
+  CHECK_EQ(AM43.GetStallCount(), 0);
+
+  s_mcu.Jammed = true;
+  from = PubSubClient::s_published.size();
+  PubSubClient::Deliver("blinds/am43/position/set", "20");
+  Run(AM43_TRACK_STALL_MS - AM43_TRACK_POLL_MS);
+  CHECK(AM43.GetOperation() == AM43Core::Operation::Opening);
+  Run(AM43_TRACK_POLL_MS * 2);
+  CHECK(AM43.GetOperation() == AM43Core::Operation::Stopped);
+  CHECK_EQ(AM43.GetStallCount(), 1);
+  states = States(from);
+  CHECK(states.size() == 2 && states[0] == "opening" && states[1] == "stopped");
+  bool stall_published = false;
+  for(size_t i = from; i < PubSubClient::s_published.size(); ++i)
+  {
+    const PubSubClient::Message& msg = PubSubClient::s_published[i];
+    stall_published = stall_published ||
+      (msg.Topic == "blinds/am43/stall" && msg.Payload == "{\"position\":80,\"target\":20,\"stalls\":1}");
+  }
+  CHECK(stall_published);
+
+  return Test::Result("tracker");
+}
@@ -0,0 +1,78 @@
+#include "test.h"
+#include "fake_mcu.h"
+#include "am43.h"
+#include "battery.h"
+#include "scheduler.h"
+#include "warmstart.h"
+
+#include <FS.h>
+
+// Flash snapshot survives power loss at any point of replacement
+
+namespace {
+FakeMcu s_mcu;
+const char* s_final = "/snapshot.bin";
+const char* s_tmp = "/snapshot.tmp";
+
+void Run(unsigned long ms, int drain_per_day)
+{
+  const unsigned long start = Clock::Millis();
+  const uint8_t level = s_mcu.Battery;
+  while(Clock::Millis() - start < ms)
+  {
+    Clock::Advance(5000);
+    s_mcu.Battery = level - drain_per_day * (Clock::Millis() - start) / 86400000UL;
+    Scheduler.Run();
+    AM43.Loop();
+    Battery.Loop();
+    WarmStart.Loop();
+    s_mcu.Serve();
+  }
+}
+
+// Cold boot with given flash contents, returns restored discharge rate or 0
+int Boot(const std::map<std::string, std::string>& files)
+{
+  memset(ESP.RtcMemory, 0, sizeof(ESP.RtcMemory));
+  SPIFFS.Files = files;
+  Battery = BatteryClass();
+  return WarmStart.Restore() ? Battery.GetRateX100() : 0;
+}
+}
+
+int main()
+{
+  s_mcu.Battery = 60;
+  AM43.Init(&s_mcu);
+
+  // Two snapshots with different discharge series
+  Run(4 * BATTERY_SAMPLE_MS - 60000, 4);
+  CHECK(SPIFFS.exists(s_final));
+  CHECK(!SPIFFS.exists(s_tmp));
+  const std::string older = SPIFFS.Files[s_final];
+  Run(4 * BATTERY_SAMPLE_MS, 12);
+  const std::string newer = SPIFFS.Files[s_final];
+  CHECK(older != newer);
+
+  const int older_rate = Boot({{s_final, older}});
+  const int newer_rate = Boot({{s_final, newer}});
+  CHECK(older_rate != 0 && newer_rate != 0 && older_rate != newer_rate);
+
+  // Power lost after temporary file is written, before old snapshot is removed
+  CHECK_EQ(Boot({{s_final, older}, {s_tmp, newer}}), newer_rate);
+  // Power lost after old snapshot is removed, before rename
+  CHECK_EQ(Boot({{s_tmp, newer}}), newer_rate);
+  // Power lost while temporary file is written
+  CHECK_EQ(Boot({{s_final, older}, {s_tmp, newer.substr(0, newer.size() / 2)}}), older_rate);
+  // Nothing usable
+  CHECK_EQ(Boot({{s_tmp, newer.substr(0, 10)}}), 0);
+  CHECK_EQ(Boot({}), 0);
+
+  // Next write replaces both files with single snapshot
+  SPIFFS.Files = {{s_final, older}, {s_tmp, newer}};
+  Run(WARMSTART_FLASH_MS + BATTERY_SAMPLE_MS, 6);
+  CHECK(SPIFFS.exists(s_final));
+  CHECK(!SPIFFS.exists(s_tmp));
+
+  return Test::Result("warmstart");
+}